@@ -11,4 +11,8 @@
 
 #define APP_TFTP	1
 
+/* frames handled by one pass of the main loop before the timers get
+ their turn */
+#define APP_RX_BUDGET	8
+
 #endif //_APP_CONFIG_H
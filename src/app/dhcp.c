@@ -345,6 +345,8 @@ uint8_t dhcp_start(dhcp_callback_t callback)
 	ip_init((const ip_address*)&dhcp_client.addr,
 		(const ip_address*)&dhcp_client.netmask,
 		(const ip_address*)&dhcp_client.gateway);		
+	/* let broadcast replies of the servers through the receive filter */
+	ethernet_rx_accept(ETHERNET_RX_ACCEPT_DHCP,1);
 	dhcp_client.state = dhcp_state_init;
 	dhcp_client.callback = callback;
 	/* start on the next timeout */
@@ -435,6 +437,7 @@ static void dhcp_udp_callback(udp_socket_t socket,uint8_t * data,uint16_t len)
 			ip_init((const ip_address*)&dhcp_client.addr,
 				(const ip_address*)&dhcp_client.netmask,
 				(const ip_address*)&dhcp_client.gateway);
+			ethernet_rx_accept(ETHERNET_RX_ACCEPT_DHCP,0);
 			timer_set(dhcp_client.timer,(dhcp_client.time_rebind*1000), TIMER_MODE_ONE_SHOT);
 			dhcp_client.state = dhcp_state_bound;
 			dhcp_client.callback(dhcp_event_lease_acquired);
@@ -486,6 +489,7 @@ static void dhcp_timer_callback(timer_t timer,void * arg)
 		{
 			dhcp_client.state = dhcp_state_rebinding;
 			dhcp_client.rtx = 0xff;
+			ethernet_rx_accept(ETHERNET_RX_ACCEPT_DHCP,1);
 		}
 		case dhcp_state_rebinding:
 		case dhcp_state_requesting:
@@ -705,6 +709,7 @@ void dhcp_stop(void)
 }
 void dhcp_free(void)
 {
+	ethernet_rx_accept(ETHERNET_RX_ACCEPT_DHCP,0);
 	udp_socket_free(dhcp_client.socket);
 	timer_free(dhcp_client.timer);
 	memset(&dhcp_client,0,sizeof(dhcp_client));
@@ -11,6 +11,7 @@
 #include "../net/ethernet.h"
 #include "../net/ip.h"
 #include "../net/arp.h"
+#include "../net/icmp.h"
 #include "../net/udp.h"
 #include "../net/tcp.h"
 
@@ -32,6 +33,7 @@ uint8_t netstat(FILE * fh,uint8_t args)
 	if(args&(1<<NETSTAT_OPT_IFACE))
 	{ 
 		const struct ethernet_stats * eth_stat = ethernet_get_stats();
+		const struct pbuf_stats * pbuf_stat = pbuf_get_stats();
 		fprintf_P(fh,PSTR("HW addr: "));
 		fprintf(fh,"%s\n",ethernet_addr_str(ethernet_get_mac()));
 		fprintf_P(fh,PSTR("MTU    : "));
@@ -40,6 +42,12 @@ uint8_t netstat(FILE * fh,uint8_t args)
 		fprintf(fh,"%u\n",(unsigned int)eth_stat->rx_packets);
 		fprintf_P(fh,PSTR("TX pack: "));
 		fprintf(fh,"%u\n",(unsigned int)eth_stat->tx_packets);
+		fprintf_P(fh,PSTR("Buffers: "));
+		fprintf(fh,"%u/%u used, %u max, %u alloc failures\n",
+			(unsigned int)pbuf_stat->used,
+			(unsigned int)PBUF_COUNT,
+			(unsigned int)pbuf_stat->used_max,
+			(unsigned int)pbuf_stat->alloc_failures);
 		netstat_dashes(fh,NETSTAT_NDASHES);
 	}
 	if(args&(1<<NETSTAT_OPT_IP))
@@ -61,6 +69,13 @@ uint8_t netstat(FILE * fh,uint8_t args)
 		fprintf_P(fh,PSTR("\n"));
 		netstat_dashes(fh,NETSTAT_NDASHES);
 	}
+#if NET_ICMP
+	if(args&(1<<NETSTAT_OPT_ICMP))
+	{
+		icmp_print_stat(fh);
+		netstat_dashes(fh,NETSTAT_NDASHES);
+	}
+#endif
 	if(args&(1<<NETSTAT_OPT_UDP) || args&(1<<NETSTAT_OPT_TCP))
 	{
 		fprintf_P(fh,PSTR("%-5S %5S %5S %-21S %-21S %S\n"),
@@ -18,6 +18,7 @@
 #define NETSTAT_OPT_ARP		2
 #define NETSTAT_OPT_UDP		3
 #define NETSTAT_OPT_TCP		4
+#define NETSTAT_OPT_ICMP	5
 
 uint8_t netstat(FILE * fh,uint8_t args);
 
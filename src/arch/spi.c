@@ -84,22 +84,61 @@ uint8_t spi_read(uint8_t data)
 	return (uint8_t)SPI_DATA;
 }
 /**
-* Writess a block of bytes to the SPI bus
+* Writess a block of bytes to the SPI bus. The next byte is loaded and
+* the loop bookkeeping is done while the current byte is being shifted
+* out, so the bus is restarted right after SPIF is set.
 * @param[in] data Pointer to data to write
 * @param[in] len Length of data
 * @returns 0 on success
 */
 uint8_t spi_write_block(uint8_t * data,uint16_t len)
 {
-	while(len--)
+	uint8_t next;
+
+	if(!len)
+	{
+		return 0;
+	}
+	SPI_DATA = *(data++);
+	while(--len)
+	{
+		next = *(data++);
+		SPI_WAIT();
+		SPI_DATA = next;
+	}
+	SPI_WAIT();
+	return 0;
+}
+/**
+* Writes a block of bytes stored in program memory to the SPI bus like
+* spi_write_block()
+* @param[in] data Pointer to data in program memory
+* @param[in] len Length of data
+* @returns 0 on success
+*/
+uint8_t spi_write_block_P(const prog_uint8_t * data,uint16_t len)
+{
+	uint8_t next;
+
+	if(!len)
 	{
-		SPI_DATA = *(data++);
+		return 0;
+	}
+	SPI_DATA = pgm_read_byte(data++);
+	while(--len)
+	{
+		next = pgm_read_byte(data++);
 		SPI_WAIT();
+		SPI_DATA = next;
 	}
+	SPI_WAIT();
 	return 0;
 }
 /**
-* Reads a block of bytes from the SPI bus
+* Reads a block of bytes from the SPI bus. The received byte is taken
+* from the (double buffered) data register and the next transfer is
+* started immediately, storing the byte and the loop bookkeeping overlap
+* the next byte's shift.
 * @param[in] data Pointer to data to write
 * @param[in] len Length of data
 * @param[in] bus Value which will be on the MOSI bus while reading
@@ -107,12 +146,22 @@ uint8_t spi_write_block(uint8_t * data,uint16_t len)
 */
 uint8_t spi_read_block(uint8_t * data,uint16_t len,uint8_t bus)
 {
-	while(len--)
+	uint8_t received;
+
+	if(!len)
+	{
+		return 0;
+	}
+	SPI_DATA = bus;
+	while(--len)
 	{
-		SPI_DATA = bus;
 		SPI_WAIT();
-		*(data++) = (uint8_t)SPI_DATA;
+		received = SPI_DATA;
+		SPI_DATA = bus;
+		*(data++) = received;
 	}
+	SPI_WAIT();
+	*data = (uint8_t)SPI_DATA;
 	return 0;
 }
 /**
@@ -24,9 +24,21 @@
 
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include "spi_config.h"
 
+#if HAL_HOST
+#include "../host/spi_host.h"
+/**
+* Clocks the data byte through the emulated device
+*/
+#define SPI_WAIT()	spi_host_transfer()
+/**
+* SPI data byte register
+*/
+#define SPI_DATA	spi_host_data
+#else
 /**
 * Waits for sending or receiving data byte
 */
@@ -35,6 +47,7 @@
 * SPI data byte register
 */
 #define SPI_DATA	SPDR
+#endif //HAL_HOST
 /**
 * Enables SPI interface
 */
@@ -50,6 +63,7 @@ void spi_high_frequency(void);
 void spi_write(uint8_t data);
 uint8_t spi_read(uint8_t data);
 uint8_t spi_write_block(uint8_t * data,uint16_t len);
+uint8_t spi_write_block_P(const prog_uint8_t * data,uint16_t len);
 uint8_t spi_read_block(uint8_t * data,uint16_t len,uint8_t bus);
 
 /**
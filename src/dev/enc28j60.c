@@ -11,9 +11,44 @@
 #include "../debug.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <string.h>
 
-static uint8_t	enc28j60_bank;
+/* ECON1 bits changed only by the driver: BSEL1:0 and CSUMEN */
+static uint8_t	enc28j60_econ1;
+/* values of the pointer register pairs of bank 0 indexed by address/2,
+ the read and write pointers follow the buffer memory accesses */
+static uint16_t enc28j60_ptr[EDMADSTL/2];
+/* frames counted by the last EPKTCNT read which were not released yet */
+static uint8_t enc28j60_rx_count;
+/* the last transmission was aborted, the transmit logic has to be reset */
+static uint8_t enc28j60_tx_error;
 static uint16_t enc28j60_next_packet_ptr;
+/* buffer memory address of the frame being processed */
+static uint16_t enc28j60_rx_frame_ptr;
+
+/**
+* Frame queued in the transmit ring
+*/
+struct enc28j60_tx_frame
+{
+	/* buffer memory address of the per-packet control byte */
+	uint16_t start;
+	/* frame length */
+	uint16_t len;
+};
+
+static struct enc28j60_tx_frame enc28j60_tx_queue[ENC28J60_TX_QUEUE_LEN];
+/* queue index of the frame being transmitted */
+static uint8_t enc28j60_tx_head;
+/* number of queued frames including the one being transmitted */
+static uint8_t enc28j60_tx_count;
+/* buffer memory address where the next frame is written */
+static uint16_t enc28j60_tx_write_ptr;
+
+#if ENC28J60_RTX_SIZE
+/* frames kept in the retransmission area, unused if len is 0 */
+static struct enc28j60_tx_frame enc28j60_rtx_frames[ENC28J60_RTX_FRAMES];
+#endif
 
 uint8_t enc28j60_read_op(uint8_t op,uint8_t addr)
 {
@@ -61,18 +96,17 @@ void enc28j60_read_buffer(uint16_t len,uint8_t * data)
 	SPI_DATA = ENC28J60_OPC_RBM;
 	SPI_WAIT();
 	
-	while(len)
-	{
-		len--;
-		//read data
-		SPI_DATA = 0x00;
-			SPI_WAIT();
-			*data = SPI_DATA;
-			data++;
-	}
-	*data = '\0';
+	spi_read_block(data,len,0x00);
 	
 	ENC28J60_CS_INACTIVE();
+	
+	// the read pointer wraps at the end of the receive buffer
+	len += enc28j60_ptr[ERDPTL/2];
+	if(enc28j60_ptr[ERDPTL/2] <= ENC28J60_RXSTOP_INIT && len > ENC28J60_RXSTOP_INIT)
+	{
+		len -= ENC28J60_RXSTOP_INIT - ENC28J60_RXSTART_INIT + 1;
+	}
+	enc28j60_ptr[ERDPTL/2] = len;
 }
 
 void enc28j60_write_buffer(uint16_t len,uint8_t * data)
@@ -82,28 +116,37 @@ void enc28j60_write_buffer(uint16_t len,uint8_t * data)
 	SPI_DATA = ENC28J60_OPC_WBM;
 	SPI_WAIT();
 	
-	while(len)
-	{
-			len--;
-			
-			//write data
-			SPI_DATA = *data;
-			SPI_WAIT();
-			data++;
-	}
+	spi_write_block(data,len);
 	
 	ENC28J60_CS_INACTIVE();
+	enc28j60_ptr[EWRPTL/2] += len;
 }
 
+/**
+* Selects the bank of the register. The common registers (EIE, EIR,
+* ESTAT, ECON2, ECON1) are present in every bank, other registers cost
+* one BFC and/or BFS of the BSEL bits only if the bank changes.
+*/
 void enc28j60_set_bank(uint8_t addr)
 {
-	uint8_t address = (addr & ENC28J60_BANK_MASK);
-	if( address != enc28j60_bank)
+	uint8_t bank = (addr & ENC28J60_BANK_MASK) >> 5;
+	uint8_t bits;
+	
+	if((addr & ENC28J60_ADDR_MASK) >= EIE)
 	{
-		enc28j60_write_op(ENC28J60_OPC_BFC,ECON1,(ECON1_BSEL0|ECON1_BSEL1));
-		enc28j60_write_op(ENC28J60_OPC_BFS,ECON1,address>>5);
-		enc28j60_bank = address;
+		return;
 	}
+	bits = enc28j60_econ1 & ~bank & (ECON1_BSEL0|ECON1_BSEL1);
+	if(bits)
+	{
+		enc28j60_write_op(ENC28J60_OPC_BFC,ECON1,bits);
+	}
+	bits = bank & ~enc28j60_econ1;
+	if(bits)
+	{
+		enc28j60_write_op(ENC28J60_OPC_BFS,ECON1,bits);
+	}
+	enc28j60_econ1 = (enc28j60_econ1 & ~(ECON1_BSEL0|ECON1_BSEL1)) | bank;
 }
 
 uint8_t enc28j60_read(uint8_t addr)
@@ -118,6 +161,43 @@ void enc28j60_write(uint8_t addr,uint8_t data)
 	enc28j60_write_op(ENC28J60_OPC_WCR,addr,data);
 }
 
+/**
+* Writes the register pair, low byte first. Bytes of the read, write,
+* transmit, receive buffer and DMA pointers which already hold the value
+* are skipped unless force is set.
+*/
+static void enc28j60_write_ptr(uint8_t addr,uint16_t data,uint8_t force)
+{
+	uint16_t changed = 0xffff;
+	
+	// ERXRDPT takes effect when its high byte is written, ERXWRPT is read only
+	if(!(addr & ENC28J60_BANK_MASK) && addr < EDMADSTL && (addr & ~0x03) != ERXRDPTL)
+	{
+		if(!force)
+		{
+			changed = enc28j60_ptr[addr/2] ^ data;
+		}
+		enc28j60_ptr[addr/2] = data;
+	}
+	if(changed & 0x00ff)
+	{
+		enc28j60_write(addr,data&0xff);
+	}
+	if(changed & 0xff00)
+	{
+		enc28j60_write(addr+1,data>>8);
+	}
+}
+
+/**
+* Writes a 16-bit register pair, the pointers must only be written with
+* this function
+*/
+void enc28j60_write16(uint8_t addr,uint16_t data)
+{
+	enc28j60_write_ptr(addr,data,0);
+}
+
 void enc28j60_phy_write(uint8_t addr,uint16_t data)
 {
 	//set the PHY register address
@@ -180,6 +260,8 @@ void enc28j60_init(const uint8_t * macaddr)
 	enc28j60_reset();
 	ENC28J60_CS_INACTIVE();
 	enc28j60_write_op(ENC28J60_OPC_RES,0,ENC28J60_OPC_RES);
+	// the reset selects bank 0 and clears CSUMEN
+	enc28j60_econ1 = 0;
 	_delay_ms(50);
 	
 	// BANK 0 STUFF
@@ -187,48 +269,36 @@ void enc28j60_init(const uint8_t * macaddr)
 	// 16-bit transfers, must write low byte first
 	// set receive buffer start address
 	enc28j60_next_packet_ptr = ENC28J60_RXSTART_INIT;
+	enc28j60_rx_count = 0;
 	//Rx start
-	enc28j60_write(ERXSTL,ENC28J60_RXSTART_INIT&0xff);
-	enc28j60_write(ERXSTH,ENC28J60_RXSTART_INIT>>8);
+	enc28j60_write_ptr(ERXSTL,ENC28J60_RXSTART_INIT,1);
 	//set receive pointer address
-	enc28j60_write(ERXRDPTL,ENC28J60_RXSTART_INIT&0xff);
-	enc28j60_write(ERXRDPTH,ENC28J60_RXSTART_INIT>>8);
+	enc28j60_write_ptr(ERXRDPTL,ENC28J60_RXSTART_INIT,1);
 	//Rx end
-	enc28j60_write(ERXNDL,ENC28J60_RXSTOP_INIT&0xff);
-	enc28j60_write(ERXNDH,ENC28J60_RXSTOP_INIT>>8);
+	enc28j60_write_ptr(ERXNDL,ENC28J60_RXSTOP_INIT,1);
 	//Tx start
-	enc28j60_write(ETXSTL,ENC28J60_TXSTART_INIT&0xff);
-	enc28j60_write(ETXSTH,ENC28J60_TXSTART_INIT>>8);
+	enc28j60_write_ptr(ETXSTL,ENC28J60_TXSTART_INIT,1);
 	//Tx end
-	enc28j60_write(ETXNDL,ENC28J60_TXSTOP_INIT&0xff);
-	enc28j60_write(ETXNDH,ENC28J60_TXSTOP_INIT>>8);
+	enc28j60_write_ptr(ETXNDL,ENC28J60_TXSTOP_INIT,1);
+	// load the shadows of the other pointers
+	enc28j60_write_ptr(ERDPTL,ENC28J60_RXSTART_INIT,1);
+	enc28j60_write_ptr(EWRPTL,ENC28J60_TXSTART_INIT,1);
+	enc28j60_write_ptr(EDMASTL,ENC28J60_RXSTART_INIT,1);
+	enc28j60_write_ptr(EDMANDL,ENC28J60_RXSTART_INIT,1);
+	enc28j60_tx_error = 0;
+	enc28j60_tx_head = 0;
+	enc28j60_tx_count = 0;
+	enc28j60_tx_write_ptr = ENC28J60_TXSTART_INIT;
+#if ENC28J60_RTX_SIZE
+	memset(enc28j60_rtx_frames,0,sizeof(enc28j60_rtx_frames));
+#endif
 	
 	
 	// BANK 1 STUFF
-	// For broadcast packets we allow only ARP packtets
-	// All other packets should be unicast only for our mac (MAADR)
-	//
-	// The pattern to match on is therefore
-	// Type		 ETH.DST
-	// ARP			BROADCAST
-	// 06 08 -- ff ff ff ff ff ff -> ip checksum for theses bytes=f7f9
-	// in binary these poitions are:11 0000 0011 1111
-	// This is hex 303F->EPMM0=0x3f,EPMM1=0x30
-//	 enc28j60_write(ERXFCON, ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_PMEN);
-//	 enc28j60_write(EPMM0, 0x3f);
-//	 enc28j60_write(EPMM1, 0x30);
-//	 enc28j60_write(EPMCSL, 0xf9);
-//	 enc28j60_write(EPMCSH, 0xf7);
-//	/* configure frame filters */
-	enc28j60_write(ERXFCON, (ERXFCON_UCEN)	| /* accept unicast packets */
-				(ERXFCON_CRCEN) | /* accept packets with valid CRC only */
-// 				(0 << ERXFCON_PMEN)	| /* no pattern matching */
-// 				(0 << ERXFCON_MPEN)	| /* ignore magic packets */
-// 				(0 << ERXFCON_HTEN)	| /* disable hash table filter */
-// 				(0 << ERXFCON_MCEN)	| /* ignore multicast packets */
-				(ERXFCON_BCEN)	 /* accept broadcast packets */
-// 				(0 << ERXFCON_ANDOR)	 /* packets must meet at least one criteria */
-		);
+	// accept unicast and broadcast frames until the stack programs the
+	// filters with enc28j60_rx_filter()
+	enc28j60_rx_hash_clear();
+	enc28j60_rx_filter(ERXFCON_UCEN|ERXFCON_BCEN);
 	// BANK 2 STUFF
 	// enable MAC receive
 	enc28j60_write(MACON1, MACON1_MARXEN|MACON1_TXPAUS|MACON1_RXPAUS);
@@ -263,12 +333,10 @@ void enc28j60_init(const uint8_t * macaddr)
 					(PHLCON_STRCH_TIME_73MS<<PHLCON_STRCH_TIME)|
 					(1<<PHLCON_STRCH)
 					);
-	
-	// switch to bank 0
-	enc28j60_set_bank(ECON1);
+
 	// enable interrutps
 //	 enc28j60_phy_write(PHIE,(1<<PHIE_PLNKIE)|(1<<PHIE_PGEIE));
-	enc28j60_write_op(ENC28J60_OPC_BFS, EIE, EIE_INTIE|EIE_PKTIE/*|EIE_LINKIE*/);
+	enc28j60_write_op(ENC28J60_OPC_BFS, EIE, EIE_INTIE|EIE_PKTIE|EIE_TXIE/*|EIE_LINKIE*/);
 	// enable packet reception
 	enc28j60_write_op(ENC28J60_OPC_BFS, ECON1, ECON1_RXEN);
 	_delay_ms(100);
@@ -279,87 +347,820 @@ uint8_t	enc28j60_get_revision(void)
 	return enc28j60_read(EREVID);
 }
 
-uint8_t	enc28j60_send_packet(uint8_t * packet,uint16_t len)
+/**
+* Sets the receive filters (ERXFCON_* flags), a frame is accepted if it
+* passes any of the enabled filters. Frames with invalid CRC are always
+* dropped.
+*/
+void enc28j60_rx_filter(uint8_t filters)
+{
+	enc28j60_write(ERXFCON,(filters & ~ERXFCON_ANDOR)|ERXFCON_CRCEN);
+}
+
+/**
+* Programs the pattern match filter (ERXFCON_PMEN). The window of 64 bytes
+* starts offset bytes into the frame, bit n of the 8 byte mask selects byte
+* n of the window. The data holds the len selected bytes in order, the
+* controller compares their checksum with the one written to EPMCS.
+*/
+void enc28j60_rx_pattern(uint16_t offset,const uint8_t * mask,const uint8_t * data,uint8_t len)
+{
+	uint32_t sum = 0;
+	uint8_t i;
+
+	for(i = 0 ; i < len ; i++)
+	{
+		sum += (i & 1) ? data[i] : ((uint16_t)data[i] << 8);
+	}
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	sum = ~sum;
+	for(i = 0 ; i < 8 ; i++)
+	{
+		enc28j60_write(EPMM0 + i,mask[i]);
+	}
+	enc28j60_write(EPMCSL,sum & 0xff);
+	enc28j60_write(EPMCSH,(sum >> 8) & 0xff);
+	enc28j60_write(EPMOL,offset & 0xff);
+	enc28j60_write(EPMOH,offset >> 8);
+}
+
+/**
+* Clears the hash table filter (ERXFCON_HTEN)
+*/
+void enc28j60_rx_hash_clear(void)
+{
+	uint8_t i;
+
+	for(i = 0 ; i < 8 ; i++)
+	{
+		enc28j60_write(EHT0 + i,0);
+	}
+}
+
+/**
+* Lets frames sent to the (multicast) address pass the hash table filter.
+* Bits 28:23 of the Ethernet CRC of the address select the table bit, so
+* other addresses with the same hash pass as well.
+*/
+void enc28j60_rx_hash_add(const uint8_t * mac)
+{
+	uint32_t crc = 0xffffffff;
+	uint8_t i,j,bit;
+
+	for(i = 0 ; i < 6 ; i++)
+	{
+		uint8_t data = mac[i];
+
+		for(j = 0 ; j < 8 ; j++)
+		{
+			uint8_t carry = ((crc >> 31) ^ data) & 1;
+
+			crc <<= 1;
+			data >>= 1;
+			if(carry)
+			{
+				crc ^= 0x04c11db7;
+			}
+		}
+	}
+	bit = (crc >> 23) & 0x3f;
+	enc28j60_set_bits(EHT0 + (bit >> 3),1 << (bit & 7));
+}
+
+/**
+* Returns address of the oldest queued frame which lies in the transmit
+* ring or 0 if there is none, queued frames kept in the retransmission
+* area do not take ring space
+*/
+static uint16_t enc28j60_tx_ring_head(void)
+{
+	uint8_t i = enc28j60_tx_head;
+	uint8_t n;
+	
+	for(n = enc28j60_tx_count ; n ; n--)
+	{
+		if(enc28j60_tx_queue[i].start >= ENC28J60_TXSTART_INIT)
+		{
+			return enc28j60_tx_queue[i].start;
+		}
+		if(++i == ENC28J60_TX_QUEUE_LEN)
+		{
+			i = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+* Reserves space for a frame of len bytes, its control byte and its
+* transmit status vector in the transmit ring. Frames never wrap, if the
+* space left at the end of the ring is too small the frame is placed at
+* its start.
+* @returns Buffer memory address of the reserved space or 0 if the ring
+* or the queue is full
+*/
+static uint16_t enc28j60_tx_alloc(uint16_t len)
+{
+	uint16_t size = ENC28J60_TX_FRAME_SIZE(len);
+	uint16_t head;
+	uint16_t start;
+	
+	if(enc28j60_tx_count >= ENC28J60_TX_QUEUE_LEN)
+	{
+		return 0;
+	}
+	head = enc28j60_tx_ring_head();
+	if(!head)
+	{
+		enc28j60_tx_write_ptr = ENC28J60_TXSTART_INIT;
+	}
+	else
+	{
+		// the write pointer never catches up with the head, it is
+		// below the head only if the ring has wrapped
+		if(enc28j60_tx_write_ptr > head)
+		{
+			if(size > ENC28J60_TXSTOP_INIT + 1 - enc28j60_tx_write_ptr)
+			{
+				if(size >= head - ENC28J60_TXSTART_INIT)
+				{
+					return 0;
+				}
+				enc28j60_tx_write_ptr = ENC28J60_TXSTART_INIT;
+			}
+		}
+		else if(size >= head - enc28j60_tx_write_ptr)
+		{
+			return 0;
+		}
+	}
+	start = enc28j60_tx_write_ptr;
+	enc28j60_tx_write_ptr += size;
+	return start;
+}
+
+/**
+* Returns length of the frame made of the spans
+*/
+static uint16_t enc28j60_span_len(const struct enc28j60_span * spans,uint8_t count)
+{
+	uint16_t len = 0;
+	
+	while(count--)
+	{
+		len += (spans++)->len;
+	}
+	return len;
+}
+
+/**
+* Copies the frame made of the spans into the transmit buffer at start
+*/
+static void enc28j60_tx_load(uint16_t start,const struct enc28j60_span * spans,uint8_t count)
 {
-	/* wait until previous packet was sent */
-	// while(enc28j60_read(ECON1) & (1 << ECON1_TXRTS));
-	// Set the write pointer to start of transmit buffer area
-	enc28j60_write(EWRPTL,ENC28J60_TXSTART_INIT&0xff);
-	enc28j60_write(EWRPTH,ENC28J60_TXSTART_INIT>>8);
-	// Set the TXND pointer to correspond to the packet size given 
-	enc28j60_write(ETXNDL,(ENC28J60_TXSTART_INIT+len)&0xff);
-	enc28j60_write(ETXNDH,(ENC28J60_TXSTART_INIT+len)>>8);
+	uint16_t len = 0;
+	
+	// Set the write pointer to the reserved space
+	enc28j60_write16(EWRPTL,start);
+	ENC28J60_CS_ACTIVE();
+	SPI_DATA = ENC28J60_OPC_WBM;
+	SPI_WAIT();
 	// write per-packet control byte (0x00 means use macon3 settings)
-	enc28j60_write_op(ENC28J60_OPC_WBM,0,0x00);
-	// copy the packet into the transmit buffer
-	enc28j60_write_buffer(len,packet);
+	SPI_DATA = 0x00;
+	SPI_WAIT();
+	// stream the pieces of the packet in the same transaction
+	for( ; count ; count--,spans++)
+	{
+		if(spans->pgm)
+		{
+			spi_write_block_P((const prog_uint8_t*)spans->data,spans->len);
+		}
+		else
+		{
+			spi_write_block((uint8_t*)spans->data,spans->len);
+		}
+		len += spans->len;
+	}
+	ENC28J60_CS_INACTIVE();
+	enc28j60_ptr[EWRPTL/2] += 1 + len;
+}
+
+/**
+* Starts transmission of the frame at the head of the queue
+*/
+static void enc28j60_tx_kick(void)
+{
+	struct enc28j60_tx_frame * frame = &enc28j60_tx_queue[enc28j60_tx_head];
+	uint16_t end = frame->start + frame->len;
+	
+	// Reset the transmit logic problem after an aborted transmission.
+	// See Rev. B4 Silicon Errata point 12.
+	if(enc28j60_tx_error)
+	{
+		enc28j60_write_op(ENC28J60_OPC_BFS, ECON1, ECON1_TXRST);
+		enc28j60_write_op(ENC28J60_OPC_BFC, ECON1, ECON1_TXRST);
+		enc28j60_tx_error = 0;
+	}
+	enc28j60_write_op(ENC28J60_OPC_BFC, EIR, EIR_TXIF|EIR_TXERIF);
+	enc28j60_write16(ETXSTL,frame->start);
+	enc28j60_write16(ETXNDL,end);
 	// send the contents of the transmit buffer onto the network
 	enc28j60_write_op(ENC28J60_OPC_BFS, ECON1, ECON1_TXRTS);
-	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-	if( (enc28j60_read(EIR) & EIR_TXERIF) ){
+}
+
+/**
+* Queues the frame written at start, it is sent at once if the
+* controller is idle
+*/
+static uint8_t enc28j60_tx_enqueue(uint16_t start,uint16_t len)
+{
+	uint8_t tail = enc28j60_tx_head + enc28j60_tx_count;
+	
+	if(tail >= ENC28J60_TX_QUEUE_LEN)
+	{
+		tail -= ENC28J60_TX_QUEUE_LEN;
+	}
+	enc28j60_tx_queue[tail].start = start;
+	enc28j60_tx_queue[tail].len = len;
+	if(!enc28j60_tx_count++)
+	{
+		enc28j60_tx_kick();
+	}
+	return 1;
+}
+
+/**
+* Releases the frame at the head of the queue and starts the next one
+*/
+static void enc28j60_tx_next(void)
+{
+	if(++enc28j60_tx_head == ENC28J60_TX_QUEUE_LEN)
+	{
+		enc28j60_tx_head = 0;
+	}
+	if(--enc28j60_tx_count)
+	{
+		enc28j60_tx_kick();
+	}
+	else
+	{
+		// nothing to send, release the interrupt line
+		enc28j60_write_op(ENC28J60_OPC_BFC, EIR, EIR_TXIF|EIR_TXERIF);
+	}
+}
+
+/**
+* Waits until the frame at the head of the queue is done. If it is not
+* done within ENC28J60_TX_TIMEOUT_POLLS, the transmission is aborted, the
+* transmit logic is reset and the frame is dropped.
+* @returns 0 if the frame was dropped
+*/
+static uint8_t enc28j60_tx_wait(void)
+{
+	uint8_t count = enc28j60_tx_count;
+	uint16_t polls;
+	
+	for(polls = ENC28J60_TX_TIMEOUT_POLLS ; polls ; polls--)
+	{
+		enc28j60_tx_service();
+		if(enc28j60_tx_count != count)
+		{
+			return 1;
+		}
+		_delay_us(ENC28J60_TX_POLL_US);
+	}
+	// See Rev. B4 Silicon Errata point 12.
+	enc28j60_write_op(ENC28J60_OPC_BFC, ECON1, ECON1_TXRTS);
+	enc28j60_write_op(ENC28J60_OPC_BFS, ECON1, ECON1_TXRST);
+	enc28j60_write_op(ENC28J60_OPC_BFC, ECON1, ECON1_TXRST);
+	enc28j60_tx_error = 0;
+	enc28j60_tx_next();
+	return 0;
+}
+
+/**
+* Waits for space of len bytes frame in the transmit ring while the
+* controller sends the queued frames
+* @returns Buffer memory address or 0 if a stalled transmission had to be
+* aborted
+*/
+static uint16_t enc28j60_tx_reserve(uint16_t len)
+{
+	uint16_t start;
+	
+	while(!(start = enc28j60_tx_alloc(len)))
+	{
+		if(!enc28j60_tx_wait())
+		{
+			return 0;
+		}
+	}
+	return start;
+}
+
+/**
+* Releases the transmitted frame and starts the next queued one. Called
+* on the TXIF interrupt and when waiting for space in the transmit ring.
+*/
+void enc28j60_tx_service(void)
+{
+	uint8_t eir;
+	
+	if(!enc28j60_tx_count)
+	{
+		return;
+	}
+	// TXIF or TXERIF are set when the frame is done, they were cleared
+	// when the transmission started
+	eir = enc28j60_read(EIR);
+	if(!(eir & (EIR_TXIF|EIR_TXERIF)))
+	{
+		return;
+	}
+	if(eir & EIR_TXERIF)
+	{
+		// the transmission stays pending after a late collision
+		// See Rev. B4 Silicon Errata point 12.
 		enc28j60_write_op(ENC28J60_OPC_BFC, ECON1, ECON1_TXRTS);
+		enc28j60_tx_error = 1;
 	}
+	enc28j60_tx_next();
+}
+
+/**
+* Returns number of frames not yet released by enc28j60_tx_service()
+*/
+uint8_t enc28j60_tx_pending(void)
+{
+	return enc28j60_tx_count;
+}
+
+/**
+* Lets the DMA compute the Internet checksum of the tail of the frame
+* loaded at start and stores it into the checksum field
+*/
+static void enc28j60_tx_checksum(uint16_t start,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint16_t addr = start + 1 + csum_start;
+	uint16_t checksum = enc28j60_checksum(addr,len - csum_start);
+	uint8_t data[2] = {checksum>>8,checksum&0xff};
 	
-	return 1;
+	enc28j60_write16(EWRPTL,addr + csum_offset);
+	enc28j60_write_buffer(sizeof(data),data);
 }
 
-uint16_t enc28j60_receive_packet(uint8_t * packet,uint16_t maxlen)
+uint8_t	enc28j60_send_packet(uint8_t * packet,uint16_t len)
+{
+	struct enc28j60_span span = {packet,len,0};
+	
+	return enc28j60_send_gather(&span,1,0,0);
+}
+
+/**
+* Sends packet and lets the DMA compute the Internet checksum of its
+* tail starting at csum_start. The 16-bit word at csum_start+csum_offset
+* must hold the initial (pseudo header) sum, it is replaced by the
+* result before transmission.
+*/
+uint8_t	enc28j60_send_packet_csum(uint8_t * packet,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	struct enc28j60_span span = {packet,len,0};
+	
+	return enc28j60_send_gather(&span,1,csum_start,csum_offset);
+}
+
+/**
+* Sends frame made of count spans like enc28j60_send_packet_csum()
+* (csum_offset 0 means no checksum). Each span is written straight from
+* its memory, the frame is never assembled in RAM.
+*/
+uint8_t	enc28j60_send_gather(const struct enc28j60_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint16_t len = enc28j60_span_len(spans,count);
+	uint16_t start = enc28j60_tx_reserve(len);
+
+	if(!start)
+	{
+		return 0;
+	}
+	enc28j60_tx_load(start,spans,count);
+	if(csum_offset)
+	{
+		enc28j60_tx_checksum(start,len,csum_start,csum_offset);
+	}
+	return enc28j60_tx_enqueue(start,len);
+}
+
+#if ENC28J60_RTX_SIZE
+/**
+* Returns 1 if the frame at start waits in the queue or is being sent
+*/
+static uint8_t enc28j60_tx_queued(uint16_t start)
+{
+	uint8_t i = enc28j60_tx_head;
+	uint8_t n;
+	
+	for(n = enc28j60_tx_count ; n ; n--)
+	{
+		if(enc28j60_tx_queue[i].start == start)
+		{
+			return 1;
+		}
+		if(++i == ENC28J60_TX_QUEUE_LEN)
+		{
+			i = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+* First fit allocation of a frame of len bytes in the retransmission
+* area. Candidates are the start of the area and the end of every kept
+* frame.
+* @returns Buffer memory address or 0 if there is no space
+*/
+static uint16_t enc28j60_rtx_alloc(uint16_t len)
 {
-	uint16_t rxstatus;
-	uint16_t rxlen=0;
+	uint16_t size = ENC28J60_TX_FRAME_SIZE(len);
+	uint16_t start;
+	struct enc28j60_tx_frame * frame;
+	struct enc28j60_tx_frame * other;
+	uint8_t i;
+	
+	for(i = 0 ; i <= ENC28J60_RTX_FRAMES ; i++)
+	{
+		if(!i)
+		{
+			start = ENC28J60_RTXSTART_INIT;
+		}
+		else
+		{
+			frame = &enc28j60_rtx_frames[i-1];
+			if(!frame->len)
+			{
+				continue;
+			}
+			start = frame->start + ENC28J60_TX_FRAME_SIZE(frame->len);
+		}
+		if(size > ENC28J60_RTXSTOP_INIT + 1 - start)
+		{
+			continue;
+		}
+		for(other = &enc28j60_rtx_frames[0] ; other < &enc28j60_rtx_frames[ENC28J60_RTX_FRAMES] ; other++)
+		{
+			if(other->len && start < other->start + ENC28J60_TX_FRAME_SIZE(other->len) && other->start < start + size)
+			{
+				break;
+			}
+		}
+		if(other == &enc28j60_rtx_frames[ENC28J60_RTX_FRAMES])
+		{
+			return start;
+		}
+	}
+	return 0;
+}
+
+/**
+* Returns kept frame or 0 if frame is not a valid handle
+*/
+static struct enc28j60_tx_frame * enc28j60_rtx_get(int8_t frame)
+{
+	if(frame < 0 || frame >= ENC28J60_RTX_FRAMES || !enc28j60_rtx_frames[frame].len)
+	{
+		return 0;
+	}
+	return &enc28j60_rtx_frames[frame];
+}
+
+/**
+* Queues the kept frame, it is sent from the retransmission area
+* without being copied to the ring
+* @returns 0 if a stalled transmission had to be aborted
+*/
+static uint8_t enc28j60_rtx_enqueue(struct enc28j60_tx_frame * frame)
+{
+	while(enc28j60_tx_count >= ENC28J60_TX_QUEUE_LEN)
+	{
+		if(!enc28j60_tx_wait())
+		{
+			return 0;
+		}
+	}
+	return enc28j60_tx_enqueue(frame->start,frame->len);
+}
+
+/**
+* Sends packet like enc28j60_send_packet_csum() (csum_offset 0 means no
+* checksum) and keeps it in the controller so that it can be sent again
+* with enc28j60_rtx_resend() until enc28j60_rtx_free() is called.
+* @returns Frame handle or -1 if there is no space to keep the frame
+*/
+int8_t enc28j60_rtx_send(uint8_t * packet,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	struct enc28j60_span span = {packet,len,0};
+	
+	return enc28j60_rtx_send_gather(&span,1,csum_start,csum_offset);
+}
+
+/**
+* Sends and keeps frame made of count spans, see enc28j60_rtx_send()
+* and enc28j60_send_gather()
+*/
+int8_t enc28j60_rtx_send_gather(const struct enc28j60_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset)
+{
+	struct enc28j60_tx_frame * frame;
+	uint16_t len = enc28j60_span_len(spans,count);
+	uint16_t start;
+	
+	for(frame = &enc28j60_rtx_frames[0] ; frame < &enc28j60_rtx_frames[ENC28J60_RTX_FRAMES] ; frame++)
+	{
+		if(!frame->len)
+		{
+			break;
+		}
+	}
+	if(frame == &enc28j60_rtx_frames[ENC28J60_RTX_FRAMES] || !(start = enc28j60_rtx_alloc(len)))
+	{
+		return -1;
+	}
+	enc28j60_tx_load(start,spans,count);
+	if(csum_offset)
+	{
+		enc28j60_tx_checksum(start,len,csum_start,csum_offset);
+	}
+	frame->start = start;
+	frame->len = len;
+	if(!enc28j60_rtx_enqueue(frame))
+	{
+		frame->len = 0;
+		return -1;
+	}
+	return (int8_t)(frame - enc28j60_rtx_frames);
+}
+
+/**
+* Overwrites len bytes at offset of the kept frame with data and sends
+* it again
+*/
+uint8_t enc28j60_rtx_resend(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len)
+{
+	struct enc28j60_tx_frame * kept = enc28j60_rtx_get(frame);
+	
+	if(!kept)
+	{
+		return 0;
+	}
+	// the previous transmission must not read modified data
+	while(enc28j60_tx_queued(kept->start))
+	{
+		if(!enc28j60_tx_wait())
+		{
+			return 0;
+		}
+	}
+	if(len)
+	{
+		enc28j60_write16(EWRPTL,kept->start + 1 + offset);
+		enc28j60_write_buffer(len,data);
+	}
+	return enc28j60_rtx_enqueue(kept);
+}
+
+/**
+* Reads len bytes at offset of the kept frame
+*/
+void enc28j60_rtx_read(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len)
+{
+	struct enc28j60_tx_frame * kept = enc28j60_rtx_get(frame);
+	
+	if(!kept)
+	{
+		return;
+	}
+	enc28j60_write16(ERDPTL,kept->start + 1 + offset);
+	enc28j60_read_buffer(len,data);
+}
+
+/**
+* Releases the kept frame once it is not being sent
+*/
+void enc28j60_rtx_free(int8_t frame)
+{
+	struct enc28j60_tx_frame * kept = enc28j60_rtx_get(frame);
+	
+	if(!kept)
+	{
+		return;
+	}
+	// every wait releases a frame, sent or dropped
+	while(enc28j60_tx_queued(kept->start))
+	{
+		enc28j60_tx_wait();
+	}
+	kept->len = 0;
+}
+#endif //ENC28J60_RTX_SIZE
+
+/**
+* Sets the DMA source to len (non zero) bytes of the buffer memory at
+* start. Ranges which start in the receive buffer wrap around its end the
+* same way the DMA does.
+*/
+static void enc28j60_dma_range(uint16_t start,uint16_t len)
+{
+	uint16_t end = start + len - 1;
+
+	if(start <= ENC28J60_RXSTOP_INIT && end > ENC28J60_RXSTOP_INIT)
+	{
+		end -= ENC28J60_RXSTOP_INIT - ENC28J60_RXSTART_INIT + 1;
+	}
+	enc28j60_write16(EDMASTL,start);
+	enc28j60_write16(EDMANDL,end);
+}
+
+/**
+* Starts the DMA operation which has been set up and waits until it
+* completes. Reception is disabled meanwhile (see ENC28J60_DMA_RX_PAUSE),
+* a frame which is being received is completed first.
+*/
+static void enc28j60_dma_run(void)
+{
+#if ENC28J60_DMA_RX_PAUSE
+	enc28j60_write_op(ENC28J60_OPC_BFC,ECON1,ECON1_RXEN);
+	while(enc28j60_read(ESTAT) & ESTAT_RXBUSY);
+#endif
+	enc28j60_write_op(ENC28J60_OPC_BFS,ECON1,ECON1_DMAST);
+	// wait until the DMA completes
+	while(enc28j60_read(ECON1) & ECON1_DMAST);
+#if ENC28J60_DMA_RX_PAUSE
+	enc28j60_write_op(ENC28J60_OPC_BFS,ECON1,ECON1_RXEN);
+#endif
+}
+
+/**
+* Computes the Internet checksum of len bytes of the buffer memory at
+* start with the DMA checksum engine. Ranges which start in the receive
+* buffer wrap around its end the same way the DMA does.
+* @returns Complemented checksum in host byte order
+*/
+uint16_t enc28j60_checksum(uint16_t start,uint16_t len)
+{
+	if(!len)
+	{
+		return 0xffff;
+	}
+	enc28j60_dma_range(start,len);
+	// CSUMEN stays set until the DMA is used for a copy
+	if(!(enc28j60_econ1 & ECON1_CSUMEN))
+	{
+		enc28j60_write_op(ENC28J60_OPC_BFS,ECON1,ECON1_CSUMEN);
+		enc28j60_econ1 |= ECON1_CSUMEN;
+	}
+	enc28j60_dma_run();
+	return ((uint16_t)enc28j60_read(EDMACSH)<<8) | enc28j60_read(EDMACSL);
+}
+
+/**
+* Returns buffer memory address of byte at offset of the received frame
+*/
+static uint16_t enc28j60_rx_addr(uint16_t offset)
+{
+	uint16_t addr = enc28j60_rx_frame_ptr + offset;
+	
+	if(addr > ENC28J60_RXSTOP_INIT)
+	{
+		addr -= ENC28J60_RXSTOP_INIT - ENC28J60_RXSTART_INIT + 1;
+	}
+	return addr;
+}
+
+/**
+* Starts processing of the next received frame. Only the receive header
+* is read, the frame itself stays in the controller and can be read in
+* any order with enc28j60_rx_read() until enc28j60_rx_end() is called.
+* @returns Frame length (without CRC) or 0 if there is no valid frame
+*/
+uint16_t enc28j60_rx_begin(void)
+{
+	uint8_t header[6];
+	uint16_t rxlen;
+	
 	// check if a packet has been received and buffered
 	//if( !(enc28j60Read(EIR) & EIR_PKTIF) ){
 	// The above does not work. See Rev. B4 Silicon Errata point 6.
-	if( !enc28j60_read(EPKTCNT) )
+	// Frames counted by the previous read are known to be there.
+	if( !enc28j60_rx_count && !(enc28j60_rx_count = enc28j60_read(EPKTCNT)) )
 	{
-		goto enc28j60_receive_packet_no_packet;
+		return 0;
 	}
-		
+	
 	// Set the read pointer to the start of the received packet
-	enc28j60_write(ERDPTL,enc28j60_next_packet_ptr&0xff);
-	enc28j60_write(ERDPTH,enc28j60_next_packet_ptr>>8);
+	enc28j60_write16(ERDPTL,enc28j60_next_packet_ptr);
 	
-	// read the next packet pointer
-	enc28j60_next_packet_ptr	 = enc28j60_read_op(ENC28J60_OPC_RBM,0);
-	enc28j60_next_packet_ptr	|= enc28j60_read_op(ENC28J60_OPC_RBM,0)<<8;
+	// read the next packet pointer, the packet length and the receive
+	// status (see datasheet page 43) in one burst
+	enc28j60_read_buffer(sizeof(header),header);
+	enc28j60_rx_frame_ptr = enc28j60_next_packet_ptr;
+	enc28j60_rx_frame_ptr = enc28j60_rx_addr(sizeof(header));
+	enc28j60_next_packet_ptr = header[0] | ((uint16_t)header[1]<<8);
 	
-	// read the packet length (see datasheet page 43)
-	rxlen	= enc28j60_read_op(ENC28J60_OPC_RBM,0);
-	rxlen |= enc28j60_read_op(ENC28J60_OPC_RBM,0)<<8;
 	//remove the CRC count
-	rxlen -= 4; 
-	
-	// read the receive status (see datasheet page 43)
-	rxstatus	= enc28j60_read_op(ENC28J60_OPC_RBM,0);
-	rxstatus |= enc28j60_read_op(ENC28J60_OPC_RBM,0)<<8;
-	
-	if(rxlen > maxlen)
-		rxlen = maxlen -1;
-	
-	if( (rxstatus & 0x80) == 0)
-		rxlen = 0;
-	else
-		enc28j60_read_buffer(rxlen,packet);
+	rxlen = (header[2] | ((uint16_t)header[3]<<8)) - 4;
 	
-	// Move the RX read pointer to the start of the next received packet
-	// This frees the memory we just read out
-	enc28j60_write(ERXRDPTL, (enc28j60_next_packet_ptr));
-	enc28j60_write(ERXRDPTH, (enc28j60_next_packet_ptr)>>8);
+	if( (header[4] & 0x80) == 0)
+	{
+		enc28j60_rx_end();
+		return 0;
+	}
+	return rxlen;
+}
+
+/**
+* Reads len bytes at offset of the frame started by enc28j60_rx_begin().
+* The read pointer is moved only if the data does not follow the
+* previously read one.
+*/
+void enc28j60_rx_read(uint16_t offset,uint8_t * data,uint16_t len)
+{
+	enc28j60_write16(ERDPTL,enc28j60_rx_addr(offset));
+	enc28j60_read_buffer(len,data);
+}
+
+/**
+* Computes the Internet checksum of len bytes at offset of the frame
+* started by enc28j60_rx_begin() without reading them
+* @returns Complemented checksum in host byte order
+*/
+uint16_t enc28j60_rx_checksum(uint16_t offset,uint16_t len)
+{
+	return enc28j60_checksum(enc28j60_rx_addr(offset),len);
+}
+
+/**
+* Sends frame made of count spans followed by len bytes at offset of the
+* frame started by enc28j60_rx_begin(). The received bytes are copied
+* into the transmit buffer by the DMA, they never pass the SPI bus.
+*/
+uint8_t enc28j60_send_rx(const struct enc28j60_span * spans,uint8_t count,uint16_t offset,uint16_t len)
+{
+	uint16_t head = enc28j60_span_len(spans,count);
+	uint16_t start = enc28j60_tx_reserve(head + len);
+
+	if(!start)
+	{
+		return 0;
+	}
+	enc28j60_tx_load(start,spans,count);
+	if(len)
+	{
+		enc28j60_dma_range(enc28j60_rx_addr(offset),len);
+		enc28j60_write16(EDMADSTL,start + 1 + head);
+		if(enc28j60_econ1 & ECON1_CSUMEN)
+		{
+			enc28j60_write_op(ENC28J60_OPC_BFC,ECON1,ECON1_CSUMEN);
+			enc28j60_econ1 &= ~ECON1_CSUMEN;
+		}
+		// the frame must not be sent before the copy completes
+		enc28j60_dma_run();
+	}
+	return enc28j60_tx_enqueue(start,head + len);
+}
+
+/**
+* Releases the frame started by enc28j60_rx_begin()
+*/
+void enc28j60_rx_end(void)
+{
 	// Move the RX read pointer to the start of the next received packet
 	// This frees the memory we just read out.
 	// However, compensate for the errata point 13, rev B4: enver write an even address!
+	uint16_t rdpt = enc28j60_next_packet_ptr - 1;
+	
 	if ((enc28j60_next_packet_ptr - 1 < ENC28J60_RXSTART_INIT) || (enc28j60_next_packet_ptr -1 > ENC28J60_RXSTOP_INIT))
 	{
-		enc28j60_write(ERXRDPTL, (ENC28J60_RXSTOP_INIT)&0xFF);
-		enc28j60_write(ERXRDPTH, (ENC28J60_RXSTOP_INIT)>>8);
-	} 
-	else
-	{
-		enc28j60_write(ERXRDPTL, (enc28j60_next_packet_ptr-1)&0xFF);
-		enc28j60_write(ERXRDPTH, (enc28j60_next_packet_ptr-1)>>8);
+		rdpt = ENC28J60_RXSTOP_INIT;
 	}
+	enc28j60_write16(ERXRDPTL,rdpt);
 	// decrement the packet counter indicate we are done with this packet
 	enc28j60_write_op(ENC28J60_OPC_BFS, ECON2, ECON2_PKTDEC);
-enc28j60_receive_packet_no_packet:
-	return rxlen;	
+	enc28j60_rx_count--;
+}
+
+uint16_t enc28j60_receive_packet(uint8_t * packet,uint16_t maxlen)
+{
+	uint16_t rxlen = enc28j60_rx_begin();
+	
+	if(rxlen)
+	{
+		if(rxlen > maxlen)
+			rxlen = maxlen;
+		enc28j60_rx_read(0,packet,rxlen);
+		enc28j60_rx_end();
+	}
+	return rxlen;
 }
@@ -18,8 +18,26 @@
 
 #define ENC28J60_RST_ON()	ENC28J60_RST_PORT &= ~(1<<ENC28J60_RST);
 #define ENC28J60_RST_OFF()	ENC28J60_RST_PORT |= (1<<ENC28J60_RST);
+#if HAL_HOST
+#include "../host/enc28j60_model.h"
+#define ENC28J60_CS_ACTIVE()	enc28j60_model_select(1)
+#define ENC28J60_CS_INACTIVE()	enc28j60_model_select(0)
+#else
 #define ENC28J60_CS_ACTIVE()	ENC28J60_CS_PORT &= ~(1<<ENC28J60_CS)
 #define ENC28J60_CS_INACTIVE()	ENC28J60_CS_PORT |=	(1<<ENC28J60_CS)
+#endif //HAL_HOST
+
+/**
+* Piece of a frame sent with enc28j60_send_gather(), the pieces are
+* streamed into the controller one after another
+*/
+struct enc28j60_span
+{
+	const uint8_t * data;
+	uint16_t len;
+	/* data is stored in program memory */
+	uint8_t pgm;
+};
 
 void enc28j60_io_init(void);
 void enc28j60_reset(void);
@@ -34,10 +52,30 @@ void enc28j60_write_buffer(uint16_t len,uint8_t * data);
 void enc28j60_set_bank(uint8_t addr);
 uint8_t	enc28j60_read(uint8_t addr);
 void enc28j60_write(uint8_t addr,uint8_t data);
+void enc28j60_write16(uint8_t addr,uint16_t data);
 void enc28j60_phy_write(uint8_t addr,uint16_t data);
 uint8_t	enc28j60_send_packet(uint8_t * buff,uint16_t len);
+uint8_t	enc28j60_send_packet_csum(uint8_t * buff,uint16_t len,uint16_t csum_start,uint16_t csum_offset);
+uint8_t	enc28j60_send_gather(const struct enc28j60_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset);
+void enc28j60_tx_service(void);
+uint8_t enc28j60_tx_pending(void);
+int8_t enc28j60_rtx_send(uint8_t * buff,uint16_t len,uint16_t csum_start,uint16_t csum_offset);
+int8_t enc28j60_rtx_send_gather(const struct enc28j60_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset);
+uint8_t enc28j60_rtx_resend(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len);
+void enc28j60_rtx_read(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len);
+void enc28j60_rtx_free(int8_t frame);
 uint16_t enc28j60_receive_packet(uint8_t * buff,uint16_t max_len);
+uint16_t enc28j60_rx_begin(void);
+void enc28j60_rx_read(uint16_t offset,uint8_t * data,uint16_t len);
+uint16_t enc28j60_rx_checksum(uint16_t offset,uint16_t len);
+uint8_t	enc28j60_send_rx(const struct enc28j60_span * spans,uint8_t count,uint16_t offset,uint16_t len);
+void enc28j60_rx_end(void);
+uint16_t enc28j60_checksum(uint16_t start,uint16_t len);
 uint8_t	enc28j60_get_revision(void);
+void enc28j60_rx_filter(uint8_t filters);
+void enc28j60_rx_pattern(uint16_t offset,const uint8_t * mask,const uint8_t * data,uint8_t len);
+void enc28j60_rx_hash_clear(void);
+void enc28j60_rx_hash_add(const uint8_t * mac);
 
 //SPI Instruction Set
 #define ENC28J60_OPC_RCR	0x00		//Read Control Register
@@ -55,11 +93,19 @@ uint8_t	enc28j60_get_revision(void);
 // start with recbuf at 0/
 #define ENC28J60_RXSTART_INIT	0x0
 // receive buffer end
-#define ENC28J60_RXSTOP_INIT	(0x1FFF-0x0600-1)
-// start TX buffer at 0x1FFF-0x0600, pace for one full ethernet frame (~1500 bytes)
-#define ENC28J60_TXSTART_INIT	(0x1FFF-0x0600)
+#define ENC28J60_RXSTOP_INIT	(ENC28J60_RTXSTART_INIT-1)
+// retransmission area between the receive buffer and the TX ring
+#define ENC28J60_RTXSTART_INIT	(ENC28J60_TXSTART_INIT-ENC28J60_RTX_SIZE)
+#define ENC28J60_RTXSTOP_INIT	(ENC28J60_TXSTART_INIT-1)
+// start TX ring ENC28J60_TX_SIZE bytes before the end of mem, space for
+// several queued frames
+#define ENC28J60_TXSTART_INIT	(0x2000-ENC28J60_TX_SIZE)
 // stp TX buffer at end of mem
 #define ENC28J60_TXSTOP_INIT	0x1FFF
+// the controller writes transmit status vector after each frame
+#define ENC28J60_TSV_LEN	7
+// buffer memory taken by a frame with its control byte and status vector
+#define ENC28J60_TX_FRAME_SIZE(len)	(1 + (len) + ENC28J60_TSV_LEN)
 //
 // max frame length which the conroller will accept:
 #define	MAX_FRAMELEN		 1518		// maximum ethernet frame length
@@ -17,3 +17,24 @@
 #define ENC28J60_INT		7
 
 #define ENC28J60_FULL_DUPLEX	0
+
+// size of the transmit ring at the end of the buffer memory, it must be
+// even and hold at least one full frame with its control byte and status
+#define ENC28J60_TX_SIZE	0x0800
+// frames which may be queued in the transmit ring
+#define ENC28J60_TX_QUEUE_LEN	8
+// size of the area below the transmit ring which keeps frames until they
+// are released (TCP segments waiting for acknowledgment), 0 disables it
+#define ENC28J60_RTX_SIZE	0x0C00
+// frames which may be kept in the retransmission area
+#define ENC28J60_RTX_FRAMES	8
+// the Rev. B silicon errata warn that a frame received while the DMA
+// copies or computes a checksum may be corrupted; reception is paused
+// for each DMA operation, frames arriving meanwhile are not received
+#define ENC28J60_DMA_RX_PAUSE	1
+// a transmission which has not completed after this many polls of EIR,
+// ENC28J60_TX_POLL_US apart, is aborted when the driver waits for it;
+// the transmit logic may hang (Rev. B4 Silicon Errata point 12) or the
+// link may be down
+#define ENC28J60_TX_TIMEOUT_POLLS	2000
+#define ENC28J60_TX_POLL_US	10
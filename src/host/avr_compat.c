@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* avr-libc compatibility functions for the host build
+* @author agent <agent@local>
+*/
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define AVR_COMPAT_FMT_MAX	256
+
+volatile uint8_t PORTA,DDRA,PINA;
+volatile uint8_t PORTB,DDRB,PINB;
+volatile uint8_t PORTC,DDRC,PINC;
+volatile uint8_t PORTD,DDRD,PIND;
+volatile uint8_t PORTE,DDRE,PINE;
+volatile uint8_t PORTF,DDRF,PINF;
+volatile uint8_t PORTG,DDRG,PING;
+volatile uint8_t EIMSK,EIFR,EICRA,EICRB;
+volatile uint8_t SPCR,SPSR,SPDR;
+
+/**
+* Debug output stream used by DBG_* macros
+*/
+FILE * df;
+
+static void avr_compat_init(void) __attribute__((constructor));
+
+static void avr_compat_init(void)
+{
+	df = stderr;
+}
+
+int fprintf_P(FILE * fh,const char * fmt,...)
+{
+	char host_fmt[AVR_COMPAT_FMT_MAX];
+	char * ptr = host_fmt;
+	const char * src = fmt;
+	uint8_t conversion = 0;
+	va_list args;
+	int ret;
+
+	/* translate %S (program memory string) to %s */
+	while(*src && ptr < &host_fmt[AVR_COMPAT_FMT_MAX-1])
+	{
+		if(conversion && *src == 'S')
+		{
+			*ptr = 's';
+		}
+		else
+		{
+			*ptr = *src;
+		}
+		if(*src == '%')
+		{
+			conversion = !conversion;
+		}
+		else if(conversion && ((*src >= 'a' && *src <= 'z') || (*src >= 'A' && *src <= 'Z')))
+		{
+			conversion = 0;
+		}
+		ptr++;
+		src++;
+	}
+	*ptr = '\0';
+
+	va_start(args,fmt);
+	ret = vfprintf(fh,host_fmt,args);
+	va_end(args);
+	return ret;
+}
+/**
+* @}
+*/
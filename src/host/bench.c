@@ -0,0 +1,2099 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Network stack benchmark for the host build. Synthetic frames are
+* injected through the host HAL backend and pushed through
+* ethernet_handle_packet(), or a pcap file is replayed.
+*
+* Usage: bench [-n iterations] [-r rx.pcap] [-w tx.pcap] [scenario...]
+* @author agent <agent@local>
+*/
+
+#include "hal_host.h"
+#if HAL_HOST_ENC28J60
+#include "enc28j60_model.h"
+#include "../dev/enc28j60.h"
+#endif
+
+#include "../net/net.h"
+#include "../net/hal.h"
+#include "../net/ethernet.h"
+#include "../net/ip.h"
+#include "../net/arp.h"
+#include "../net/icmp.h"
+#include "../net/udp.h"
+#include "../net/tcp.h"
+#include "../net/pbuf.h"
+#include "../util/fifo.h"
+#include "../sys/timer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_ITERATIONS	100000
+#define BENCH_FRAME_MAX		1514
+#define BENCH_TCP_PORT		80
+#define BENCH_UDP_PORT		7000
+#define BENCH_TCP_PAYLOAD	1400
+#define BENCH_ICMP_PAYLOAD	1024
+/* datagram larger than one frame sent in BENCH_REASS_FRAGMENTS fragments */
+#define BENCH_REASS_PAYLOAD	3000
+#define BENCH_REASS_FRAGMENTS	3
+/* datagram sent with udp_send_data() in fragments */
+#define BENCH_FRAG_PAYLOAD	4000
+/* datagrams sent while the transmit logic of the model hangs */
+#define BENCH_STALL_FRAMES	32
+/* datagram in two fragments which wait for the ARP reply */
+#define BENCH_FRAG_HELD_PAYLOAD	2400
+
+#define BENCH_ETH_HEADER_LEN	14
+#define BENCH_IP_HEADER_LEN	20
+#define BENCH_UDP_HEADER_LEN	8
+#define BENCH_TCP_HEADER_LEN	20
+
+/* SPI transactions a transmission lasts in the controller model */
+#define BENCH_TX_DELAY		16
+
+/* checksum field offset which never matches (offsets are even) */
+#define BENCH_NO_SKIP		1
+
+#define BENCH_TCP_FLAG_RST	0x04
+#define BENCH_TCP_FLAG_ACK	0x10
+#define BENCH_TCP_FLAG_PSH	0x08
+#define BENCH_TCP_FLAG_SYN	0x02
+
+struct bench_scenario
+{
+	const char * name;
+	void (*run)(uint32_t iterations);
+};
+
+static const ethernet_address bench_mac = {'<','P','A','K','O','>'};
+static const ethernet_address bench_peer_mac = {0x02,0x00,0x00,0x00,0x00,0x01};
+static const ip_address bench_ip = NET_IP_ADDRESS;
+static const ip_address bench_peer_ip = {192,168,1,10};
+static const ip_address bench_other_ip = {192,168,1,99};
+static const ip_address bench_netmask = {255,255,255,0};
+static const ip_address bench_no_netmask = {0,0,0,0};
+
+static uint8_t bench_frame[BENCH_FRAME_MAX];
+
+/* transmitted frames with invalid checksum */
+static uint32_t bench_tx_errors;
+/* checks which failed, the exit status is non zero if there are any */
+static uint32_t bench_failures;
+/* scenario specific handler of transmitted frames */
+static hal_host_tx_callback bench_tx_handler;
+
+/* TCP peer state */
+static struct
+{
+	tcp_socket_t listen;
+	tcp_socket_t socket;
+	uint32_t seq;
+	uint32_t ack;
+	uint32_t sent_end;
+	uint8_t established;
+	uint32_t rx_bytes;
+	uint32_t tx_bytes;
+	/* data is written with tcp_write_P() from bench_tcp_page */
+	uint8_t tx_pgm;
+	uint8_t sink[BENCH_TCP_PAYLOAD];
+} bench_tcp;
+
+/* response stored in program memory */
+static const prog_uint8_t bench_tcp_page[BENCH_TCP_PAYLOAD] PROGMEM = {0x3c};
+
+/* UDP burst state */
+static struct
+{
+	uint32_t received;
+	uint32_t corrupt;
+} bench_udp;
+
+/* echo replies sent back to the peer */
+static struct
+{
+	uint32_t received;
+	uint32_t corrupt;
+} bench_echo;
+
+/* ping client state, the peer answers the echo requests sent by the
+ stack after the round trip time chosen by the scenario */
+static struct
+{
+	uint8_t request[BENCH_FRAME_MAX];
+	uint16_t request_len;
+	uint16_t seq;
+	int32_t rtt;
+	uint32_t callbacks;
+	uint32_t wrong;
+} bench_ping;
+
+/* datagrams delivered to each socket */
+static struct
+{
+	udp_socket_t sockets[UDP_SOCKET_MAX];
+	uint32_t delivered[UDP_SOCKET_MAX];
+	uint32_t wrong;
+	udp_socket_t expected;
+} bench_demux;
+
+/* connectionless server answering several peers, the peer of the
+ datagram being processed is host and port */
+#define BENCH_SENDTO_PEERS	8
+static struct
+{
+	udp_socket_t socket;
+	uint8_t host;
+	uint16_t port;
+	uint32_t replies;
+	uint32_t wrong;
+} bench_sendto;
+
+/* error replies to datagrams and segments sent to closed ports */
+static struct
+{
+	uint32_t unreachable;
+	uint32_t resets;
+	uint32_t corrupt;
+} bench_errors;
+
+/* fragmented datagram state, fragments sent by the stack are put
+ together in data */
+static struct
+{
+	uint8_t data[BENCH_UDP_HEADER_LEN + BENCH_FRAG_PAYLOAD];
+	/* length of the datagrams being sent */
+	uint16_t size;
+	uint16_t id;
+	uint16_t bytes;
+	uint32_t fragments;
+	uint32_t received;
+	uint32_t corrupt;
+} bench_frag;
+
+/* address resolution state, the datagram to the peer being resolved
+ has to wait for the ARP reply */
+static struct
+{
+	ip_address ip;
+	ethernet_address mac;
+	uint8_t seq;
+	uint32_t requests;
+	uint32_t delivered;
+	uint32_t corrupt;
+} bench_resolve;
+
+static double bench_now(void)
+{
+	return (double)hal_host_clock_ns() * 1e-9;
+}
+
+static void bench_set_tx_handler(hal_host_tx_callback handler)
+{
+	bench_tx_handler = handler;
+}
+
+static void bench_report(const char * name,uint32_t count,uint32_t bytes,double elapsed)
+{
+	printf("%-16s %9u frames %10.0f frames/s %8.1f ns/frame",
+		name,
+		count,
+		count / elapsed,
+		elapsed * 1e9 / count);
+	if(bytes)
+	{
+		printf(" %8.2f MB/s",bytes / elapsed / 1e6);
+	}
+	printf(" (%u tx",hal_host_get_stats()->tx_frames);
+	if(bench_tx_errors)
+	{
+		bench_failures++;
+		printf(", %u with bad checksum",bench_tx_errors);
+	}
+#if HAL_HOST_ENC28J60
+	printf(", %.1f SPI B/frame, %.1f SPI ops/frame",
+		(double)enc28j60_model_get_stats()->spi_bytes / count,
+		(double)enc28j60_model_get_stats()->spi_transactions / count);
+	if(enc28j60_model_get_stats()->dma_checksums)
+	{
+		printf(", %u B DMA checksum",enc28j60_model_get_stats()->dma_checksum_bytes);
+	}
+	if(enc28j60_model_get_stats()->dma_copies)
+	{
+		printf(", %u B DMA copy",enc28j60_model_get_stats()->dma_copy_bytes);
+	}
+	if(enc28j60_model_get_stats()->dma_rx_enabled)
+	{
+		bench_failures++;
+		printf(", %u DMA while receiving",enc28j60_model_get_stats()->dma_rx_enabled);
+	}
+	if(enc28j60_model_get_stats()->rx_filtered)
+	{
+		printf(", %u filtered",enc28j60_model_get_stats()->rx_filtered);
+	}
+#endif
+	printf(")\n");
+}
+
+static uint16_t bench_put16(uint8_t * ptr,uint16_t val)
+{
+	ptr[0] = val >> 8;
+	ptr[1] = val & 0xff;
+	return val;
+}
+
+static void bench_put32(uint8_t * ptr,uint32_t val)
+{
+	bench_put16(ptr,val >> 16);
+	bench_put16(ptr + 2,val & 0xffff);
+}
+
+static uint32_t bench_get32(const uint8_t * ptr)
+{
+	return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+/**
+* Builds Ethernet and IP headers and returns pointer to the IP payload
+*/
+static uint8_t * bench_ip_frame(uint8_t * frame,uint8_t protocol,const ip_address * dst,uint16_t payload_len)
+{
+	uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+
+	memcpy(frame,bench_mac,sizeof(ethernet_address));
+	memcpy(frame + 6,bench_peer_mac,sizeof(ethernet_address));
+	bench_put16(frame + 12,ETHERNET_TYPE_IP);
+
+	memset(ip,0,BENCH_IP_HEADER_LEN);
+	ip[0] = 0x45;
+	bench_put16(ip + 2,BENCH_IP_HEADER_LEN + payload_len);
+	ip[8] = 64;
+	ip[9] = protocol;
+	memcpy(ip + 12,bench_peer_ip,sizeof(ip_address));
+	memcpy(ip + 16,dst,sizeof(ip_address));
+	bench_put16(ip + 10,~net_get_checksum(0,ip,BENCH_IP_HEADER_LEN,10));
+
+	return ip + BENCH_IP_HEADER_LEN;
+}
+
+/**
+* Computes transport checksum (with pseudo header) of the segment
+*/
+static uint16_t bench_transport_checksum(uint8_t protocol,const ip_address * dst,const uint8_t * data,uint16_t len,uint8_t skip)
+{
+	uint16_t checksum = protocol + len;
+	checksum = net_get_checksum(checksum,(const uint8_t*)bench_peer_ip,sizeof(ip_address),4);
+	checksum = net_get_checksum(checksum,(const uint8_t*)dst,sizeof(ip_address),4);
+	return ~net_get_checksum(checksum,data,len,skip);
+}
+
+/**
+* Verifies IP and transport checksums of frame transmitted by the stack
+*/
+static void bench_tx_verify(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	uint8_t header_len = (ip[0] & 0xf) * 4;
+	uint16_t ip_len;
+	uint16_t checksum;
+
+	if(len < BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN || frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff))
+	{
+		return;
+	}
+	ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+	if(net_get_checksum(0,ip,header_len,header_len) != 0xffff)
+	{
+		bench_tx_errors++;
+		return;
+	}
+	/* only first fragment carries transport header */
+	if((((uint16_t)ip[6] << 8) | ip[7]) & 0x3fff)
+	{
+		return;
+	}
+	switch(ip[9])
+	{
+		case IP_PROTOCOL_ICMP:
+			checksum = net_get_checksum(0,ip + header_len,ip_len - header_len,BENCH_NO_SKIP);
+			break;
+		case IP_PROTOCOL_UDP:
+		case IP_PROTOCOL_TCP:
+			checksum = ip[9] + ip_len - header_len;
+			checksum = net_get_checksum(checksum,ip + 12,8,8);
+			checksum = net_get_checksum(checksum,ip + header_len,ip_len - header_len,BENCH_NO_SKIP);
+			break;
+		default:
+			return;
+	}
+	if(checksum != 0xffff)
+	{
+		bench_tx_errors++;
+	}
+}
+
+static void bench_tx(const uint8_t * frame,uint16_t len)
+{
+	bench_tx_verify(frame,len);
+	if(bench_tx_handler)
+	{
+		bench_tx_handler(frame,len);
+	}
+}
+
+static uint16_t bench_udp_frame(uint8_t * frame,const ip_address * dst,uint16_t port,uint16_t payload_len)
+{
+	uint16_t len = BENCH_UDP_HEADER_LEN + payload_len;
+	uint8_t * udp = bench_ip_frame(frame,IP_PROTOCOL_UDP,dst,len);
+
+	bench_put16(udp,40000);
+	bench_put16(udp + 2,port);
+	bench_put16(udp + 4,len);
+	bench_put16(udp + 6,0);
+	memset(udp + BENCH_UDP_HEADER_LEN,0x5a,payload_len);
+	bench_put16(udp + 6,bench_transport_checksum(IP_PROTOCOL_UDP,dst,udp,len,6));
+
+	return BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + len;
+}
+
+static uint16_t bench_tcp_frame(uint8_t * frame,uint8_t flags,const uint8_t * payload,uint16_t payload_len)
+{
+	uint16_t header_len = BENCH_TCP_HEADER_LEN + ((flags & BENCH_TCP_FLAG_SYN) ? 4 : 0);
+	uint16_t len = header_len + payload_len;
+	uint8_t * tcp = bench_ip_frame(frame,IP_PROTOCOL_TCP,&bench_ip,len);
+
+	memset(tcp,0,header_len);
+	bench_put16(tcp,40000);
+	bench_put16(tcp + 2,BENCH_TCP_PORT);
+	bench_put32(tcp + 4,bench_tcp.seq);
+	bench_put32(tcp + 8,bench_tcp.ack);
+	tcp[12] = (header_len / 4) << 4;
+	tcp[13] = flags;
+	bench_put16(tcp + 14,0xffff);
+	if(flags & BENCH_TCP_FLAG_SYN)
+	{
+		/* maximum segment size option */
+		tcp[20] = 2;
+		tcp[21] = 4;
+		bench_put16(tcp + 22,1460);
+	}
+	if(payload_len)
+	{
+		memcpy(tcp + header_len,payload,payload_len);
+	}
+	bench_put16(tcp + 16,bench_transport_checksum(IP_PROTOCOL_TCP,&bench_ip,tcp,len,16));
+
+	return BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + len;
+}
+
+/**
+* Injects a frame and lets the stack process it
+*/
+/**
+* Sends all frames queued in the controller like the TXIF interrupt would
+*/
+static void bench_flush(void)
+{
+	while(hal_tx_pending())
+	{
+		hal_tx_service();
+	}
+}
+
+static void bench_process(const uint8_t * frame,uint16_t len)
+{
+	hal_host_inject(frame,len);
+	ethernet_handle_packet();
+	bench_flush();
+}
+
+static void bench_tick(void)
+{
+	timer_tick();
+	timer_poll();
+	bench_flush();
+}
+
+static void bench_run_frame(const char * name,const uint8_t * frame,uint16_t len,uint32_t iterations)
+{
+	uint32_t i;
+	double start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		bench_process(frame,len);
+	}
+	bench_report(name,iterations,(uint32_t)len * iterations,bench_now() - start);
+}
+
+/**
+* Builds a broadcast ARP request for the target address
+*/
+static uint16_t bench_arp_frame(uint8_t * frame,const ip_address * target)
+{
+	uint8_t * arp = frame + BENCH_ETH_HEADER_LEN;
+
+	memset(frame,0xff,sizeof(ethernet_address));
+	memcpy(frame + 6,bench_peer_mac,sizeof(ethernet_address));
+	bench_put16(frame + 12,ETHERNET_TYPE_ARP);
+	bench_put16(arp,ARP_HW_ADDR_TYPE_ETHERNET);
+	bench_put16(arp + 2,ARP_PROTO_ADDR_TYPE_IP);
+	arp[4] = ARP_HW_ADDR_SIZE_ETHERNET;
+	arp[5] = ARP_PROTO_ADDR_SIZE_IP;
+	bench_put16(arp + 6,ARP_OPERATION_REQUEST);
+	memcpy(arp + 8,bench_peer_mac,sizeof(ethernet_address));
+	memcpy(arp + 14,bench_peer_ip,sizeof(ip_address));
+	memset(arp + 18,0,sizeof(ethernet_address));
+	memcpy(arp + 24,target,sizeof(ip_address));
+
+	return BENCH_ETH_HEADER_LEN + 28;
+}
+
+static void bench_arp(uint32_t iterations)
+{
+	uint16_t len = bench_arp_frame(bench_frame,&bench_ip);
+	bench_run_frame("arp-request",bench_frame,len,iterations);
+}
+
+static void bench_arp_foreign(uint32_t iterations)
+{
+	uint16_t len = bench_arp_frame(bench_frame,&bench_other_ip);
+	bench_run_frame("arp-foreign",bench_frame,len,iterations);
+}
+
+/**
+* Broadcast datagram to a port nobody listens on (NetBIOS name service)
+*/
+static void bench_broadcast(uint32_t iterations)
+{
+	const ip_address broadcast = {0xff,0xff,0xff,0xff};
+	uint16_t len = bench_udp_frame(bench_frame,&broadcast,137,50);
+
+	memset(bench_frame,0xff,sizeof(ethernet_address));
+	bench_run_frame("udp-broadcast",bench_frame,len,iterations);
+}
+
+/**
+* Checks that the echo reply goes back to the peer and carries the data
+* of the request
+*/
+static void bench_icmp_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * icmp = ip + BENCH_IP_HEADER_LEN;
+	uint16_t i;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_ICMP)
+	{
+		return;
+	}
+	bench_echo.received++;
+	if(len != BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + 8 + BENCH_ICMP_PAYLOAD ||
+		memcmp(frame,bench_peer_mac,sizeof(ethernet_address)) ||
+		memcmp(ip + 12,bench_ip,sizeof(ip_address)) ||
+		memcmp(ip + 16,bench_peer_ip,sizeof(ip_address)) ||
+		icmp[0] != 0)
+	{
+		bench_echo.corrupt++;
+		return;
+	}
+	for(i = 0 ; i < BENCH_ICMP_PAYLOAD ; i++)
+	{
+		if(icmp[8 + i] != (uint8_t)i)
+		{
+			bench_echo.corrupt++;
+			break;
+		}
+	}
+}
+
+static void bench_icmp(uint32_t iterations)
+{
+	uint16_t len = 8 + BENCH_ICMP_PAYLOAD;
+	uint8_t * icmp = bench_ip_frame(bench_frame,IP_PROTOCOL_ICMP,&bench_ip,len);
+	uint16_t i;
+
+	memset(icmp,0,8);
+	icmp[0] = 8;
+	for(i = 0 ; i < BENCH_ICMP_PAYLOAD ; i++)
+	{
+		icmp[8 + i] = i;
+	}
+	bench_put16(icmp + 2,~net_get_checksum(0,icmp,len,2));
+
+	memset(&bench_echo,0,sizeof(bench_echo));
+	bench_set_tx_handler(bench_icmp_tx);
+	bench_run_frame("icmp-echo-1k",bench_frame,BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + len,iterations);
+	if(bench_echo.received != iterations || bench_echo.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u replies, %u corrupt\n","icmp-echo-1k",bench_echo.received,iterations,bench_echo.corrupt);
+	}
+}
+
+static void bench_ping_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_ICMP || len > sizeof(bench_ping.request))
+	{
+		return;
+	}
+	memcpy(bench_ping.request,frame,len);
+	bench_ping.request_len = len;
+}
+
+static void bench_ping_callback(const ip_address * ip,uint16_t seq,int32_t rtt)
+{
+	bench_ping.callbacks++;
+	if(seq != bench_ping.seq || rtt != bench_ping.rtt || memcmp(ip,bench_peer_ip,sizeof(ip_address)))
+	{
+		bench_ping.wrong++;
+	}
+}
+
+/**
+* Turns the echo request sent by the stack into the peer's reply
+*/
+static uint16_t bench_ping_reply(uint8_t * frame)
+{
+	uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	uint8_t * icmp = ip + BENCH_IP_HEADER_LEN;
+	uint16_t len = bench_ping.request_len - BENCH_ETH_HEADER_LEN - BENCH_IP_HEADER_LEN;
+
+	memcpy(frame,bench_ping.request,bench_ping.request_len);
+	memcpy(frame,bench_mac,sizeof(ethernet_address));
+	memcpy(frame + 6,bench_peer_mac,sizeof(ethernet_address));
+	memcpy(ip + 12,bench_peer_ip,sizeof(ip_address));
+	memcpy(ip + 16,bench_ip,sizeof(ip_address));
+	bench_put16(ip + 10,~net_get_checksum(0,ip,BENCH_IP_HEADER_LEN,10));
+	icmp[0] = 0;
+	bench_put16(icmp + 2,~net_get_checksum(0,icmp,len,2));
+
+	return bench_ping.request_len;
+}
+
+static void bench_advance(uint32_t ms)
+{
+	while(ms--)
+	{
+		timer_tick();
+	}
+	timer_poll();
+	bench_flush();
+}
+
+/**
+* Pings the peer which answers after 1 to 8 ms, every 64th request is
+* not answered
+*/
+static void bench_icmp_ping(uint32_t iterations)
+{
+	const struct icmp_ping_stats * stats = icmp_ping_get_stats();
+	uint32_t lost = 0;
+	uint32_t i;
+	uint16_t len;
+	double start;
+
+	memset(&bench_ping,0,sizeof(bench_ping));
+	arp_table_insert(&bench_peer_ip,&bench_peer_mac);
+	bench_set_tx_handler(bench_ping_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		bench_ping.request_len = 0;
+		if(!icmp_ping(&bench_peer_ip,56,bench_ping_callback))
+		{
+			break;
+		}
+		bench_flush();
+		bench_ping.seq++;
+		if(!bench_ping.request_len)
+		{
+			break;
+		}
+		if(i % 64 == 63)
+		{
+			bench_ping.rtt = -1;
+			bench_advance(ICMP_PING_TIMEOUT_MS);
+			lost++;
+			continue;
+		}
+		bench_ping.rtt = 1 + i % 8;
+		bench_advance(bench_ping.rtt);
+		len = bench_ping_reply(bench_frame);
+		bench_process(bench_frame,len);
+	}
+	bench_report("icmp-ping",iterations,0,bench_now() - start);
+	if(stats->sent != iterations || stats->received != iterations - lost || stats->lost != lost ||
+		bench_ping.callbacks != iterations || bench_ping.wrong ||
+		(iterations >= 8 && (stats->rtt_min != 1 || stats->rtt_max != 8)))
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u requests, %u received, %u lost, %u callbacks, %u wrong, rtt %u..%u\n","icmp-ping",
+			stats->sent,iterations,stats->received,stats->lost,bench_ping.callbacks,bench_ping.wrong,stats->rtt_min,stats->rtt_max);
+	}
+}
+
+static void bench_udp_closed(uint32_t iterations)
+{
+	uint16_t len = bench_udp_frame(bench_frame,&bench_ip,9,512);
+	bench_run_frame("udp-closed-port",bench_frame,len,iterations);
+}
+
+/**
+* Counts port unreachable messages, which must quote the datagram in
+* bench_frame, and resets
+*/
+static void bench_errors_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * payload = ip + BENCH_IP_HEADER_LEN;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff))
+	{
+		return;
+	}
+	if(ip[9] == IP_PROTOCOL_ICMP)
+	{
+		if(len == BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + 8 + BENCH_IP_HEADER_LEN + 8 &&
+			payload[0] == 3 && payload[1] == ICMP_CODE_PORT_UNREACHABLE &&
+			!memcmp(payload + 8,bench_frame + BENCH_ETH_HEADER_LEN,BENCH_IP_HEADER_LEN + 8))
+		{
+			bench_errors.unreachable++;
+		}
+		else
+		{
+			bench_errors.corrupt++;
+		}
+	}
+	else if(ip[9] == IP_PROTOCOL_TCP && (payload[13] & BENCH_TCP_FLAG_RST))
+	{
+		bench_errors.resets++;
+	}
+}
+
+/**
+* Datagrams and connection attempts to closed ports arrive every ms, the
+* replies to them must not exceed the rate limit
+*/
+static void bench_error_limit(uint32_t iterations)
+{
+	uint8_t segment[BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_TCP_HEADER_LEN + 4];
+	uint16_t udp_len = bench_udp_frame(bench_frame,&bench_ip,9,512);
+	uint16_t tcp_len;
+	uint32_t expected = NET_IP_ERROR_BURST + iterations / NET_IP_ERROR_INTERVAL_MS;
+	uint32_t sent;
+	uint32_t i;
+	double start;
+
+	if(expected > iterations)
+	{
+		expected = iterations;
+	}
+	memset(&bench_tcp,0,sizeof(bench_tcp));
+	tcp_len = bench_tcp_frame(segment,BENCH_TCP_FLAG_SYN,0,0);
+	memset(&bench_errors,0,sizeof(bench_errors));
+	bench_set_tx_handler(bench_errors_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		if(i & 1)
+		{
+			bench_process(segment,tcp_len);
+		}
+		else
+		{
+			bench_process(bench_frame,udp_len);
+		}
+		bench_advance(1);
+	}
+	bench_report("error-limit",iterations,0,bench_now() - start);
+	sent = bench_errors.unreachable + bench_errors.resets;
+	if(sent + 1 < expected || sent > expected || (iterations > 1 && (!bench_errors.unreachable || !bench_errors.resets)) || bench_errors.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u replies, %u unreachable, %u resets, %u corrupt\n","error-limit",
+			sent,expected,bench_errors.unreachable,bench_errors.resets,bench_errors.corrupt);
+	}
+}
+
+static void bench_ip_foreign(uint32_t iterations)
+{
+	uint16_t len = bench_udp_frame(bench_frame,&bench_other_ip,9,512);
+	bench_run_frame("ip-foreign",bench_frame,len,iterations);
+}
+
+static void bench_ethertype(uint32_t iterations)
+{
+	memcpy(bench_frame,bench_mac,sizeof(ethernet_address));
+	memcpy(bench_frame + 6,bench_peer_mac,sizeof(ethernet_address));
+	bench_put16(bench_frame + 12,0x86dd);
+	memset(bench_frame + BENCH_ETH_HEADER_LEN,0,512);
+	bench_run_frame("ethertype-drop",bench_frame,BENCH_ETH_HEADER_LEN + 512,iterations);
+}
+
+/**
+* Payload length of n-th datagram of the UDP burst
+*/
+static uint16_t bench_udp_tx_len(uint32_t n)
+{
+	return 16 + (n * 97) % BENCH_TCP_PAYLOAD;
+}
+
+/**
+* Checks that datagrams of the UDP burst leave the controller in order
+* and intact, each payload is filled with its sequence number
+*/
+static void bench_udp_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * data = ip + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN;
+	uint16_t data_len = bench_udp_tx_len(bench_udp.received);
+	uint16_t i;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_UDP)
+	{
+		return;
+	}
+	if(len != BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN + data_len)
+	{
+		bench_udp.corrupt++;
+	}
+	else
+	{
+		for(i = 0 ; i < data_len ; i++)
+		{
+			if(data[i] != (uint8_t)bench_udp.received)
+			{
+				bench_udp.corrupt++;
+				break;
+			}
+		}
+	}
+	bench_udp.received++;
+}
+
+static void bench_udp_callback(udp_socket_t socket,uint8_t * data,uint16_t length)
+{
+}
+
+static void bench_demux_callback(udp_socket_t socket,uint8_t * data,uint16_t length)
+{
+	if(socket != bench_demux.expected)
+	{
+		bench_demux.wrong++;
+	}
+	bench_demux.delivered[socket]++;
+}
+
+/**
+* Every socket is bound to a port, datagrams come to them in turn. The
+* ports fall into one bucket of the port index.
+*/
+static void bench_udp_demux(uint32_t iterations)
+{
+	uint16_t len[UDP_SOCKET_MAX];
+	uint8_t frames[UDP_SOCKET_MAX][BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN + 64];
+	uint32_t i;
+	uint8_t n;
+	double start;
+
+	memset(&bench_demux,0,sizeof(bench_demux));
+	for(n = 0 ; n < UDP_SOCKET_MAX ; n++)
+	{
+		bench_demux.sockets[n] = udp_socket_alloc(BENCH_UDP_PORT + n * UDP_HASH_SIZE,bench_demux_callback);
+		if(bench_demux.sockets[n] < 0)
+		{
+			bench_failures++;
+			printf("%-16s socket failed\n","udp-demux");
+			return;
+		}
+		len[n] = bench_udp_frame(frames[n],&bench_ip,BENCH_UDP_PORT + n * UDP_HASH_SIZE,64);
+	}
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		n = i % UDP_SOCKET_MAX;
+		bench_demux.expected = bench_demux.sockets[n];
+		bench_process(frames[n],len[n]);
+	}
+	bench_report("udp-demux",iterations,0,bench_now() - start);
+	for(n = 0 ; n < UDP_SOCKET_MAX ; n++)
+	{
+		if(bench_demux.delivered[bench_demux.sockets[n]] != iterations / UDP_SOCKET_MAX + (n < iterations % UDP_SOCKET_MAX) || bench_demux.wrong)
+		{
+			bench_failures++;
+			printf("%-16s socket %u got %u datagrams, %u to wrong socket\n","udp-demux",n,bench_demux.delivered[bench_demux.sockets[n]],bench_demux.wrong);
+		}
+		udp_socket_free(bench_demux.sockets[n]);
+	}
+}
+
+/**
+* Echoes the datagram to its source without binding the socket
+*/
+static void bench_sendto_callback(udp_socket_t socket,const ip_address * ip_remote,uint16_t port_remote,uint8_t * data,uint16_t length)
+{
+	if((*ip_remote)[3] != bench_sendto.host || port_remote != bench_sendto.port)
+	{
+		bench_sendto.wrong++;
+	}
+	memmove(udp_get_buffer(),data,length);
+	udp_sendto(socket,ip_remote,port_remote,length);
+}
+
+static void bench_sendto_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * udp = ip + BENCH_IP_HEADER_LEN;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_UDP)
+	{
+		return;
+	}
+	bench_sendto.replies++;
+	if(ip[19] != bench_sendto.host ||
+		(((uint16_t)udp[0] << 8) | udp[1]) != BENCH_UDP_PORT ||
+		(((uint16_t)udp[2] << 8) | udp[3]) != bench_sendto.port ||
+		udp[BENCH_UDP_HEADER_LEN] != bench_sendto.host)
+	{
+		bench_sendto.wrong++;
+	}
+}
+
+/**
+* Datagrams from several peers come to one connectionless socket which
+* echoes each of them to its source
+*/
+static void bench_udp_sendto(uint32_t iterations)
+{
+	uint8_t frames[BENCH_SENDTO_PEERS][BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN + 64];
+	uint16_t len = 0;
+	uint32_t i;
+	uint8_t n;
+	double start;
+
+	memset(&bench_sendto,0,sizeof(bench_sendto));
+	bench_sendto.socket = udp_socket_alloc_from(BENCH_UDP_PORT,bench_sendto_callback);
+	if(bench_sendto.socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","udp-sendto");
+		return;
+	}
+	for(n = 0 ; n < BENCH_SENDTO_PEERS ; n++)
+	{
+		uint8_t * ip = frames[n] + BENCH_ETH_HEADER_LEN;
+		uint8_t * udp = ip + BENCH_IP_HEADER_LEN;
+		uint16_t checksum;
+
+		/* peer 192.168.1.(100 + n) sends from port 40000 + n */
+		len = bench_udp_frame(frames[n],&bench_ip,BENCH_UDP_PORT,64);
+		ip[15] = 100 + n;
+		bench_put16(ip + 10,0);
+		bench_put16(ip + 10,~net_get_checksum(0,ip,BENCH_IP_HEADER_LEN,10));
+		bench_put16(udp,40000 + n);
+		memset(udp + BENCH_UDP_HEADER_LEN,100 + n,64);
+		checksum = IP_PROTOCOL_UDP + BENCH_UDP_HEADER_LEN + 64;
+		checksum = net_get_checksum(checksum,ip + 12,8,8);
+		bench_put16(udp + 6,~net_get_checksum(checksum,udp,BENCH_UDP_HEADER_LEN + 64,6));
+	}
+	bench_set_tx_handler(bench_sendto_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		n = i % BENCH_SENDTO_PEERS;
+		bench_sendto.host = 100 + n;
+		bench_sendto.port = 40000 + n;
+		bench_process(frames[n],len);
+	}
+	bench_report("udp-sendto",iterations,0,bench_now() - start);
+	if(bench_sendto.replies != iterations || bench_sendto.wrong)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u replies, %u to wrong peer\n","udp-sendto",bench_sendto.replies,iterations,bench_sendto.wrong);
+	}
+	udp_socket_free(bench_sendto.socket);
+}
+
+/**
+* Allocates sockets with ephemeral ports while the others are taken, a
+* freed port must not be given out again at once
+*/
+static void bench_udp_ephemeral(uint32_t iterations)
+{
+	udp_socket_t busy[UDP_SOCKET_MAX - 1];
+	udp_socket_t socket;
+	uint16_t port;
+	uint16_t last = 0;
+	uint32_t reused = 0;
+	uint32_t failed = 0;
+	uint32_t i;
+	uint8_t n;
+	double start;
+
+	for(n = 0 ; n < UDP_SOCKET_MAX - 1 ; n++)
+	{
+		busy[n] = udp_socket_alloc(UDP_PORT_ANY,bench_udp_callback);
+	}
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		socket = udp_socket_alloc(UDP_PORT_ANY,bench_udp_callback);
+		if(socket < 0)
+		{
+			failed++;
+			continue;
+		}
+		port = udp_get_local_port(socket);
+		if(port == last || port < UDP_PORT_EPHEMERAL_FIRST)
+		{
+			reused++;
+		}
+		last = port;
+		udp_socket_free(socket);
+	}
+	bench_report("udp-ephemeral",iterations,0,bench_now() - start);
+	if(failed || reused)
+	{
+		bench_failures++;
+		printf("%-16s %u allocations failed, %u ports reused\n","udp-ephemeral",failed,reused);
+	}
+	for(n = 0 ; n < UDP_SOCKET_MAX - 1 ; n++)
+	{
+		udp_socket_free(busy[n]);
+	}
+}
+
+/**
+* Sends datagrams back to back without waiting for the transmission of
+* the previous ones
+*/
+static void bench_udp_tx_burst(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	uint32_t i;
+	uint32_t bytes = 0;
+	uint16_t len;
+	double start;
+
+	memset(&bench_udp,0,sizeof(bench_udp));
+	if(socket < 0 || !udp_bind_remote(socket,BENCH_UDP_PORT,&bench_peer_ip))
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","udp-tx-burst");
+		return;
+	}
+	arp_table_insert(&bench_peer_ip,&bench_peer_mac);
+	bench_set_tx_handler(bench_udp_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		len = bench_udp_tx_len(i);
+		memset(udp_get_buffer(),(uint8_t)i,len);
+		udp_send(socket,len);
+		bytes += len;
+	}
+	bench_flush();
+	bench_report("udp-tx-burst",iterations,bytes,bench_now() - start);
+	if(bench_udp.received != iterations || bench_udp.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams, %u corrupt\n","udp-tx-burst",bench_udp.received,iterations,bench_udp.corrupt);
+	}
+	udp_socket_free(socket);
+}
+
+/**
+* Checks that reassembled datagram is complete, it is filled with the
+* sequence number
+*/
+static void bench_reass_callback(udp_socket_t socket,uint8_t * data,uint16_t length)
+{
+	uint16_t i;
+
+	if(length != BENCH_REASS_PAYLOAD)
+	{
+		bench_udp.corrupt++;
+		return;
+	}
+	for(i = 0 ; i < length ; i++)
+	{
+		if(data[i] != (uint8_t)bench_udp.received)
+		{
+			bench_udp.corrupt++;
+			return;
+		}
+	}
+	bench_udp.received++;
+}
+
+/**
+* Builds fragment of the datagram with len bytes of data, ip_len is the
+* total length put into its header
+*/
+static uint16_t bench_reass_fragment(uint8_t * fragment,const uint8_t * datagram,uint16_t id,uint16_t flags,const uint8_t * data,uint16_t len,uint16_t ip_len)
+{
+	uint8_t * ip = fragment + BENCH_ETH_HEADER_LEN;
+
+	memcpy(fragment,datagram,BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN);
+	bench_put16(ip + 2,ip_len);
+	bench_put16(ip + 4,id);
+	bench_put16(ip + 6,flags);
+	bench_put16(ip + 10,0);
+	bench_put16(ip + 10,~net_get_checksum(0,ip,BENCH_IP_HEADER_LEN,10));
+	memcpy(ip + BENCH_IP_HEADER_LEN,data,len);
+	return BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + len;
+}
+
+/**
+* Every datagram is received in fragments which come in reverse order.
+* After the first one come a fragment at the largest offset, whose end
+* does not fit into 16 bits, and a fragment whose total length is
+* shorter than its header; both have to be dropped.
+*/
+static void bench_ip_reass(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_reass_callback);
+	uint8_t datagram[BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN + BENCH_REASS_PAYLOAD];
+	uint8_t fragment[BENCH_FRAME_MAX];
+	uint8_t * ip = datagram + BENCH_ETH_HEADER_LEN;
+	uint8_t * udp = ip + BENCH_IP_HEADER_LEN;
+	uint16_t udp_len = BENCH_UDP_HEADER_LEN + BENCH_REASS_PAYLOAD;
+	/* all fragments but the last carry a multiple of 8 bytes */
+	uint16_t fragment_len = (udp_len / BENCH_REASS_FRAGMENTS + 7) & ~7;
+	uint16_t offset;
+	uint16_t len;
+	uint32_t i;
+	int8_t n;
+	double start;
+
+	memset(&bench_udp,0,sizeof(bench_udp));
+	if(socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","ip-reass");
+		return;
+	}
+	bench_udp_frame(datagram,&bench_ip,BENCH_UDP_PORT,BENCH_REASS_PAYLOAD);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		memset(udp + BENCH_UDP_HEADER_LEN,(uint8_t)i,BENCH_REASS_PAYLOAD);
+		bench_put16(udp + 6,0);
+		bench_put16(udp + 6,bench_transport_checksum(IP_PROTOCOL_UDP,&bench_ip,udp,udp_len,6));
+		for(n = BENCH_REASS_FRAGMENTS - 1 ; n >= 0 ; n--)
+		{
+			offset = n * fragment_len;
+			len = n == BENCH_REASS_FRAGMENTS - 1 ? udp_len - offset : fragment_len;
+			bench_process(fragment,bench_reass_fragment(fragment,datagram,(uint16_t)i,
+				(n == BENCH_REASS_FRAGMENTS - 1 ? 0 : 0x2000) | (offset / 8),udp + offset,len,BENCH_IP_HEADER_LEN + len));
+			if(n == BENCH_REASS_FRAGMENTS - 1)
+			{
+				bench_process(fragment,bench_reass_fragment(fragment,datagram,(uint16_t)i,0x1fff,udp,16,BENCH_IP_HEADER_LEN + 16));
+				bench_process(fragment,bench_reass_fragment(fragment,datagram,(uint16_t)i,0x2000,udp,16,BENCH_IP_HEADER_LEN - 8));
+			}
+		}
+	}
+	bench_report("ip-reass",iterations,iterations * BENCH_REASS_PAYLOAD,bench_now() - start);
+	if(bench_udp.received != iterations || bench_udp.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s received %u of %u datagrams, %u corrupt\n","ip-reass",bench_udp.received,iterations,bench_udp.corrupt);
+	}
+	udp_socket_free(socket);
+}
+
+/**
+* Puts fragments of the datagram together and checks the datagram when
+* the last one is sent, its data are filled with its sequence number
+*/
+static void bench_frag_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+	uint16_t id = ((uint16_t)ip[4] << 8) | ip[5];
+	uint16_t flags = ((uint16_t)ip[6] << 8) | ip[7];
+	uint16_t offset = (flags & 0x1fff) * 8;
+	uint16_t data_len = ip_len - BENCH_IP_HEADER_LEN;
+	uint16_t checksum;
+	uint16_t i;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_UDP)
+	{
+		return;
+	}
+	bench_frag.fragments++;
+	if(!offset)
+	{
+		/* every datagram has a new identification */
+		if(bench_frag.received && id == bench_frag.id)
+		{
+			bench_frag.corrupt++;
+		}
+		bench_frag.id = id;
+		bench_frag.bytes = 0;
+	}
+	if(id != bench_frag.id || offset != bench_frag.bytes || offset + data_len > sizeof(bench_frag.data) ||
+		((flags & 0x2000) && (data_len & 7)))
+	{
+		bench_frag.corrupt++;
+		return;
+	}
+	memcpy(bench_frag.data + offset,ip + BENCH_IP_HEADER_LEN,data_len);
+	bench_frag.bytes += data_len;
+	if(flags & 0x2000)
+	{
+		return;
+	}
+	checksum = IP_PROTOCOL_UDP + bench_frag.bytes;
+	checksum = net_get_checksum(checksum,ip + 12,8,8);
+	checksum = net_get_checksum(checksum,bench_frag.data,bench_frag.bytes,BENCH_NO_SKIP);
+	if(bench_frag.bytes != bench_frag.size || checksum != 0xffff)
+	{
+		bench_frag.corrupt++;
+		return;
+	}
+	for(i = BENCH_UDP_HEADER_LEN ; i < bench_frag.bytes ; i++)
+	{
+		if(bench_frag.data[i] != (uint8_t)bench_frag.received)
+		{
+			bench_frag.corrupt++;
+			return;
+		}
+	}
+	bench_frag.received++;
+}
+
+/**
+* Sends datagrams larger than a frame with udp_send_data()
+*/
+static void bench_udp_tx_frag(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	static uint8_t data[BENCH_FRAG_PAYLOAD];
+	uint32_t i;
+	double start;
+
+	memset(&bench_frag,0,sizeof(bench_frag));
+	bench_frag.size = BENCH_UDP_HEADER_LEN + sizeof(data);
+	if(socket < 0 || !udp_bind_remote(socket,BENCH_UDP_PORT,&bench_peer_ip))
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","udp-tx-frag");
+		return;
+	}
+	arp_table_insert(&bench_peer_ip,&bench_peer_mac);
+	bench_set_tx_handler(bench_frag_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		memset(data,(uint8_t)i,sizeof(data));
+		udp_send_data(socket,data,sizeof(data));
+		bench_flush();
+	}
+	bench_report("udp-tx-frag",iterations,iterations * sizeof(data),bench_now() - start);
+	if(bench_frag.received != iterations || bench_frag.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams in %u fragments, %u corrupt\n","udp-tx-frag",
+			bench_frag.received,iterations,bench_frag.fragments,bench_frag.corrupt);
+	}
+	udp_socket_free(socket);
+}
+
+/**
+* Counts ARP requests for the peer being resolved and datagrams sent to
+* it after the reply
+*/
+static void bench_resolve_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * data = ip + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN;
+
+	if(frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff))
+	{
+		if(!memcmp(ip + 24,bench_resolve.ip,sizeof(ip_address)))
+		{
+			bench_resolve.requests++;
+		}
+		return;
+	}
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_UDP)
+	{
+		return;
+	}
+	if(memcmp(frame,bench_resolve.mac,sizeof(ethernet_address)) ||
+		memcmp(ip + 16,bench_resolve.ip,sizeof(ip_address)) ||
+		len < BENCH_ETH_HEADER_LEN + BENCH_IP_HEADER_LEN + BENCH_UDP_HEADER_LEN + 1 ||
+		data[0] != bench_resolve.seq)
+	{
+		bench_resolve.corrupt++;
+		return;
+	}
+	bench_resolve.delivered++;
+}
+
+/**
+* Selects the peer whose address is resolved and the sequence byte of
+* the datagram sent to it
+*/
+static void bench_resolve_peer(uint8_t host,uint8_t seq)
+{
+	memcpy(bench_resolve.ip,bench_peer_ip,sizeof(ip_address));
+	bench_resolve.ip[3] = host;
+	memcpy(bench_resolve.mac,bench_peer_mac,sizeof(ethernet_address));
+	bench_resolve.mac[5] = host;
+	bench_resolve.seq = seq;
+}
+
+/**
+* Injects the ARP reply of the selected peer
+*/
+static void bench_resolve_reply(void)
+{
+	uint8_t * arp = bench_frame + BENCH_ETH_HEADER_LEN;
+	uint16_t len = bench_arp_frame(bench_frame,&bench_ip);
+
+	memcpy(bench_frame,bench_mac,sizeof(ethernet_address));
+	memcpy(bench_frame + 6,bench_resolve.mac,sizeof(ethernet_address));
+	bench_put16(arp + 6,ARP_OPERATION_REPLY);
+	memcpy(arp + 8,bench_resolve.mac,sizeof(ethernet_address));
+	memcpy(arp + 14,bench_resolve.ip,sizeof(ip_address));
+	memcpy(arp + 18,bench_mac,sizeof(ethernet_address));
+	bench_process(bench_frame,len);
+}
+
+/**
+* Every datagram goes to a peer which is not in the ARP table, it waits
+* for the ARP reply and has to be sent when the reply is received
+*/
+static void bench_arp_resolve(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	uint32_t i;
+	double start;
+
+	memset(&bench_resolve,0,sizeof(bench_resolve));
+	if(socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","arp-resolve");
+		return;
+	}
+	bench_set_tx_handler(bench_resolve_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		/* a new peer every time, the ARP table is too small to keep them */
+		bench_resolve_peer(100 + i % 100,(uint8_t)i);
+		udp_bind_remote(socket,BENCH_UDP_PORT,(const ip_address*)&bench_resolve.ip);
+		memset(udp_get_buffer(),bench_resolve.seq,64);
+		udp_send(socket,64);
+		bench_flush();
+		bench_resolve_reply();
+	}
+	bench_flush();
+	bench_report("arp-resolve",iterations,0,bench_now() - start);
+	if(bench_resolve.delivered != iterations || bench_resolve.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams after %u requests, %u corrupt\n","arp-resolve",
+			bench_resolve.delivered,iterations,bench_resolve.requests,bench_resolve.corrupt);
+	}
+	udp_socket_free(socket);
+}
+
+#if HAL_HOST_ENC28J60
+/**
+* Counts datagrams which leave the controller, none may leave while the
+* transmit logic hangs
+*/
+static void bench_stall_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_UDP)
+	{
+		return;
+	}
+	bench_udp.received++;
+}
+
+/**
+* Datagrams are sent while the transmit logic hangs. Once the queue is
+* full every send has to give up, dropping the oldest frame, instead of
+* waiting forever. The frames which were not dropped leave when the
+* hang ends.
+*/
+static void bench_tx_stall(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	uint32_t frames = iterations < BENCH_STALL_FRAMES ? iterations : BENCH_STALL_FRAMES;
+	uint32_t accepted = 0;
+	uint32_t refused = 0;
+	uint32_t stalled;
+	uint32_t i;
+	double start;
+
+	memset(&bench_udp,0,sizeof(bench_udp));
+	if(socket < 0 || !udp_bind_remote(socket,BENCH_UDP_PORT,&bench_peer_ip))
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","tx-stall");
+		return;
+	}
+	arp_table_insert(&bench_peer_ip,&bench_peer_mac);
+	bench_set_tx_handler(bench_stall_tx);
+	enc28j60_model_set_tx_stall(1);
+	start = bench_now();
+	for(i = 0 ; i < frames ; i++)
+	{
+		memset(udp_get_buffer(),(uint8_t)i,BENCH_TCP_PAYLOAD);
+		if(udp_send(socket,BENCH_TCP_PAYLOAD))
+		{
+			accepted++;
+		}
+		else
+		{
+			refused++;
+		}
+	}
+	bench_report("tx-stall",frames,0,bench_now() - start);
+	stalled = bench_udp.received;
+	enc28j60_model_set_tx_stall(0);
+	bench_flush();
+	udp_send(socket,BENCH_TCP_PAYLOAD);
+	bench_flush();
+	/* every refused send dropped one queued frame */
+	if(stalled || (frames > ENC28J60_TX_QUEUE_LEN && !refused) || bench_udp.received != accepted - refused + 1)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams, %u while stalled, %u refused\n","tx-stall",
+			bench_udp.received,accepted - refused + 1,stalled,refused);
+	}
+	udp_socket_free(socket);
+}
+#endif
+
+/**
+* Fragments have to go to the peer being resolved, their datagram is
+* checked like in udp-tx-frag
+*/
+static void bench_frag_held_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+
+	if(frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff))
+	{
+		if(!memcmp(ip + 24,bench_resolve.ip,sizeof(ip_address)))
+		{
+			bench_resolve.requests++;
+		}
+		return;
+	}
+	if(memcmp(frame,bench_resolve.mac,sizeof(ethernet_address)) || memcmp(ip + 16,bench_resolve.ip,sizeof(ip_address)))
+	{
+		bench_frag.corrupt++;
+		return;
+	}
+	bench_frag_tx(frame,len);
+}
+
+/**
+* Every datagram is larger than a frame and goes to a peer which is not
+* in the ARP table, its fragments wait for the ARP reply together. At
+* the end a datagram with more fragments than can wait is dropped
+* without keeping any buffer.
+*/
+static void bench_udp_frag_held(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	static uint8_t data[BENCH_FRAG_PAYLOAD];
+	uint8_t used;
+	uint8_t dropped;
+	uint32_t i;
+	double start;
+
+	memset(&bench_frag,0,sizeof(bench_frag));
+	memset(&bench_resolve,0,sizeof(bench_resolve));
+	bench_frag.size = BENCH_UDP_HEADER_LEN + BENCH_FRAG_HELD_PAYLOAD;
+	if(socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","udp-frag-held");
+		return;
+	}
+	bench_set_tx_handler(bench_frag_held_tx);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		/* a new peer every time, the ARP table is too small to keep them */
+		bench_resolve_peer(100 + i % 100,(uint8_t)i);
+		udp_bind_remote(socket,BENCH_UDP_PORT,(const ip_address*)&bench_resolve.ip);
+		memset(data,(uint8_t)i,BENCH_FRAG_HELD_PAYLOAD);
+		if(!udp_send_data(socket,data,BENCH_FRAG_HELD_PAYLOAD))
+		{
+			bench_frag.corrupt++;
+		}
+		bench_flush();
+		bench_resolve_reply();
+	}
+	bench_flush();
+	bench_report("udp-frag-held",iterations,iterations * BENCH_FRAG_HELD_PAYLOAD,bench_now() - start);
+	used = pbuf_get_stats()->used;
+	bench_resolve_peer(99,0);
+	udp_bind_remote(socket,BENCH_UDP_PORT,(const ip_address*)&bench_resolve.ip);
+	dropped = !udp_send_data(socket,data,sizeof(data));
+	bench_flush();
+	if(bench_frag.received != iterations || bench_frag.corrupt || !dropped || pbuf_get_stats()->used != used)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams after %u requests, %u corrupt, %u buffers kept\n","udp-frag-held",
+			bench_frag.received,iterations,bench_resolve.requests,bench_frag.corrupt,pbuf_get_stats()->used - used);
+	}
+	udp_socket_free(socket);
+}
+
+/**
+* Datagrams go to as many peers as the ARP table holds in turn, once the
+* peers are known no request is sent. Datagrams received from hosts
+* behind the gateway must not push the peers out.
+*/
+static void bench_arp_cache(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	uint32_t i;
+	uint8_t host;
+	double start;
+
+	memset(&bench_resolve,0,sizeof(bench_resolve));
+	if(socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","arp-cache");
+		return;
+	}
+	bench_set_tx_handler(bench_resolve_tx);
+	ip_init(0,&bench_netmask,0);
+	for(host = 0 ; host < ARP_TABLE_SIZE ; host++)
+	{
+		bench_resolve_peer(100 + host,0);
+		bench_resolve_reply();
+	}
+	/* datagrams from hosts behind the gateway do not take entries */
+	for(host = 0 ; host < 2 * ARP_TABLE_SIZE ; host++)
+	{
+		uint8_t * ip = bench_frame + BENCH_ETH_HEADER_LEN;
+		uint16_t len = bench_udp_frame(bench_frame,&bench_ip,BENCH_UDP_PORT,16);
+
+		ip[12] = 10;
+		ip[15] = host;
+		bench_put16(ip + 10,0);
+		bench_put16(ip + 10,~net_get_checksum(0,ip,BENCH_IP_HEADER_LEN,10));
+		/* no UDP checksum */
+		bench_put16(ip + BENCH_IP_HEADER_LEN + 6,0);
+		bench_process(bench_frame,len);
+	}
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		bench_resolve_peer(100 + i % ARP_TABLE_SIZE,(uint8_t)i);
+		udp_bind_remote(socket,BENCH_UDP_PORT,(const ip_address*)&bench_resolve.ip);
+		memset(udp_get_buffer(),bench_resolve.seq,64);
+		udp_send(socket,64);
+		bench_flush();
+	}
+	bench_report("arp-cache",iterations,0,bench_now() - start);
+	if(bench_resolve.delivered != iterations || bench_resolve.requests || bench_resolve.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams after %u requests, %u corrupt\n","arp-cache",
+			bench_resolve.delivered,iterations,bench_resolve.requests,bench_resolve.corrupt);
+	}
+	ip_init(0,&bench_no_netmask,0);
+	udp_socket_free(socket);
+}
+
+/**
+* Datagrams go to one peer while time passes, the peer answers requests
+* at once. Its address is refreshed before it expires, so no datagram
+* waits for it.
+*/
+static void bench_arp_refresh(uint32_t iterations)
+{
+	udp_socket_t socket = udp_socket_alloc(BENCH_UDP_PORT,bench_udp_callback);
+	uint32_t i;
+	uint32_t requests;
+	uint32_t stalls = 0;
+	uint16_t ms;
+	double start;
+
+	memset(&bench_resolve,0,sizeof(bench_resolve));
+	if(socket < 0)
+	{
+		bench_failures++;
+		printf("%-16s socket failed\n","arp-refresh");
+		return;
+	}
+	bench_set_tx_handler(bench_resolve_tx);
+	bench_resolve_peer(100,0);
+	bench_resolve_reply();
+	udp_bind_remote(socket,BENCH_UDP_PORT,(const ip_address*)&bench_resolve.ip);
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		/* a hundredth of the lifetime of the address passes */
+		for(ms = 0 ; ms < ARP_ENTRY_LIFETIME_MS / 100 ; ms++)
+		{
+			timer_tick();
+		}
+		timer_poll();
+		bench_resolve.seq = (uint8_t)i;
+		requests = bench_resolve.requests;
+		memset(udp_get_buffer(),bench_resolve.seq,64);
+		udp_send(socket,64);
+		bench_flush();
+		if(bench_resolve.delivered != i + 1)
+		{
+			stalls++;
+		}
+		if(bench_resolve.requests != requests)
+		{
+			bench_resolve_reply();
+		}
+	}
+	bench_report("arp-refresh",iterations,0,bench_now() - start);
+	if(bench_resolve.delivered != iterations || stalls || bench_resolve.corrupt)
+	{
+		bench_failures++;
+		printf("%-16s sent %u of %u datagrams, %u waited for requests, %u corrupt\n","arp-refresh",
+			bench_resolve.delivered,iterations,stalls,bench_resolve.corrupt);
+	}
+	udp_socket_free(socket);
+}
+
+static void bench_tcp_callback(tcp_socket_t socket,enum tcp_event event)
+{
+	switch(event)
+	{
+		case tcp_event_connection_incoming:
+			tcp_accept(socket);
+			break;
+		case tcp_event_connection_established:
+			bench_tcp.socket = socket;
+			bench_tcp.established = 1;
+			break;
+		case tcp_event_data_received:
+			bench_tcp.rx_bytes += tcp_read(socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+			break;
+		case tcp_event_data_acked:
+			if(bench_tcp.tx_pgm)
+			{
+				tcp_write_P(socket,bench_tcp_page,sizeof(bench_tcp_page));
+			}
+			else if(bench_tcp.tx_bytes)
+			{
+				tcp_write(socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+* Tracks sequence numbers of segments sent by the stack
+*/
+static void bench_tcp_tx(const uint8_t * frame,uint16_t len)
+{
+	const uint8_t * ip = frame + BENCH_ETH_HEADER_LEN;
+	const uint8_t * tcp = ip + (ip[0] & 0xf) * 4;
+	uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+	uint16_t data_len = ip_len - (ip[0] & 0xf) * 4 - (tcp[12] >> 4) * 4;
+	uint32_t seq = bench_get32(tcp + 4);
+
+	if(frame[12] != (ETHERNET_TYPE_IP >> 8) || frame[13] != (ETHERNET_TYPE_IP & 0xff) || ip[9] != IP_PROTOCOL_TCP)
+	{
+		return;
+	}
+	if(tcp[13] & BENCH_TCP_FLAG_SYN)
+	{
+		bench_tcp.ack = seq + 1;
+		return;
+	}
+	if(seq + data_len > bench_tcp.sent_end)
+	{
+		bench_tcp.sent_end = seq + data_len;
+	}
+}
+
+static uint8_t bench_tcp_connect(void)
+{
+	uint16_t len;
+
+	memset(&bench_tcp,0,sizeof(bench_tcp));
+	bench_tcp.listen = tcp_socket_alloc(bench_tcp_callback);
+	if(bench_tcp.listen < 0 || !tcp_listen(bench_tcp.listen,BENCH_TCP_PORT))
+	{
+		return 0;
+	}
+	bench_set_tx_handler(bench_tcp_tx);
+	bench_tcp.seq = 1000;
+	len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_SYN,0,0);
+	bench_process(bench_frame,len);
+	bench_tcp.seq++;
+	len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_ACK,0,0);
+	bench_process(bench_frame,len);
+	bench_tcp.sent_end = bench_tcp.ack;
+	return bench_tcp.established;
+}
+
+static void bench_tcp_rx(uint32_t iterations)
+{
+	uint32_t i;
+	uint16_t len;
+	double start;
+
+	if(!bench_tcp_connect())
+	{
+		bench_failures++;
+		printf("%-16s connection failed\n","tcp-rx");
+		return;
+	}
+	memset(bench_tcp.sink,0x3c,sizeof(bench_tcp.sink));
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_ACK|BENCH_TCP_FLAG_PSH,bench_tcp.sink,BENCH_TCP_PAYLOAD);
+		bench_process(bench_frame,len);
+		bench_tcp.seq += BENCH_TCP_PAYLOAD;
+	}
+	bench_report("tcp-rx",iterations,bench_tcp.rx_bytes,bench_now() - start);
+	if(bench_tcp.rx_bytes != iterations * BENCH_TCP_PAYLOAD)
+	{
+		bench_failures++;
+		printf("%-16s received %u of %u bytes\n","tcp-rx",bench_tcp.rx_bytes,iterations * BENCH_TCP_PAYLOAD);
+	}
+}
+
+static void bench_tcp_tx_stream(const char * name,uint32_t iterations,uint8_t pgm)
+{
+	uint32_t i;
+	uint32_t acked = 0;
+	uint16_t len;
+	double start;
+
+	if(!bench_tcp_connect())
+	{
+		bench_failures++;
+		printf("%-16s connection failed\n",name);
+		return;
+	}
+	bench_tcp.tx_bytes = 1;
+	bench_tcp.tx_pgm = pgm;
+	if(pgm)
+	{
+		tcp_write_P(bench_tcp.socket,bench_tcp_page,sizeof(bench_tcp_page));
+	}
+	else
+	{
+		tcp_write(bench_tcp.socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+	}
+	start = bench_now();
+	/* tcp_write() schedules transmission on the next timer tick */
+	bench_tick();
+	bench_tick();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		if(bench_tcp.sent_end == bench_tcp.ack)
+		{
+			/* nothing in flight, let the retransmission timer fire */
+			bench_tick();
+			continue;
+		}
+		acked += bench_tcp.sent_end - bench_tcp.ack;
+		bench_tcp.ack = bench_tcp.sent_end;
+		len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_ACK,0,0);
+		bench_process(bench_frame,len);
+	}
+	bench_report(name,iterations,acked,bench_now() - start);
+}
+
+static void bench_tcp_tx_run(uint32_t iterations)
+{
+	bench_tcp_tx_stream("tcp-tx",iterations,0);
+}
+
+/**
+* Sends a response stored in program memory, it goes to the controller
+* without being copied to RAM if the controller gathers frames
+*/
+static void bench_tcp_tx_pgm(uint32_t iterations)
+{
+	bench_tcp_tx_stream("tcp-tx-pgm",iterations,1);
+}
+
+/**
+* Checks fifo_enqueue_csum() and fifo_peek_csum() for every position
+* of the wrap around within the data
+*/
+static uint8_t bench_fifo_checksum(void)
+{
+	static uint8_t data[BENCH_TCP_PAYLOAD];
+	struct fifo * fifo = fifo_alloc();
+	uint16_t shift;
+	uint16_t len = sizeof(data) - 3;
+	uint16_t sum;
+	uint16_t checksum;
+	uint8_t ret = 1;
+
+	for(shift = 0 ; shift < fifo_size(fifo) ; shift += 1 + (shift & 0xf))
+	{
+		fifo_clear(fifo);
+		fifo_enqueue(fifo,bench_frame,shift);
+		fifo_skip(fifo,shift);
+		sum = net_get_checksum(0,bench_frame + 1,len,BENCH_NO_SKIP);
+		/* invalid checksum must not enqueue anything */
+		if(fifo_enqueue_csum(fifo,bench_frame + 1,len,~sum + 1) || fifo_length(fifo))
+		{
+			ret = 0;
+			break;
+		}
+		if(fifo_enqueue_csum(fifo,bench_frame + 1,len,~sum) != len)
+		{
+			ret = 0;
+			break;
+		}
+		checksum = 0;
+		if(fifo_peek_csum(fifo,data,len - 1,1,&checksum) != len - 1
+			|| checksum != net_get_checksum(0,bench_frame + 2,len - 1,BENCH_NO_SKIP)
+			|| memcmp(data,bench_frame + 2,len - 1))
+		{
+			ret = 0;
+			break;
+		}
+	}
+	if(!ret)
+	{
+		bench_failures++;
+		printf("%-16s fifo mismatch shift=%u\n","checksum",shift);
+	}
+	fifo_free(fifo);
+	return ret;
+}
+
+#if HAL_HOST_ENC28J60
+/**
+* Checks enc28j60_checksum() over data written to the controller,
+* including ranges wrapping around the end of the receive buffer
+*/
+static uint8_t bench_dma_checksum(void)
+{
+	uint16_t len;
+	uint16_t start;
+	uint16_t head;
+	uint16_t expected;
+
+	for(len = 1 ; len < BENCH_FRAME_MAX ; len += 37)
+	{
+		for(start = 0 ; start < 3 ; start++)
+		{
+			/* tail of the receive buffer, then its start */
+			head = len / 3 + start;
+			if(head > len)
+			{
+				head = len;
+			}
+			enc28j60_write16(EWRPTL,ENC28J60_RXSTOP_INIT + 1 - head);
+			enc28j60_write_buffer(head,bench_frame);
+			enc28j60_write16(EWRPTL,ENC28J60_RXSTART_INIT);
+			enc28j60_write_buffer(len - head,bench_frame + head);
+			expected = ~net_get_checksum(0,bench_frame,len,BENCH_NO_SKIP);
+			if(enc28j60_checksum(ENC28J60_RXSTOP_INIT + 1 - head,len) != expected)
+			{
+				bench_failures++;
+				printf("%-16s mismatch len=%u head=%u\n","dma-checksum",len,head);
+				return 0;
+			}
+		}
+	}
+	enc28j60_model_clear_stats();
+	return 1;
+}
+#endif
+
+/**
+* Checks net_get_checksum() against the reference implementation and
+* compares their speed
+*/
+static void bench_checksum(uint32_t iterations)
+{
+	uint16_t (*const impl[2])(uint16_t,const uint8_t*,uint16_t,uint8_t) = {net_get_checksum_reference,net_get_checksum};
+	const char * names[2] = {"checksum-ref","checksum"};
+	volatile uint16_t result = 0;
+	uint32_t i;
+	uint16_t len;
+	uint16_t skip;
+	uint8_t n;
+	double start;
+
+	for(i = 0 ; i < sizeof(bench_frame) ; i++)
+	{
+		bench_frame[i] = (uint8_t)(i * 151 + (i >> 3));
+	}
+	for(len = 0 ; len < sizeof(bench_frame) ; len++)
+	{
+		for(skip = 0 ; skip < 24 ; skip++)
+		{
+			if(net_get_checksum(len,bench_frame + (skip & 3),len,skip) != net_get_checksum_reference(len,bench_frame + (skip & 3),len,skip))
+			{
+				bench_failures++;
+				printf("%-16s mismatch len=%u skip=%u\n","checksum",len,skip);
+				return;
+			}
+		}
+	}
+	if(!bench_fifo_checksum())
+	{
+		return;
+	}
+#if HAL_HOST_ENC28J60
+	if(!bench_dma_checksum())
+	{
+		return;
+	}
+#endif
+	for(n = 0 ; n < 2 ; n++)
+	{
+		start = bench_now();
+		for(i = 0 ; i < iterations ; i++)
+		{
+			result += impl[n](0,bench_frame,BENCH_TCP_PAYLOAD,16);
+		}
+		bench_report(names[n],iterations,iterations * BENCH_TCP_PAYLOAD,bench_now() - start);
+	}
+}
+
+/**
+* Lets the stack retransmit unacknowledged segment while peer keeps
+* sending data, so acknowledgment number and window change between
+* retransmissions
+*/
+static void bench_tcp_rtx(uint32_t iterations)
+{
+	uint32_t i;
+	uint32_t count;
+	uint16_t len;
+	uint16_t t;
+	double start;
+
+	if(!bench_tcp_connect())
+	{
+		bench_failures++;
+		printf("%-16s connection failed\n","tcp-rtx");
+		return;
+	}
+	tcp_write(bench_tcp.socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+	bench_tick();
+	bench_tick();
+	start = bench_now();
+	for(i = 0 ; i < iterations ; i++)
+	{
+		/* retransmission counter is not reset by incoming data */
+		if(i % TCP_RTX_DATA == TCP_RTX_DATA - 1)
+		{
+			bench_tcp.ack = bench_tcp.sent_end;
+			len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_ACK,0,0);
+			bench_process(bench_frame,len);
+			tcp_write(bench_tcp.socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+		}
+		len = bench_tcp_frame(bench_frame,BENCH_TCP_FLAG_ACK|BENCH_TCP_FLAG_PSH,bench_tcp.sink,1 + (i & 0xf));
+		bench_process(bench_frame,len);
+		bench_tcp.seq += 1 + (i & 0xf);
+		tcp_read(bench_tcp.socket,bench_tcp.sink,sizeof(bench_tcp.sink));
+		count = hal_host_get_stats()->tx_frames;
+		for(t = 0 ; t <= TCP_TIMEOUT_GENERIC && hal_host_get_stats()->tx_frames == count ; t++)
+		{
+			bench_tick();
+		}
+	}
+	bench_report("tcp-rtx",iterations,0,bench_now() - start);
+}
+
+static const struct bench_scenario bench_scenarios[] =
+{
+	{"arp",bench_arp},
+	{"arp-foreign",bench_arp_foreign},
+	{"broadcast",bench_broadcast},
+	{"icmp",bench_icmp},
+	{"icmp-ping",bench_icmp_ping},
+	{"udp-closed",bench_udp_closed},
+	{"error-limit",bench_error_limit},
+	{"ip-foreign",bench_ip_foreign},
+	{"ethertype",bench_ethertype},
+	{"udp-tx",bench_udp_tx_burst},
+	{"udp-demux",bench_udp_demux},
+	{"udp-ephemeral",bench_udp_ephemeral},
+	{"udp-sendto",bench_udp_sendto},
+	{"ip-reass",bench_ip_reass},
+	{"udp-tx-frag",bench_udp_tx_frag},
+	{"arp-resolve",bench_arp_resolve},
+	{"udp-frag-held",bench_udp_frag_held},
+	{"arp-cache",bench_arp_cache},
+	{"arp-refresh",bench_arp_refresh},
+	{"tcp-rx",bench_tcp_rx},
+	{"tcp-tx",bench_tcp_tx_run},
+	{"tcp-tx-pgm",bench_tcp_tx_pgm},
+	{"tcp-rtx",bench_tcp_rtx},
+	{"checksum",bench_checksum},
+#if HAL_HOST_ENC28J60
+	{"tx-stall",bench_tx_stall},
+#endif
+};
+
+#define BENCH_NSCENARIOS	(sizeof(bench_scenarios)/sizeof(bench_scenarios[0]))
+
+static void bench_init(void)
+{
+	timer_init();
+	fifo_init();
+	hal_host_init((const uint8_t*)&bench_mac);
+	hal_host_set_tx_callback(bench_tx);
+#if HAL_HOST_ENC28J60
+	enc28j60_init((const uint8_t*)&bench_mac);
+	enc28j60_model_set_tx_delay(BENCH_TX_DELAY);
+	enc28j60_model_clear_stats();
+#endif
+	bench_set_tx_handler(0);
+	bench_tx_errors = 0;
+	ethernet_init(&bench_mac);
+	ip_init(&bench_ip,0,0);
+	arp_init();
+	icmp_init();
+	udp_init();
+	tcp_init();
+}
+
+static void bench_replay(uint32_t iterations)
+{
+	uint32_t i;
+	uint32_t frames;
+	double start = bench_now();
+
+	for(i = 0 ; i < iterations ; i++)
+	{
+		hal_host_rewind();
+		do
+		{
+			frames = hal_host_get_stats()->rx_frames;
+			ethernet_handle_packet();
+			bench_flush();
+		}while(hal_host_get_stats()->rx_frames != frames);
+	}
+	bench_report("pcap-replay",hal_host_get_stats()->rx_frames,hal_host_get_stats()->rx_bytes,bench_now() - start);
+}
+
+static void bench_usage(const char * name)
+{
+	uint8_t i;
+	fprintf(stderr,"usage: %s [-n iterations] [-r rx.pcap] [-w tx.pcap] [scenario...]\n",name);
+	fprintf(stderr,"scenarios:");
+	for(i = 0 ; i < BENCH_NSCENARIOS ; i++)
+	{
+		fprintf(stderr," %s",bench_scenarios[i].name);
+	}
+	fprintf(stderr,"\n");
+}
+
+int main(int argc,char ** argv)
+{
+	uint32_t iterations = BENCH_ITERATIONS;
+	const char * rx_path = 0;
+	const char * tx_path = 0;
+	uint8_t i;
+	int opt;
+
+	while((opt = getopt(argc,argv,"n:r:w:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				if(sscanf(optarg,"%u",&iterations) != 1)
+				{
+					iterations = 0;
+				}
+				break;
+			case 'r':
+				rx_path = optarg;
+				break;
+			case 'w':
+				tx_path = optarg;
+				break;
+			default:
+				bench_usage(argv[0]);
+				return 1;
+		}
+	}
+	if(!iterations)
+	{
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	bench_init();
+	if((rx_path || tx_path) && !hal_host_open_pcap(rx_path,tx_path))
+	{
+		fprintf(stderr,"%s: cannot open pcap file\n",argv[0]);
+		return 1;
+	}
+
+	if(rx_path)
+	{
+		bench_replay(iterations);
+	}
+	else if(optind >= argc)
+	{
+		for(i = 0 ; i < BENCH_NSCENARIOS ; i++)
+		{
+			bench_scenarios[i].run(iterations);
+			bench_init();
+		}
+	}
+	for(; optind < argc ; optind++)
+	{
+		for(i = 0 ; i < BENCH_NSCENARIOS ; i++)
+		{
+			if(!strcmp(argv[optind],bench_scenarios[i].name))
+			{
+				bench_scenarios[i].run(iterations);
+				bench_init();
+				break;
+			}
+		}
+		if(i == BENCH_NSCENARIOS)
+		{
+			bench_usage(argv[0]);
+			return 1;
+		}
+	}
+	hal_host_close();
+	return bench_failures != 0;
+}
+/**
+* @}
+*/
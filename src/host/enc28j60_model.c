@@ -0,0 +1,630 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Register-level ENC28J60 model implementation
+* @author agent <agent@local>
+*/
+
+#include "enc28j60_model.h"
+#include "spi_host.h"
+#include "hal_host.h"
+
+#include "../dev/enc28j60.h"
+
+#include <string.h>
+
+#define ENC28J60_MODEL_MEM_SIZE		0x2000
+#define ENC28J60_MODEL_MEM_MASK		(ENC28J60_MODEL_MEM_SIZE-1)
+#define ENC28J60_MODEL_FRAME_MAX	1518
+#define ENC28J60_MODEL_RX_HEADER_LEN	6
+#define ENC28J60_MODEL_CRC_LEN		4
+#define ENC28J60_MODEL_TSV_LEN		7
+#define ENC28J60_MODEL_REVISION		0x06
+
+/* opcode part of the first byte of an SPI transaction */
+#define ENC28J60_MODEL_OPC_MASK		0xE0
+#define ENC28J60_MODEL_OPC_RBM		(ENC28J60_OPC_RBM & ENC28J60_MODEL_OPC_MASK)
+#define ENC28J60_MODEL_OPC_WBM		(ENC28J60_OPC_WBM & ENC28J60_MODEL_OPC_MASK)
+
+/**
+* Register storage for a register define from enc28j60.h (bank in bits
+* 5-6, the MAC/MII dummy byte flag in bit 7 is ignored)
+*/
+#define ENC28J60_MODEL_REG(reg)		(enc28j60_model.regs[((reg) & ENC28J60_BANK_MASK) >> 5][(reg) & ENC28J60_ADDR_MASK])
+
+struct enc28j60_model
+{
+	uint8_t mem[ENC28J60_MODEL_MEM_SIZE];
+	uint8_t regs[4][ENC28J60_ADDR_MASK+1];
+	uint16_t phy[ENC28J60_ADDR_MASK+1];
+	/* chip select state */
+	uint8_t selected;
+	/* first byte of the current transaction */
+	uint8_t command;
+	/* number of bytes clocked in the current transaction */
+	uint16_t count;
+	uint8_t frame[ENC28J60_MODEL_FRAME_MAX];
+	/* SPI transactions a transmission lasts, 0 sends at once */
+	uint16_t tx_delay;
+	/* SPI transactions left until the frame in progress is sent */
+	uint16_t tx_countdown;
+	/* transmissions never complete, like a hung transmit logic */
+	uint8_t tx_stall;
+	struct enc28j60_model_stats stats;
+};
+
+static struct enc28j60_model enc28j60_model;
+
+uint8_t spi_host_data;
+
+/**
+* The ENC28J60 is the only device on the host SPI bus
+*/
+void spi_host_transfer(void)
+{
+	spi_host_data = enc28j60_model_transfer(spi_host_data);
+}
+
+static uint16_t enc28j60_model_get16(uint8_t reg)
+{
+	return ENC28J60_MODEL_REG(reg) | ((uint16_t)ENC28J60_MODEL_REG(reg+1) << 8);
+}
+
+static void enc28j60_model_set16(uint8_t reg,uint16_t val)
+{
+	ENC28J60_MODEL_REG(reg) = val & 0xff;
+	ENC28J60_MODEL_REG(reg+1) = (val >> 8) & (ENC28J60_MODEL_MEM_MASK >> 8);
+}
+
+/**
+* Returns the address following addr. Addresses inside the receive
+* buffer wrap from ERXND to ERXST, all other wrap at the end of memory.
+*/
+static uint16_t enc28j60_model_next(uint16_t addr)
+{
+	uint16_t rx_start = enc28j60_model_get16(ERXSTL);
+	uint16_t rx_end = enc28j60_model_get16(ERXNDL);
+
+	if(addr == rx_end && rx_start <= rx_end)
+	{
+		return rx_start;
+	}
+	return (addr + 1) & ENC28J60_MODEL_MEM_MASK;
+}
+
+static uint16_t enc28j60_model_rx_free(void)
+{
+	uint16_t rx_start = enc28j60_model_get16(ERXSTL);
+	uint16_t rx_end = enc28j60_model_get16(ERXNDL);
+	uint16_t rx_size = rx_end - rx_start + 1;
+	uint16_t wr = enc28j60_model_get16(ERXWRPTL);
+	uint16_t rd = enc28j60_model_get16(ERXRDPTL);
+
+	if(rd > wr)
+	{
+		return rd - wr;
+	}
+	return rx_size - (wr - rd);
+}
+
+/**
+* Pattern match filter: the checksum of the window bytes selected by EPMM
+* has to equal EPMCS. Frames shorter than the window never match, short
+* frames are padded to 60 bytes on the wire.
+*/
+static uint8_t enc28j60_model_rx_pattern(const uint8_t * frame,uint16_t len)
+{
+	uint16_t offset = enc28j60_model_get16(EPMOL);
+	uint16_t wire_len = (len < 60 ? 60 : len) + ENC28J60_MODEL_CRC_LEN;
+	uint32_t sum = 0;
+	uint8_t count = 0;
+	uint8_t i;
+
+	if(offset + 64 > wire_len)
+	{
+		return 0;
+	}
+	for(i = 0 ; i < 64 ; i++)
+	{
+		uint8_t data;
+
+		if(!(ENC28J60_MODEL_REG(EPMM0 + (i >> 3)) & (1 << (i & 7))))
+		{
+			continue;
+		}
+		/* padding, the CRC is not modelled */
+		data = offset + i < len ? frame[offset + i] : 0;
+		sum += (count++ & 1) ? data : ((uint16_t)data << 8);
+	}
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (uint16_t)~sum == enc28j60_model_get16(EPMCSL);
+}
+
+/**
+* Hash table filter: bits 28:23 of the CRC of the destination address
+* select a bit of EHT
+*/
+static uint8_t enc28j60_model_rx_hash(const uint8_t * frame)
+{
+	uint32_t crc = 0xffffffff;
+	uint8_t i,j,bit;
+
+	for(i = 0 ; i < 6 ; i++)
+	{
+		uint8_t data = frame[i];
+
+		for(j = 0 ; j < 8 ; j++)
+		{
+			uint8_t carry = ((crc >> 31) ^ data) & 1;
+
+			crc <<= 1;
+			data >>= 1;
+			if(carry)
+			{
+				crc ^= 0x04c11db7;
+			}
+		}
+	}
+	bit = (crc >> 23) & 0x3f;
+	return (ENC28J60_MODEL_REG(EHT0 + (bit >> 3)) >> (bit & 7)) & 1;
+}
+
+static uint8_t enc28j60_model_rx_accept(const uint8_t * frame,uint16_t len)
+{
+	uint8_t filter = ENC28J60_MODEL_REG(ERXFCON);
+	const uint8_t mac[6] =
+	{
+		ENC28J60_MODEL_REG(MAADR5),ENC28J60_MODEL_REG(MAADR4),ENC28J60_MODEL_REG(MAADR3),
+		ENC28J60_MODEL_REG(MAADR2),ENC28J60_MODEL_REG(MAADR1),ENC28J60_MODEL_REG(MAADR0)
+	};
+	static const uint8_t broadcast[6] = {0xff,0xff,0xff,0xff,0xff,0xff};
+
+	if(!filter || !(filter & ~ERXFCON_CRCEN))
+	{
+		/* promiscuous */
+		return 1;
+	}
+	if((filter & ERXFCON_UCEN) && !memcmp(frame,mac,sizeof(mac)))
+	{
+		return 1;
+	}
+	if((filter & ERXFCON_BCEN) && !memcmp(frame,broadcast,sizeof(broadcast)))
+	{
+		return 1;
+	}
+	if((filter & ERXFCON_MCEN) && (frame[0] & 0x01) && memcmp(frame,broadcast,sizeof(broadcast)))
+	{
+		return 1;
+	}
+	if((filter & ERXFCON_PMEN) && enc28j60_model_rx_pattern(frame,len))
+	{
+		return 1;
+	}
+	if((filter & ERXFCON_HTEN) && enc28j60_model_rx_hash(frame))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* Takes one frame from the wire and stores it in the receive buffer
+* together with the next packet pointer and the receive status vector
+*/
+static void enc28j60_model_rx_poll(void)
+{
+	uint16_t len;
+	uint16_t addr;
+	uint16_t next;
+	uint16_t total;
+	uint16_t i;
+	uint8_t header[ENC28J60_MODEL_RX_HEADER_LEN];
+	static const uint8_t broadcast[6] = {0xff,0xff,0xff,0xff,0xff,0xff};
+
+	if(!(ENC28J60_MODEL_REG(ECON1) & ECON1_RXEN) || ENC28J60_MODEL_REG(EPKTCNT) == 0xff)
+	{
+		return;
+	}
+	len = hal_host_receive_packet(enc28j60_model.frame,ENC28J60_MODEL_FRAME_MAX - ENC28J60_MODEL_CRC_LEN);
+	if(len < 6)
+	{
+		return;
+	}
+	if(!enc28j60_model_rx_accept(enc28j60_model.frame,len))
+	{
+		enc28j60_model.stats.rx_filtered++;
+		return;
+	}
+	/* frames always start at even addresses */
+	total = ENC28J60_MODEL_RX_HEADER_LEN + len + ENC28J60_MODEL_CRC_LEN;
+	total += total & 1;
+	if(total >= enc28j60_model_rx_free())
+	{
+		enc28j60_model.stats.rx_overflows++;
+		ENC28J60_MODEL_REG(EIR) |= EIR_RXERIF;
+		return;
+	}
+	addr = enc28j60_model_get16(ERXWRPTL);
+	next = addr;
+	for(i = 0 ; i < total ; i++)
+	{
+		next = enc28j60_model_next(next);
+	}
+	header[0] = next & 0xff;
+	header[1] = next >> 8;
+	header[2] = (len + ENC28J60_MODEL_CRC_LEN) & 0xff;
+	header[3] = (len + ENC28J60_MODEL_CRC_LEN) >> 8;
+	/* received ok */
+	header[4] = 0x80;
+	/* broadcast / multicast */
+	header[5] = 0;
+	if(enc28j60_model.frame[0] & 0x01)
+	{
+		header[5] = memcmp(enc28j60_model.frame,broadcast,sizeof(broadcast)) ? 0x01 : 0x02;
+	}
+	for(i = 0 ; i < ENC28J60_MODEL_RX_HEADER_LEN ; i++)
+	{
+		enc28j60_model.mem[addr] = header[i];
+		addr = enc28j60_model_next(addr);
+	}
+	for(i = 0 ; i < len + ENC28J60_MODEL_CRC_LEN ; i++)
+	{
+		enc28j60_model.mem[addr] = i < len ? enc28j60_model.frame[i] : 0;
+		addr = enc28j60_model_next(addr);
+	}
+	enc28j60_model_set16(ERXWRPTL,next);
+	ENC28J60_MODEL_REG(EPKTCNT)++;
+	ENC28J60_MODEL_REG(EIR) |= EIR_PKTIF;
+}
+
+/**
+* Sends the frame between ETXST+1 and ETXND (ETXST holds the per-packet
+* control byte) and writes the transmit status vector after it
+*/
+static void enc28j60_model_tx(void)
+{
+	uint16_t start = enc28j60_model_get16(ETXSTL);
+	uint16_t end = enc28j60_model_get16(ETXNDL);
+	uint16_t len = (end - start) & ENC28J60_MODEL_MEM_MASK;
+	uint16_t addr;
+	uint16_t i;
+
+	if(len > ENC28J60_MODEL_FRAME_MAX)
+	{
+		len = ENC28J60_MODEL_FRAME_MAX;
+	}
+	addr = (start + 1) & ENC28J60_MODEL_MEM_MASK;
+	for(i = 0 ; i < len ; i++)
+	{
+		enc28j60_model.frame[i] = enc28j60_model.mem[addr];
+		addr = (addr + 1) & ENC28J60_MODEL_MEM_MASK;
+	}
+	hal_host_send_packet(enc28j60_model.frame,len);
+	/* transmit status vector: byte count and transmit done */
+	addr = (end + 1) & ENC28J60_MODEL_MEM_MASK;
+	for(i = 0 ; i < ENC28J60_MODEL_TSV_LEN ; i++)
+	{
+		enc28j60_model.mem[(addr + i) & ENC28J60_MODEL_MEM_MASK] = 0;
+	}
+	enc28j60_model.mem[addr] = len & 0xff;
+	enc28j60_model.mem[(addr + 1) & ENC28J60_MODEL_MEM_MASK] = len >> 8;
+	enc28j60_model.mem[(addr + 2) & ENC28J60_MODEL_MEM_MASK] = 0x80;
+	ENC28J60_MODEL_REG(ECON1) &= ~ECON1_TXRTS;
+	ENC28J60_MODEL_REG(EIR) |= EIR_TXIF;
+}
+
+/**
+* Runs the DMA: either computes the IP checksum of EDMAST..EDMAND into
+* EDMACS or copies it to EDMADST. The checksum is stored so that
+* EDMACSH:EDMACSL read as a big endian 16-bit value gives the checksum
+* field in network byte order.
+*/
+static void enc28j60_model_dma(void)
+{
+	uint16_t addr = enc28j60_model_get16(EDMASTL);
+	uint16_t end = enc28j60_model_get16(EDMANDL);
+	uint16_t dst = enc28j60_model_get16(EDMADSTL);
+	uint32_t sum = 0;
+	uint16_t count = 0;
+
+	if(ENC28J60_MODEL_REG(ECON1) & ECON1_CSUMEN)
+	{
+		for(;;)
+		{
+			sum += (count & 1) ? enc28j60_model.mem[addr] : ((uint16_t)enc28j60_model.mem[addr] << 8);
+			count++;
+			if(addr == end)
+			{
+				break;
+			}
+			addr = enc28j60_model_next(addr);
+		}
+		while(sum >> 16)
+		{
+			sum = (sum & 0xffff) + (sum >> 16);
+		}
+		sum = ~sum & 0xffff;
+		ENC28J60_MODEL_REG(EDMACSH) = sum >> 8;
+		ENC28J60_MODEL_REG(EDMACSL) = sum & 0xff;
+		enc28j60_model.stats.dma_checksums++;
+		enc28j60_model.stats.dma_checksum_bytes += count;
+	}
+	else
+	{
+		for(;;)
+		{
+			enc28j60_model.mem[dst] = enc28j60_model.mem[addr];
+			count++;
+			if(addr == end)
+			{
+				break;
+			}
+			addr = enc28j60_model_next(addr);
+			dst = enc28j60_model_next(dst);
+		}
+		enc28j60_model.stats.dma_copies++;
+		enc28j60_model.stats.dma_copy_bytes += count;
+	}
+	ENC28J60_MODEL_REG(ECON1) &= ~ECON1_DMAST;
+	ENC28J60_MODEL_REG(EIR) |= EIR_DMAIF;
+}
+
+/**
+* Returns register define (bank and address) of the 5-bit address in
+* the currently selected bank
+*/
+static uint8_t enc28j60_model_reg_addr(uint8_t addr)
+{
+	if(addr >= EIE)
+	{
+		return addr;
+	}
+	return ((ENC28J60_MODEL_REG(ECON1) & (ECON1_BSEL1|ECON1_BSEL0)) << 5) | addr;
+}
+
+static uint8_t enc28j60_model_read_reg(uint8_t reg)
+{
+	return ENC28J60_MODEL_REG(reg);
+}
+
+static void enc28j60_model_write_reg(uint8_t reg,uint8_t val)
+{
+	/* bits changed from 0 to 1 */
+	uint8_t set = val & ~ENC28J60_MODEL_REG(reg);
+
+	switch(reg)
+	{
+		case EPKTCNT:
+		case EREVID:
+		case EDMACSL:
+		case EDMACSH:
+		case (MISTAT & ~ENC28J60_SPRD_MASK):
+			/* read only */
+			return;
+		case ECON2:
+			if(val & ECON2_PKTDEC)
+			{
+				if(ENC28J60_MODEL_REG(EPKTCNT))
+				{
+					ENC28J60_MODEL_REG(EPKTCNT)--;
+				}
+				if(!ENC28J60_MODEL_REG(EPKTCNT))
+				{
+					ENC28J60_MODEL_REG(EIR) &= ~EIR_PKTIF;
+				}
+				val &= ~ECON2_PKTDEC;
+			}
+			break;
+		case ECON1:
+			if((val & ECON1_TXRST) || !(val & ECON1_TXRTS))
+			{
+				/* transmit logic reset or transmission aborted */
+				enc28j60_model.tx_countdown = 0;
+				val &= ~ECON1_TXRTS;
+				set &= ~ECON1_TXRTS;
+			}
+			break;
+	}
+	ENC28J60_MODEL_REG(reg) = val;
+	switch(reg)
+	{
+		case ERXSTL:
+		case ERXSTH:
+			/* the receive write pointer follows the buffer start */
+			enc28j60_model_set16(ERXWRPTL,enc28j60_model_get16(ERXSTL));
+			break;
+		case (MIWRH & ~ENC28J60_SPRD_MASK):
+			enc28j60_model.phy[ENC28J60_MODEL_REG(MIREGADR) & ENC28J60_ADDR_MASK] =
+				ENC28J60_MODEL_REG(MIWRL) | ((uint16_t)val << 8);
+			break;
+		case (MICMD & ~ENC28J60_SPRD_MASK):
+			if(val & MICMD_MIIRD)
+			{
+				uint16_t phy = enc28j60_model.phy[ENC28J60_MODEL_REG(MIREGADR) & ENC28J60_ADDR_MASK];
+				ENC28J60_MODEL_REG(MIRDL) = phy & 0xff;
+				ENC28J60_MODEL_REG(MIRDH) = phy >> 8;
+			}
+			break;
+		case ECON1:
+			if(set & ECON1_DMAST)
+			{
+				if(ENC28J60_MODEL_REG(ECON1) & ECON1_RXEN)
+				{
+					enc28j60_model.stats.dma_rx_enabled++;
+				}
+				enc28j60_model_dma();
+			}
+			if((set & ECON1_TXRTS) && !enc28j60_model.tx_stall)
+			{
+				/* the frame is read from the buffer when it leaves the wire */
+				enc28j60_model.tx_countdown = enc28j60_model.tx_delay;
+				if(!enc28j60_model.tx_countdown)
+				{
+					enc28j60_model_tx();
+				}
+			}
+			break;
+	}
+}
+
+void enc28j60_model_reset(void)
+{
+	memset(enc28j60_model.regs,0,sizeof(enc28j60_model.regs));
+	memset(enc28j60_model.phy,0,sizeof(enc28j60_model.phy));
+	enc28j60_model.command = 0;
+	enc28j60_model.count = 0;
+	enc28j60_model.tx_countdown = 0;
+	enc28j60_model.tx_stall = 0;
+	ENC28J60_MODEL_REG(ECON2) = ECON2_AUTOINC;
+	ENC28J60_MODEL_REG(ESTAT) = ESTAT_CLKRDY;
+	ENC28J60_MODEL_REG(EREVID) = ENC28J60_MODEL_REVISION;
+	ENC28J60_MODEL_REG(ERXFCON) = ERXFCON_UCEN|ERXFCON_CRCEN|ERXFCON_BCEN;
+	enc28j60_model_set16(ERXSTL,0x05fa);
+	enc28j60_model_set16(ERXNDL,0x1fff);
+	enc28j60_model_set16(ERDPTL,0x05fa);
+	enc28j60_model_set16(ERXRDPTL,0x05fa);
+	enc28j60_model_set16(ERXWRPTL,0x05fa);
+}
+
+void enc28j60_model_select(uint8_t active)
+{
+	if(active && !enc28j60_model.selected)
+	{
+		enc28j60_model.stats.spi_transactions++;
+		enc28j60_model.count = 0;
+		if(enc28j60_model.tx_countdown && !--enc28j60_model.tx_countdown)
+		{
+			enc28j60_model_tx();
+		}
+	}
+	enc28j60_model.selected = active;
+}
+
+/**
+* Clocks one byte over SPI and returns the byte clocked out of the chip
+*/
+uint8_t enc28j60_model_transfer(uint8_t data)
+{
+	uint8_t opcode = enc28j60_model.command & ENC28J60_MODEL_OPC_MASK;
+	uint8_t reg = enc28j60_model_reg_addr(enc28j60_model.command & ENC28J60_ADDR_MASK);
+	uint8_t ret = 0xff;
+	uint16_t ptr;
+
+	if(!enc28j60_model.selected)
+	{
+		return ret;
+	}
+	enc28j60_model.stats.spi_bytes++;
+	if(!enc28j60_model.count++)
+	{
+		enc28j60_model.command = data;
+		if(data == ENC28J60_OPC_RES)
+		{
+			enc28j60_model_reset();
+			enc28j60_model.command = ENC28J60_OPC_RES;
+			return ret;
+		}
+		reg = enc28j60_model_reg_addr(data & ENC28J60_ADDR_MASK);
+		if((data & ENC28J60_MODEL_OPC_MASK) == ENC28J60_OPC_RCR && (reg == EPKTCNT || reg == EIR))
+		{
+			/* frames arrive while the driver polls for them */
+			enc28j60_model_rx_poll();
+		}
+		return ret;
+	}
+	if(enc28j60_model.command == ENC28J60_OPC_RES)
+	{
+		return ret;
+	}
+	switch(opcode)
+	{
+		case ENC28J60_OPC_RCR:
+			/* MAC and MII reads clock a dummy byte first */
+			ret = enc28j60_model_read_reg(reg);
+			break;
+		case ENC28J60_MODEL_OPC_RBM:
+			ptr = enc28j60_model_get16(ERDPTL);
+			ret = enc28j60_model.mem[ptr];
+			if(ENC28J60_MODEL_REG(ECON2) & ECON2_AUTOINC)
+			{
+				enc28j60_model_set16(ERDPTL,enc28j60_model_next(ptr));
+			}
+			break;
+		case ENC28J60_OPC_WCR:
+			if(enc28j60_model.count == 2)
+			{
+				enc28j60_model_write_reg(reg,data);
+			}
+			break;
+		case ENC28J60_MODEL_OPC_WBM:
+			ptr = enc28j60_model_get16(EWRPTL);
+			enc28j60_model.mem[ptr] = data;
+			if(ENC28J60_MODEL_REG(ECON2) & ECON2_AUTOINC)
+			{
+				enc28j60_model_set16(EWRPTL,(ptr + 1) & ENC28J60_MODEL_MEM_MASK);
+			}
+			break;
+		case ENC28J60_OPC_BFS:
+			if(enc28j60_model.count == 2)
+			{
+				enc28j60_model_write_reg(reg,ENC28J60_MODEL_REG(reg) | data);
+			}
+			break;
+		case ENC28J60_OPC_BFC:
+			if(enc28j60_model.count == 2)
+			{
+				enc28j60_model_write_reg(reg,ENC28J60_MODEL_REG(reg) & ~data);
+			}
+			break;
+	}
+	return ret;
+}
+
+/**
+* Makes transmissions last the given number of SPI transactions so that
+* the driver can write the buffer while a frame is still being sent
+*/
+void enc28j60_model_set_tx_delay(uint16_t transactions)
+{
+	enc28j60_model.tx_delay = transactions;
+}
+
+/**
+* Stalls the transmit logic, a transmission started meanwhile completes
+* only when the stall ends
+*/
+void enc28j60_model_set_tx_stall(uint8_t stall)
+{
+	enc28j60_model.tx_stall = stall;
+	if(!stall && (ENC28J60_MODEL_REG(ECON1) & ECON1_TXRTS) && !enc28j60_model.tx_countdown)
+	{
+		enc28j60_model_tx();
+	}
+}
+
+void enc28j60_model_clear_stats(void)
+{
+	memset(&enc28j60_model.stats,0,sizeof(enc28j60_model.stats));
+}
+
+const struct enc28j60_model_stats * enc28j60_model_get_stats(void)
+{
+	return (const struct enc28j60_model_stats*)&enc28j60_model.stats;
+}
+/**
+* @}
+*/
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _ENC28J60_MODEL_H
+#define _ENC28J60_MODEL_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Register-level model of the ENC28J60 for the host build. The model
+* decodes the SPI instruction set (RCR, RBM, WCR, WBM, BFS, BFC, SRC),
+* keeps the four register banks, the PHY registers and the 8 KB buffer
+* memory, and implements the receive filters, the receive ring,
+* transmission, the DMA copy and the DMA checksum engine. The unmodified driver (src/dev/enc28j60.c)
+* runs on top of it; the wire side of the model is the host HAL backend
+* (hal_host_send_packet() / hal_host_receive_packet()).
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+
+struct enc28j60_model_stats
+{
+	/* bytes clocked over SPI */
+	uint32_t spi_bytes;
+	/* chip select assertions */
+	uint32_t spi_transactions;
+	/* DMA checksum operations and bytes covered by them */
+	uint32_t dma_checksums;
+	uint32_t dma_checksum_bytes;
+	/* DMA copy operations and bytes copied */
+	uint32_t dma_copies;
+	uint32_t dma_copy_bytes;
+	/* DMA operations started while reception was enabled */
+	uint32_t dma_rx_enabled;
+	/* frames rejected by the receive filters */
+	uint32_t rx_filtered;
+	/* frames dropped because the receive buffer was full */
+	uint32_t rx_overflows;
+};
+
+void enc28j60_model_reset(void);
+void enc28j60_model_select(uint8_t active);
+uint8_t enc28j60_model_transfer(uint8_t data);
+void enc28j60_model_set_tx_delay(uint16_t transactions);
+void enc28j60_model_set_tx_stall(uint8_t stall);
+void enc28j60_model_clear_stats(void);
+const struct enc28j60_model_stats * enc28j60_model_get_stats(void);
+
+/**
+* @}
+*/
+#endif //_ENC28J60_MODEL_H
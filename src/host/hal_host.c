@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Host (Linux) network interface backend implementation
+* @author agent <agent@local>
+*/
+
+#include "hal_host.h"
+#include "../net/net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define HAL_HOST_FRAME_MAX	1518
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_SWAPPED	0xd4c3b2a1
+#define PCAP_VERSION_MAJOR	2
+#define PCAP_VERSION_MINOR	4
+#define PCAP_LINKTYPE_ETHERNET	1
+
+struct pcap_file_header
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header
+{
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+struct hal_host
+{
+	/* peer socket, -1 if not used */
+	int fd;
+	/* frames loaded from pcap file */
+	uint8_t * rx_data;
+	uint32_t rx_data_len;
+	uint32_t rx_offset;
+	/* transmitted frames are appended to this pcap file */
+	FILE * tx_pcap;
+	/* frame injected from memory */
+	const uint8_t * inject_frame;
+	uint16_t inject_len;
+	hal_host_tx_callback tx_callback;
+	/* frame being processed with hal_host_rx_*() */
+	uint8_t rx_frame[HAL_HOST_FRAME_MAX];
+	uint16_t rx_frame_len;
+	struct hal_host_stats stats;
+};
+
+static struct hal_host hal_host = {.fd = -1};
+
+static uint32_t hal_host_swap32(uint32_t val)
+{
+	return ((val & 0x000000ff) << 24) |
+		((val & 0x0000ff00) << 8) |
+		((val & 0x00ff0000) >> 8) |
+		((val & 0xff000000) >> 24);
+}
+
+static uint8_t hal_host_load_pcap(const char * path);
+
+void hal_host_init(const uint8_t * mac)
+{
+	memset(&hal_host.stats,0,sizeof(hal_host.stats));
+}
+
+const struct hal_host_stats * hal_host_get_stats(void)
+{
+	return (const struct hal_host_stats*)&hal_host.stats;
+}
+
+/**
+* Returns monotonic time in nanoseconds
+*/
+uint64_t hal_host_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void hal_host_set_tx_callback(hal_host_tx_callback callback)
+{
+	hal_host.tx_callback = callback;
+}
+
+uint8_t hal_host_open_socket(int fd)
+{
+	if(fd < 0)
+	{
+		return 0;
+	}
+	hal_host.fd = fd;
+	return 1;
+}
+
+uint8_t hal_host_open_pcap(const char * rx_path,const char * tx_path)
+{
+	if(rx_path && !hal_host_load_pcap(rx_path))
+	{
+		return 0;
+	}
+	if(tx_path)
+	{
+		struct pcap_file_header header;
+		
+		hal_host.tx_pcap = fopen(tx_path,"wb");
+		if(!hal_host.tx_pcap)
+		{
+			return 0;
+		}
+		memset(&header,0,sizeof(header));
+		header.magic = PCAP_MAGIC;
+		header.version_major = PCAP_VERSION_MAJOR;
+		header.version_minor = PCAP_VERSION_MINOR;
+		header.snaplen = HAL_HOST_FRAME_MAX;
+		header.linktype = PCAP_LINKTYPE_ETHERNET;
+		fwrite(&header,sizeof(header),1,hal_host.tx_pcap);
+	}
+	return 1;
+}
+
+void hal_host_close(void)
+{
+	if(hal_host.tx_pcap)
+	{
+		fclose(hal_host.tx_pcap);
+		hal_host.tx_pcap = 0;
+	}
+	free(hal_host.rx_data);
+	hal_host.rx_data = 0;
+	hal_host.rx_data_len = 0;
+	hal_host.rx_offset = 0;
+	hal_host.fd = -1;
+}
+
+void hal_host_rewind(void)
+{
+	hal_host.rx_offset = 0;
+}
+
+uint8_t hal_host_inject(const uint8_t * frame,uint16_t len)
+{
+	if(hal_host.inject_frame)
+	{
+		return 0;
+	}
+	hal_host.inject_frame = frame;
+	hal_host.inject_len = len;
+	return 1;
+}
+
+/**
+* Loads all frames of the pcap file into memory so that replaying them
+* does not include file I/O. Frames are stored as 16-bit length followed
+* by frame data.
+*/
+uint8_t hal_host_load_pcap(const char * path)
+{
+	struct pcap_file_header header;
+	struct pcap_record_header record;
+	uint8_t swapped;
+	FILE * fh = fopen(path,"rb");
+	
+	if(!fh)
+	{
+		return 0;
+	}
+	if(fread(&header,sizeof(header),1,fh) != 1)
+	{
+		goto hal_host_load_pcap_error;
+	}
+	if(header.magic == PCAP_MAGIC)
+	{
+		swapped = 0;
+	}
+	else if(header.magic == PCAP_MAGIC_SWAPPED)
+	{
+		swapped = 1;
+		header.linktype = hal_host_swap32(header.linktype);
+	}
+	else
+	{
+		goto hal_host_load_pcap_error;
+	}
+	if(header.linktype != PCAP_LINKTYPE_ETHERNET)
+	{
+		goto hal_host_load_pcap_error;
+	}
+	free(hal_host.rx_data);
+	hal_host.rx_data = 0;
+	hal_host.rx_data_len = 0;
+	hal_host.rx_offset = 0;
+	while(fread(&record,sizeof(record),1,fh) == 1)
+	{
+		uint32_t len = swapped ? hal_host_swap32(record.incl_len) : record.incl_len;
+		uint16_t frame_len = (uint16_t)len;
+		uint8_t * data;
+
+		if(len > HAL_HOST_FRAME_MAX)
+		{
+			/* skip frames which would not fit into the controller */
+			fseek(fh,len,SEEK_CUR);
+			continue;
+		}
+		data = realloc(hal_host.rx_data,hal_host.rx_data_len + sizeof(frame_len) + len);
+		if(!data)
+		{
+			goto hal_host_load_pcap_error;
+		}
+		hal_host.rx_data = data;
+		data += hal_host.rx_data_len;
+		memcpy(data,&frame_len,sizeof(frame_len));
+		if(fread(data + sizeof(frame_len),1,len,fh) != len)
+		{
+			break;
+		}
+		hal_host.rx_data_len += sizeof(frame_len) + len;
+	}
+	fclose(fh);
+	return 1;
+hal_host_load_pcap_error:
+	fclose(fh);
+	return 0;
+}
+
+uint8_t hal_host_send_packet(uint8_t * buff,uint16_t len)
+{
+	hal_host.stats.tx_frames++;
+	hal_host.stats.tx_bytes += len;
+	if(hal_host.tx_callback)
+	{
+		hal_host.tx_callback(buff,len);
+	}
+	if(hal_host.tx_pcap)
+	{
+		struct pcap_record_header record;
+
+		memset(&record,0,sizeof(record));
+		record.ts_sec = hal_host.stats.tx_frames;
+		record.incl_len = len;
+		record.orig_len = len;
+		fwrite(&record,sizeof(record),1,hal_host.tx_pcap);
+		fwrite(buff,1,len,hal_host.tx_pcap);
+	}
+	if(hal_host.fd >= 0)
+	{
+		if(send(hal_host.fd,buff,len,0) != len)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+uint16_t hal_host_receive_packet(uint8_t * buff,uint16_t max_len)
+{
+	uint16_t len = 0;
+	
+	if(hal_host.inject_frame)
+	{
+		len = hal_host.inject_len;
+		if(len > max_len)
+		{
+			len = max_len;
+		}
+		memcpy(buff,hal_host.inject_frame,len);
+		hal_host.inject_frame = 0;
+	}
+	else if(hal_host.rx_offset < hal_host.rx_data_len)
+	{
+		uint16_t frame_len;
+		
+		memcpy(&frame_len,hal_host.rx_data + hal_host.rx_offset,sizeof(frame_len));
+		len = frame_len > max_len ? max_len : frame_len;
+		memcpy(buff,hal_host.rx_data + hal_host.rx_offset + sizeof(frame_len),len);
+		hal_host.rx_offset += sizeof(frame_len) + frame_len;
+	}
+	else if(hal_host.fd >= 0)
+	{
+		ssize_t ret = recv(hal_host.fd,buff,max_len,MSG_DONTWAIT);
+		
+		if(ret < 0)
+		{
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				perror("hal_host: recv");
+			}
+			return 0;
+		}
+		len = (uint16_t)ret;
+	}
+	if(len)
+	{
+		hal_host.stats.rx_frames++;
+		hal_host.stats.rx_bytes += len;
+	}
+	return len;
+}
+/**
+* Receives the next frame into the backend, it is then accessed with
+* hal_host_rx_read() and hal_host_rx_checksum() like in the controller
+*/
+uint16_t hal_host_rx_begin(void)
+{
+	hal_host.rx_frame_len = hal_host_receive_packet(hal_host.rx_frame,sizeof(hal_host.rx_frame));
+	return hal_host.rx_frame_len;
+}
+
+void hal_host_rx_read(uint16_t offset,uint8_t * buff,uint16_t len)
+{
+	if(offset >= hal_host.rx_frame_len)
+	{
+		return;
+	}
+	if(len > hal_host.rx_frame_len - offset)
+	{
+		len = hal_host.rx_frame_len - offset;
+	}
+	memcpy(buff,hal_host.rx_frame + offset,len);
+}
+
+uint16_t hal_host_rx_checksum(uint16_t offset,uint16_t len)
+{
+	if(offset > hal_host.rx_frame_len || len > hal_host.rx_frame_len - offset)
+	{
+		return 0;
+	}
+	return net_get_checksum(0,hal_host.rx_frame + offset,len,NET_CHECKSUM_NO_SKIP);
+}
+
+void hal_host_rx_end(void)
+{
+	hal_host.rx_frame_len = 0;
+}
+/**
+* @}
+*/
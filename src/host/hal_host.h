@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HAL_HOST_H
+#define _HAL_HOST_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Host (Linux) network interface backend. Frames are exchanged with
+* a peer process over a datagram socket (e.g. one end of a Unix
+* socketpair), replayed from a pcap file or injected directly from
+* memory. Transmitted frames can be written to a pcap file and/or
+* passed to a user callback.
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+
+/**
+* Callback called for every transmitted frame
+*/
+typedef void (*hal_host_tx_callback)(const uint8_t * frame,uint16_t len);
+
+struct hal_host_stats
+{
+	uint32_t rx_frames;
+	uint32_t rx_bytes;
+	uint32_t tx_frames;
+	uint32_t tx_bytes;
+};
+
+void hal_host_init(const uint8_t * mac);
+uint8_t hal_host_open_socket(int fd);
+uint8_t hal_host_open_pcap(const char * rx_path,const char * tx_path);
+void hal_host_close(void);
+void hal_host_rewind(void);
+uint8_t hal_host_inject(const uint8_t * frame,uint16_t len);
+void hal_host_set_tx_callback(hal_host_tx_callback callback);
+const struct hal_host_stats * hal_host_get_stats(void);
+uint64_t hal_host_clock_ns(void);
+
+uint8_t hal_host_send_packet(uint8_t * buff,uint16_t len);
+uint16_t hal_host_receive_packet(uint8_t * buff,uint16_t max_len);
+uint16_t hal_host_rx_begin(void);
+void hal_host_rx_read(uint16_t offset,uint8_t * buff,uint16_t len);
+uint16_t hal_host_rx_checksum(uint16_t offset,uint16_t len);
+void hal_host_rx_end(void);
+
+/**
+* @}
+*/
+#endif //_HAL_HOST_H
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HOST_AVR_INTERRUPT_H
+#define _HOST_AVR_INTERRUPT_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Interrupt control for the host build. There are no interrupts on
+* the host, interrupt handlers are plain functions.
+* @author agent <agent@local>
+*/
+
+#define sei()		do{}while(0)
+#define cli()		do{}while(0)
+
+#define ISR(vector)	void vector(void)
+
+/**
+* @}
+*/
+#endif //_HOST_AVR_INTERRUPT_H
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HOST_AVR_IO_H
+#define _HOST_AVR_IO_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* I/O registers for the host build. Port and SPI registers are plain
+* variables (see avr_compat.c) so that drivers compile unchanged; the
+* SPI bus itself is emulated by hooks in spi.h.
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+
+extern volatile uint8_t PORTA,DDRA,PINA;
+extern volatile uint8_t PORTB,DDRB,PINB;
+extern volatile uint8_t PORTC,DDRC,PINC;
+extern volatile uint8_t PORTD,DDRD,PIND;
+extern volatile uint8_t PORTE,DDRE,PINE;
+extern volatile uint8_t PORTF,DDRF,PINF;
+extern volatile uint8_t PORTG,DDRG,PING;
+extern volatile uint8_t EIMSK,EIFR,EICRA,EICRB;
+extern volatile uint8_t SPCR,SPSR,SPDR;
+
+/* SPCR */
+#define SPIE	7
+#define SPE	6
+#define DORD	5
+#define MSTR	4
+#define CPOL	3
+#define CPHA	2
+#define SPR1	1
+#define SPR0	0
+/* SPSR */
+#define SPIF	7
+#define WCOL	6
+#define SPI2X	0
+
+/**
+* @}
+*/
+#endif //_HOST_AVR_IO_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HOST_AVR_PGMSPACE_H
+#define _HOST_AVR_PGMSPACE_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Program memory access for the host build. Flash and RAM share one
+* address space on the host so all accessors map to plain memory
+* functions.
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define PSTR(s)			(s)
+
+typedef uint8_t		prog_uint8_t;
+typedef uint16_t	prog_uint16_t;
+typedef uint32_t	prog_uint32_t;
+typedef char		prog_char;
+
+#define pgm_read_byte(addr)	(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)	(*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t*)(addr))
+
+#define memcpy_P(dst,src,len)	memcpy((dst),(src),(len))
+#define memcmp_P(a,b,len)	memcmp((a),(b),(len))
+#define strlen_P(s)		strlen((s))
+#define strcpy_P(dst,src)	strcpy((dst),(src))
+#define strcmp_P(a,b)		strcmp((a),(b))
+
+/**
+* Prints format string stored in program memory. The avr-libc %S
+* conversion (string in program memory) is translated to %s.
+*/
+int fprintf_P(FILE * fh,const char * fmt,...);
+
+#define printf_P(fmt,args...)	fprintf_P(stdout,(fmt),## args)
+
+/**
+* @}
+*/
+#endif //_HOST_AVR_PGMSPACE_H
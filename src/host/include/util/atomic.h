@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HOST_UTIL_ATOMIC_H
+#define _HOST_UTIL_ATOMIC_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Atomic blocks for the host build. There are no interrupts on the
+* host, the block runs once like a plain compound statement.
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+
+#define ATOMIC_RESTORESTATE	0
+#define ATOMIC_FORCEON		1
+
+#define ATOMIC_BLOCK(type)	for(uint8_t __todo = 1 ; __todo ; __todo = 0)
+
+/**
+* @}
+*/
+#endif //_HOST_UTIL_ATOMIC_H
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _HOST_UTIL_DELAY_H
+#define _HOST_UTIL_DELAY_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* Busy-wait delays for the host build. The ENC28J60 model responds
+* immediately so the delays are no-ops.
+* @author agent <agent@local>
+*/
+
+#define _delay_ms(ms)	do{}while(0)
+#define _delay_us(us)	do{}while(0)
+
+/**
+* @}
+*/
+#endif //_HOST_UTIL_DELAY_H
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _SPI_HOST_H
+#define _SPI_HOST_H
+/**
+* @addtogroup host
+* @{
+*/
+/**
+* @file
+* SPI bus of the host build. SPI_DATA and SPI_WAIT() map to these hooks
+* so that a byte written to the data register is clocked into the
+* emulated device when waiting for completion and the byte clocked out
+* is left in the data register, exactly like SPDR/SPIF on the AVR.
+* @author agent <agent@local>
+*/
+
+#include <stdint.h>
+
+/**
+* Emulated SPI data register
+*/
+extern uint8_t spi_host_data;
+
+void spi_host_transfer(void);
+
+/**
+* @}
+*/
+#endif //_SPI_HOST_H
@@ -36,6 +36,7 @@
 #include "net/ethernet.h"
 #include "net/ip.h"
 #include "net/arp.h"
+#include "net/icmp.h"
 #include "net/udp.h"
 #include "net/tcp.h"
 
@@ -51,6 +52,9 @@ struct partition partition;
 struct fat_fs * fatfs;
 struct fat_dir_entry * fat_root;
 
+/* set by the ENC28J60 interrupt, the frames are handled in the main loop */
+static volatile uint8_t net_pending;
+
 /*void time_callback(uint8_t event,uint32_t time)
 {
 	static struct date_time dt;
@@ -186,6 +190,7 @@ int main(void)
 	ip_init(&ip, &nm, &gw);		
 //	ip_init(0,0,0);
 	arp_init();
+	icmp_init();
 	udp_init();
 //	tcp_init();
 	
@@ -207,8 +212,33 @@ int main(void)
 //	DBG_INFO("Before sei\n");
 	/* global interrupt enable */
 	sei();
+	/* the interrupts only flag the work, the stack, the timer callbacks
+	 and the applications run here with interrupts enabled */
 	for(;;)
 	{
+		if(net_pending)
+		{
+			uint8_t budget = APP_RX_BUDGET;
+			
+			net_pending = 0;
+			hal_tx_service();
+			while(budget && ethernet_handle_packet())
+			{
+				budget--;
+			}
+			if(budget)
+			{
+				/* the controller releases its interrupt line once
+				 there is nothing left to do */
+				EIMSK |= (1<<INT7);
+			}
+			else
+			{
+				/* more frames may wait, run the timers first */
+				net_pending = 1;
+			}
+		}
+		timer_poll();
 	}
 	return 0;
 }
@@ -228,7 +258,10 @@ ISR(TIMER1_OVF_vect)
 
 ISR(INT7_vect)
 {
-	while(ethernet_handle_packet());
+	/* INT7 is level triggered, keep it masked until the main loop has
+	 served the controller */
+	EIMSK &= ~(1<<INT7);
+	net_pending = 1;
 }
 
 ISR(INT6_vect)
@@ -31,24 +31,46 @@ struct arp_header
 #define ARP_TABLE_ENTRY_STATUS_REQUEST	0
 #define ARP_TABLE_ENTRY_STATUS_TIMEOUT	1
 #define ARP_TABLE_ENTRY_STATUS_EMPTY	0xff 
-
+/* end of a hash chain */
+#define ARP_TABLE_ENTRY_NONE		0xff
 
 struct arp_table_entry
 {
 	uint8_t			status;
+	/* index of the next entry with the same hash */
+	uint8_t			next;
 	ip_address 		ip_addr;
 	ethernet_address 	ethernet_addr;
-	uint16_t		timeout;
+	/* timer_now() at which the address or the request expires */
+	uint32_t		expires;
+	/* timer_now() of the last lookup, the least recently used entry is replaced */
+	uint32_t		used;
+	/* timer_now() after which a lookup sends a unicast request */
+	uint32_t		refresh;
+	/* packets waiting for the reply linked by their next field */
+	struct pbuf *		queue;
 };
 
 static struct arp_table_entry 	arp_table[ARP_TABLE_SIZE]; //EXMEM
+/* first entry of every hash chain */
+static uint8_t			arp_hash[ARP_HASH_SIZE]; //EXMEM
+/* the timer runs only while requests are waiting for replies */
 static timer_t arp_timer;
+static uint8_t arp_timer_running;
 
 #define FOREACH_ARP_ENTRY(entry) for(entry = &arp_table[0] ; entry < &arp_table[ARP_TABLE_SIZE] ; entry++)
+/* hosts of a LAN differ in the last bytes of their addresses */
+#define ARP_HASH(ip_addr) (((*(ip_addr))[2] ^ (*(ip_addr))[3]) & (ARP_HASH_SIZE - 1))
+#define ARP_EXPIRED(entry,now) ((int32_t)((now) - (entry)->expires) >= 0)
 
 uint8_t arp_send_reply(const struct arp_header * header);
 void arp_timer_tick(timer_t timer,void * arg);
-uint8_t arp_send_request(const ip_address * ip_addr);
+uint8_t arp_send_request(const ip_address * ip_addr,const ethernet_address * ethernet_addr);
+static void arp_queue_flush(struct arp_table_entry * entry,uint8_t send);
+static struct arp_table_entry * arp_table_lookup(const ip_address * ip_addr);
+static struct arp_table_entry * arp_table_alloc(const ip_address * ip_addr);
+static void arp_table_remove(struct arp_table_entry * entry);
+static void arp_timer_start(void);
 
 static const char arp_state_char_request[] PROGMEM = "REQUEST";
 static const char arp_state_char_timeout[] PROGMEM = "TIMEOUT";
@@ -61,16 +83,17 @@ void arp_print_stat(FILE * fh)
 {
 
 	struct arp_table_entry * entry;
-	fprintf_P(fh,PSTR("%-15S %-17S %-7S %S\n"),PSTR("IP addr"),PSTR("HW addr"),PSTR("Timeout"),PSTR("State"));
+	uint32_t now = timer_now();
+	fprintf_P(fh,PSTR("%-15S %-17S %-7S %S\n"),PSTR("IP addr"),PSTR("HW addr"),PSTR("Expires"),PSTR("State"));
 	FOREACH_ARP_ENTRY(entry)
 	{
 		if(entry->status != ARP_TABLE_ENTRY_STATUS_EMPTY)
 		{
 			fprintf(fh,
-				"%-15s %-17s %7d",
+				"%-15s %-17s %7lu",
 				ip_addr_str((const ip_address*)&entry->ip_addr),
 				ethernet_addr_str((const ethernet_address*)&entry->ethernet_addr),
-				entry->timeout
+				ARP_EXPIRED(entry,now) ? 0UL : (unsigned long)((entry->expires - now)/1000)
 				);		
 			 fprintf_P(fh,PSTR(" %S \n"),arp_state_chars[entry->status]);
 		}
@@ -86,7 +109,7 @@ void print_arp_table(void)
 	{
 		if(entry->status != ARP_TABLE_ENTRY_STATUS_EMPTY)
 		{
-			DBG_INFO("%3d.%3d.%3d.%3d - %02x:%02x:%02x:%02x:%02x:%02x - status = %d, timeout = %d\n",
+			DBG_INFO("%3d.%3d.%3d.%3d - %02x:%02x:%02x:%02x:%02x:%02x - status = %d, expires = %lu\n",
 						entry->ip_addr[0],
 						entry->ip_addr[1],
 						entry->ip_addr[2],
@@ -98,7 +121,7 @@ void print_arp_table(void)
 						entry->ethernet_addr[4],
 						entry->ethernet_addr[5],
 						entry->status,
-						entry->timeout);
+						(unsigned long)entry->expires);
 		}
 	}
 }
@@ -107,8 +130,16 @@ void print_arp_table(void)
 
 uint8_t arp_init(void)
 {
+	struct arp_table_entry * entry;
+	
 	/* Clear arp table */
 	memset(arp_table, 0 ,sizeof(arp_table));
+	FOREACH_ARP_ENTRY(entry)
+	{
+		entry->status = ARP_TABLE_ENTRY_STATUS_EMPTY;
+		entry->next = ARP_TABLE_ENTRY_NONE;
+	}
+	memset(arp_hash,ARP_TABLE_ENTRY_NONE,sizeof(arp_hash));
 	/* get system timer */
 	arp_timer = timer_alloc(arp_timer_tick);
 	/* Check timer */
@@ -116,8 +147,8 @@ uint8_t arp_init(void)
 	{
 		return 0;
 	}
-	/* Set timer */
-	timer_set(arp_timer,ARP_TIMER_TICK_MS, TIMER_MODE_ONE_SHOT);
+	/* it is set when the first request is sent */
+	arp_timer_running = 0;
 	
 	return 1;
 }
@@ -196,131 +227,325 @@ uint8_t arp_send_reply(const struct arp_header * header)
 	return ethernet_send_packet(&arp_reply->target_hardware_addr,ETHERNET_TYPE_ARP,sizeof(struct arp_header));
 }
 
-void arp_table_insert(const ip_address * ip_addr,const ethernet_address * ethernet_addr)
+/**
+* Returns the entry of ip_addr or 0 if it is not in the table
+*/
+struct arp_table_entry * arp_table_lookup(const ip_address * ip_addr)
+{
+	uint8_t index = arp_hash[ARP_HASH(ip_addr)];
+	struct arp_table_entry * entry;
+	
+	while(index != ARP_TABLE_ENTRY_NONE)
+	{
+		entry = &arp_table[index];
+		if(!memcmp(&entry->ip_addr,ip_addr,sizeof(ip_address)))
+		{
+			return entry;
+		}
+		index = entry->next;
+	}
+	return 0;
+}
+
+/**
+* Unlinks the entry from its hash chain and drops its packets
+*/
+void arp_table_remove(struct arp_table_entry * entry)
+{
+	uint8_t index = (uint8_t)(entry - &arp_table[0]);
+	uint8_t hash = ARP_HASH(&entry->ip_addr);
+	struct arp_table_entry * prev;
+	
+	if(arp_hash[hash] == index)
+	{
+		arp_hash[hash] = entry->next;
+	}
+	else
+	{
+		prev = &arp_table[arp_hash[hash]];
+		while(prev->next != index)
+		{
+			prev = &arp_table[prev->next];
+		}
+		prev->next = entry->next;
+	}
+	arp_queue_flush(entry,0);
+	entry->status = ARP_TABLE_ENTRY_STATUS_EMPTY;
+	entry->next = ARP_TABLE_ENTRY_NONE;
+	/* routes may use the address */
+	ip_route_flush();
+}
+
+/**
+* Adds an entry for ip_addr, it is an empty entry or the least recently
+* used resolved one. Entries waiting for a reply keep their packets.
+* @returns 0 if all entries are waiting for replies
+*/
+struct arp_table_entry * arp_table_alloc(const ip_address * ip_addr)
 {
-	uint16_t min_timeout = ARP_TABLE_ENTRY_TIMEOUT;
 	struct arp_table_entry * entry;
-	struct arp_table_entry * min_entry = 0;
+	struct arp_table_entry * lru = 0;
+	uint32_t now = timer_now();
+	uint8_t hash = ARP_HASH(ip_addr);
+	
 	FOREACH_ARP_ENTRY(entry)
 	{
-		/* Check if there is already entry in arp table with specified ip addr */
-		if(!memcmp(ip_addr,&entry->ip_addr,sizeof(ip_address)))
+		if(entry->status == ARP_TABLE_ENTRY_STATUS_EMPTY)
 		{
-			switch(entry->status)
-			{
-				/* arp table entry was waiting for reply*/
-				case ARP_TABLE_ENTRY_STATUS_REQUEST:
-					min_entry = entry;
-					/* insert to arp table with status TIMEOUT*/
-					goto arp_table_insert_out;
-				case ARP_TABLE_ENTRY_STATUS_TIMEOUT:
-					/* update timeout only */
-					entry->timeout = ARP_TABLE_ENTRY_TIMEOUT;
-					return;
-				default:
-					break;
-			}
+			lru = entry;
+			break;
 		}
-		/* find entry with minimum timeout*/
-		if(entry->timeout < min_timeout)
+		if(entry->status == ARP_TABLE_ENTRY_STATUS_TIMEOUT && (!lru || now - entry->used > now - lru->used))
 		{
-			min_entry = entry;
-			/* if there is entry with 0 timeout there is no need to look any further*/
-		// 	if(!entry->timeout)
-		// 		break;
-			min_timeout = entry->timeout;
+			lru = entry;
 		}
 	}
-	/* there must be some error (maybe arp timer does not work?) */
-	if(min_entry == 0)
+	if(!lru)
 	{
-		return;
+		return 0;
 	}
-arp_table_insert_out:
-	/* set default timeout */
-	min_entry->timeout = ARP_TABLE_ENTRY_TIMEOUT;
-	/* set status to timeout */
-	min_entry->status = ARP_TABLE_ENTRY_STATUS_TIMEOUT;	
-	/* copy ip address */
-	memcpy(&min_entry->ip_addr,ip_addr,sizeof(ip_address));
-	/* copy mac address */
-	memcpy(&min_entry->ethernet_addr,ethernet_addr,sizeof(ethernet_address));
+	if(lru->status != ARP_TABLE_ENTRY_STATUS_EMPTY)
+	{
+		arp_table_remove(lru);
+	}
+	memcpy(&lru->ip_addr,ip_addr,sizeof(ip_address));
+	lru->used = now;
+	lru->next = arp_hash[hash];
+	arp_hash[hash] = (uint8_t)(lru - &arp_table[0]);
+	
+	return lru;
 }
 
-void arp_timer_tick(timer_t timer,void * arg)
+void arp_table_insert(const ip_address * ip_addr,const ethernet_address * ethernet_addr)
 {
-		if(timer != arp_timer)
+	struct arp_table_entry * entry = arp_table_lookup(ip_addr);
+	
+	if(!entry)
+	{
+		entry = arp_table_alloc(ip_addr);
+		if(!entry)
 		{
 			return;
 		}
-		struct arp_table_entry * entry;
-		FOREACH_ARP_ENTRY(entry)
+	}
+	/* set expiration time, also of addresses which are already known */
+	entry->expires = timer_now() + ARP_ENTRY_LIFETIME_MS;
+	entry->refresh = entry->expires - ARP_REFRESH_MS;
+	/* set status to timeout */
+	entry->status = ARP_TABLE_ENTRY_STATUS_TIMEOUT;	
+	/* copy mac address, routes using the old one are filled again */
+	if(memcmp(&entry->ethernet_addr,ethernet_addr,sizeof(ethernet_address)))
+	{
+		memcpy(&entry->ethernet_addr,ethernet_addr,sizeof(ethernet_address));
+		ip_route_flush();
+	}
+	/* send packets which were waiting for the address */
+	arp_queue_flush(entry,1);
+}
+
+/**
+* Keeps packet p, whose Ethernet header is filled when it is sent, until
+* the hardware address of ip_addr requested by arp_get_mac() is known.
+* p may be a queue of buffers linked by next (the fragments of a
+* datagram), at most ARP_QUEUE_LEN buffers wait for one address.
+* @returns 0 if the packet can not wait, it is released then
+*/
+uint8_t arp_hold(const ip_address * ip_addr,struct pbuf * p)
+{
+	struct arp_table_entry * entry = arp_table_lookup(ip_addr);
+	struct pbuf * last;
+	struct pbuf * next;
+	uint8_t count = 0;
+	
+	for(next = p ; next ; next = next->next)
+	{
+		count++;
+	}
+	if(entry && entry->status == ARP_TABLE_ENTRY_STATUS_REQUEST)
+	{
+		last = entry->queue;
+		count += last ? 1 : 0;
+		while(last && last->next)
+		{
+			last = last->next;
+			count++;
+		}
+		if(count <= ARP_QUEUE_LEN)
 		{
-			if(entry->status != ARP_TABLE_ENTRY_STATUS_EMPTY)
+			if(last)
 			{
-				if(entry->timeout > 0)
-				{
-					entry->timeout--;
-				}
-				else
-				{
-					entry->status = ARP_TABLE_ENTRY_STATUS_EMPTY;
-				}
+				last->next = p;
 			}
+			else
+			{
+				entry->queue = p;
+			}
+			return 1;
 		}
-		timer_set(arp_timer,ARP_TIMER_TICK_MS, TIMER_MODE_ONE_SHOT);
+	}
+	while(p)
+	{
+		next = p->next;
+		pbuf_free(p);
+		p = next;
+	}
+	return 0;
 }
 
+/**
+* Sends packets waiting for the address of the entry or drops them
+*/
+void arp_queue_flush(struct arp_table_entry * entry,uint8_t send)
+{
+	struct pbuf * p;
+	
+	while((p = entry->queue) != 0)
+	{
+		entry->queue = p->next;
+		if(send)
+		{
+			ethernet_send_pbuf(p,&entry->ethernet_addr,ETHERNET_TYPE_IP,p->len - NET_HEADER_SIZE_ETHERNET);
+		}
+		else
+		{
+			pbuf_free(p);
+		}
+	}
+}
 
-uint8_t arp_get_mac(const ip_address * ip_addr,ethernet_address * ethernet_addr)
+void arp_timer_start(void)
 {
-	if(ip_addr == 0)
+	if(!arp_timer_running)
 	{
-		return 0;
+		arp_timer_running = timer_set(arp_timer,ARP_REQUEST_TIMEOUT_MS,TIMER_MODE_ONE_SHOT);
 	}
+}
 
+/**
+* Removes requests which have not been answered. Resolved entries are not
+* swept, they are checked when they are looked up.
+*/
+void arp_timer_tick(timer_t timer,void * arg)
+{
 	struct arp_table_entry * entry;
-	struct arp_table_entry * empty = 0;
+	uint32_t now = timer_now();
+	int32_t next = ARP_REQUEST_TIMEOUT_MS;
 	
+	if(timer != arp_timer)
+	{
+		return;
+	}
+	arp_timer_running = 0;
 	FOREACH_ARP_ENTRY(entry)
 	{
-		if(entry->status == ARP_TABLE_ENTRY_STATUS_EMPTY)
+		if(entry->status != ARP_TABLE_ENTRY_STATUS_REQUEST)
 		{
-			empty = entry;
 			continue;
 		}
-		if(!memcmp(&entry->ip_addr,ip_addr,sizeof(ip_address)))
+		if(ARP_EXPIRED(entry,now))
+		{
+			arp_table_remove(entry);
+		}
+		else
+		{
+			if((int32_t)(entry->expires - now) < next)
+			{
+				next = (int32_t)(entry->expires - now);
+			}
+			arp_timer_running = 1;
+		}
+	}
+	if(arp_timer_running)
+	{
+		timer_set(arp_timer,next,TIMER_MODE_ONE_SHOT);
+	}
+}
+
+/**
+* Gets the hardware address of ip_addr or requests it. The address may
+* be used without looking it up again until the time stored in until.
+*/
+uint8_t arp_get_mac(const ip_address * ip_addr,ethernet_address * ethernet_addr,uint32_t * until)
+{
+	if(ip_addr == 0)
+	{
+		return 0;
+	}
+
+	struct arp_table_entry * entry = arp_table_lookup(ip_addr);
+	uint32_t now = timer_now();
+	
+	if(entry)
+	{
+		if(!ARP_EXPIRED(entry,now))
 		{
-			switch(entry->status)
+			/* There is ip address but waiting for reply*/
+			if(entry->status == ARP_TABLE_ENTRY_STATUS_REQUEST)
+			{
+				return 0;
+			}
+			/* There is ethernet address in arp table */
+			entry->used = now;
+			/* ask the host again before the address expires, packets
+			 do not have to wait for it then */
+			if((int32_t)(now - entry->refresh) >= 0)
 			{
-				/* There is ethernet address in arp table */
-				case ARP_TABLE_ENTRY_STATUS_TIMEOUT:
-					entry->timeout = ARP_TABLE_ENTRY_TIMEOUT;
-					if(ethernet_addr)
-						memcpy(ethernet_addr,&entry->ethernet_addr,sizeof(ethernet_address));
-					return 1;
-				/* There is ip address but waiting for reply*/
-				case ARP_TABLE_ENTRY_STATUS_REQUEST:
-					return 0;
-				default:
-					continue;
+				entry->refresh = now + ARP_REQUEST_TIMEOUT_MS;
+				arp_send_request(ip_addr,&entry->ethernet_addr);
+			}
+			if(until)
+			{
+				*until = now + ARP_ROUTE_MS;
+				if((int32_t)(entry->refresh - *until) < 0)
+				{
+					*until = entry->refresh;
+				}
 			}
+			if(ethernet_addr)
+				memcpy(ethernet_addr,&entry->ethernet_addr,sizeof(ethernet_address));
+			return 1;
 		}
+		/* the address has expired, it is requested again */
 	}
-	if(empty != 0)
+	else
+	{
+		entry = arp_table_alloc(ip_addr);
+	}
+	if(entry != 0)
 	{
-		memcpy(&empty->ip_addr,ip_addr,sizeof(ip_address));
-		empty->status = ARP_TABLE_ENTRY_STATUS_REQUEST;
-		empty->timeout = ARP_TABLE_ENTRY_REQ_TIME;
+		entry->status = ARP_TABLE_ENTRY_STATUS_REQUEST;
+		entry->expires = now + ARP_REQUEST_TIMEOUT_MS;
+		arp_timer_start();
 	}
-	arp_send_request(ip_addr);
+	arp_send_request(ip_addr,0);
 	
 	return 0;
 }
 
-uint8_t arp_send_request(const ip_address * ip_addr)
+/**
+* Broadcasts gratuitous request for our address
+*/
+uint8_t arp_announce(void)
+{
+	return arp_send_request(ip_get_addr(),0);
+}
+
+/**
+* Sends request for the hardware address of ip_addr. It is broadcast
+* unless the address ethernet_addr which is being refreshed is known.
+* It is built in a buffer of its own, the transmit buffer may hold the
+* packet whose destination is being resolved.
+*/
+uint8_t arp_send_request(const ip_address * ip_addr,const ethernet_address * ethernet_addr)
 {
-	struct arp_header * arp_request = (struct arp_header*)ethernet_get_buffer();
+	struct pbuf * p = pbuf_alloc();
+	struct arp_header * arp_request;
+	
+	if(!p)
+	{
+		return 0;
+	}
+	arp_request = (struct arp_header*)pbuf_payload(p);
 	/* Set protocol and hardware addresses type and length */
 	arp_request->hardware_addr_len = ARP_HW_ADDR_SIZE_ETHERNET;
 	arp_request->protocol_addr_len = ARP_PROTO_ADDR_SIZE_IP;
@@ -328,7 +553,14 @@ uint8_t arp_send_request(const ip_address * ip_addr)
 	arp_request->protocol_type = HTON16(ARP_PROTO_ADDR_TYPE_IP);
 	
 	/* Set sedner and target hardware and protocol addresses */
-	memset(&arp_request->target_hardware_addr,0,sizeof(ethernet_address));
+	if(ethernet_addr)
+	{
+		memcpy(&arp_request->target_hardware_addr,ethernet_addr,sizeof(ethernet_address));
+	}
+	else
+	{
+		memset(&arp_request->target_hardware_addr,0,sizeof(ethernet_address));
+	}
 	memcpy(&arp_request->target_protocol_addr,ip_addr,sizeof(ip_address));
 	memcpy(&arp_request->sender_hardware_addr,ethernet_get_mac(),sizeof(ethernet_address));
 	memcpy(&arp_request->sender_protocol_addr,ip_get_addr(),sizeof(ip_address));
@@ -336,5 +568,5 @@ uint8_t arp_send_request(const ip_address * ip_addr)
 	/* Set operation code */
 	arp_request->operation_code = HTON16(ARP_OPERATION_REQUEST);
 	/* Send packet */
-	return ethernet_send_packet(ETHERNET_ADDR_BROADCAST,ETHERNET_TYPE_ARP,sizeof(struct arp_header));
+	return ethernet_send_pbuf(p,ethernet_addr ? (ethernet_address*)ethernet_addr : ETHERNET_ADDR_BROADCAST,ETHERNET_TYPE_ARP,sizeof(struct arp_header));
 }
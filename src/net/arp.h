@@ -27,8 +27,10 @@ struct arp_header;
 
 uint8_t arp_init(void);
 uint8_t arp_handle_packet(struct arp_header * header,uint16_t packet_length);
-uint8_t arp_get_mac(const ip_address * ip_addr,ethernet_address * ethernet_addr);
+uint8_t arp_get_mac(const ip_address * ip_addr,ethernet_address * ethernet_addr,uint32_t * until);
 void arp_table_insert(const ip_address * ip_addr,const ethernet_address * ethernet_addr);
+uint8_t arp_hold(const ip_address * ip_addr,struct pbuf * p);
+uint8_t arp_announce(void);
 void arp_print_stat(FILE * fh);
 
 #endif //_ARP_H
\ No newline at end of file
@@ -11,9 +11,23 @@
 
 #include "../sys/timer_config.h"
 
-#define ARP_TABLE_SIZE			2
-#define ARP_TIMER_TICK_MS		10
-#define ARP_TABLE_ENTRY_TIMEOUT		200
-#define ARP_TABLE_ENTRY_REQ_TIME	200
+/* at most 255 entries */
+#define ARP_TABLE_SIZE			16
+/* number of hash chains, a power of 2 */
+#define ARP_HASH_SIZE			16
+/* time a resolved address is used before it is requested again */
+#define ARP_ENTRY_LIFETIME_MS		300000UL
+/* time to wait for the reply to a request */
+#define ARP_REQUEST_TIMEOUT_MS		2000
+/* an address which is in use is requested from its host this long
+ before it expires */
+#define ARP_REFRESH_MS			30000UL
+/* time a route uses the address before it is looked up again, the
+ entry stays recently used */
+#define ARP_ROUTE_MS			1000
+/* packet buffers kept per address until the reply to its request
+ arrives, a packet takes one and a datagram sent in fragments one per
+ fragment */
+#define ARP_QUEUE_LEN			2
 
 #endif //_ARP_CONFIG_H
\ No newline at end of file
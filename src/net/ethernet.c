@@ -11,6 +11,7 @@
 #include "../arch/exmem.h"
 #include "ip.h"
 #include "arp.h"
+#include "pbuf.h"
 
 #define DEBUG_MODE 
 #include "../debug.h"
@@ -30,8 +31,23 @@ static ethernet_address ethernet_mac;
 
 static char ethernet_addr_char[2*sizeof(ethernet_address) + 5 + 1];
 
-uint8_t ethernet_tx_buffer[ETHERNET_MAX_PACKET_SIZE + NET_HEADER_SIZE_ETHERNET];
-uint8_t ethernet_rx_buffer[ETHERNET_MAX_PACKET_SIZE + NET_HEADER_SIZE_ETHERNET];
+/* packet buffers of the frame being received and of the frame being
+ built for transmission, ethernet_rx_buffer and ethernet_tx_buffer point
+ to their data */
+static struct pbuf * ethernet_rx_pbuf;
+static struct pbuf * ethernet_tx_pbuf;
+uint8_t * ethernet_tx_buffer;
+uint8_t * ethernet_rx_buffer;
+/* length of the received frame and number of its bytes in ethernet_rx_buffer */
+static uint16_t ethernet_rx_length;
+static uint16_t ethernet_rx_fetched;
+#if HAL_RX_FILTER
+/* broadcast frames accepted besides ARP requests for our address */
+static uint8_t ethernet_rx_accepted;
+/* multicast addresses let through by the hash table filter */
+static ethernet_address ethernet_multicast[ETHERNET_MULTICAST_MAX];
+static uint8_t ethernet_multicast_count;
+#endif
 
 const struct ethernet_stats * ethernet_get_stats(void)
 {
@@ -59,6 +75,16 @@ void ethernet_init(const ethernet_address * mac)
 	{
 		memcpy(&ethernet_mac,mac,sizeof(ethernet_mac));
 	}
+	pbuf_init();
+	ethernet_rx_pbuf = pbuf_alloc();
+	ethernet_tx_pbuf = pbuf_alloc();
+	ethernet_rx_buffer = ethernet_rx_pbuf->data;
+	ethernet_tx_buffer = ethernet_tx_pbuf->data;
+#if HAL_RX_FILTER
+	ethernet_rx_accepted = 0;
+	ethernet_multicast_count = 0;
+	ethernet_rx_filter_update();
+#endif
 }
 
 
@@ -67,15 +93,148 @@ const ethernet_address * ethernet_get_mac()
 	return (const ethernet_address*)&ethernet_mac;
 }
 
+#if HAL_RX_FILTER
+/**
+* Programs the receive filters of the controller. Broadcast frames are
+* matched by the pattern filter: while we have an address only ARP
+* requests for it pass, while acquiring a DHCP lease without an address
+* only UDP datagrams to the BOOTP client port (a 20 byte IP header is
+* assumed). If both are needed or ETHERNET_RX_ACCEPT_BROADCAST is set all
+* broadcast frames are received. Multicast frames pass the hash table
+* filter.
+*/
+void ethernet_rx_filter_update(void)
+{
+	/* window bytes 0-5 (destination), 12-13 (type) and 38-41 (ARP target IP) */
+	static const uint8_t arp_mask[8] = {0x3f,0x30,0x00,0x00,0xc0,0x03,0x00,0x00};
+	/* window bytes 0-5 (destination), 12-13 (type), 23 (IP protocol) and 36-37 (UDP destination port) */
+	static const uint8_t dhcp_mask[8] = {0x3f,0x30,0x80,0x00,0x30,0x00,0x00,0x00};
+	static const uint8_t dhcp_pattern[11] = {0xff,0xff,0xff,0xff,0xff,0xff,0x08,0x00,0x11,0x00,0x44};
+	const uint8_t * ip = (const uint8_t*)ip_get_addr();
+	uint8_t has_ip = ip[0] | ip[1] | ip[2] | ip[3];
+	uint8_t filters = HAL_RX_FILTER_UNICAST;
+	uint8_t i;
+
+	if((ethernet_rx_accepted & ETHERNET_RX_ACCEPT_BROADCAST) ||
+		((ethernet_rx_accepted & ETHERNET_RX_ACCEPT_DHCP) && has_ip))
+	{
+		filters |= HAL_RX_FILTER_BROADCAST;
+	}
+	else if(ethernet_rx_accepted & ETHERNET_RX_ACCEPT_DHCP)
+	{
+		hal_rx_pattern(0,dhcp_mask,dhcp_pattern,sizeof(dhcp_pattern));
+		filters |= HAL_RX_FILTER_PATTERN;
+	}
+	else if(has_ip)
+	{
+		uint8_t arp_pattern[12] = {0xff,0xff,0xff,0xff,0xff,0xff,0x08,0x06};
+
+		memcpy(arp_pattern + 8,ip,sizeof(ip_address));
+		hal_rx_pattern(0,arp_mask,arp_pattern,sizeof(arp_pattern));
+		filters |= HAL_RX_FILTER_PATTERN;
+	}
+	hal_rx_hash_clear();
+	for(i = 0 ; i < ethernet_multicast_count ; i++)
+	{
+		hal_rx_hash_add(ethernet_multicast[i]);
+	}
+	if(ethernet_multicast_count)
+	{
+		filters |= HAL_RX_FILTER_HASH;
+	}
+	hal_rx_filter(filters);
+}
+
+/**
+* Enables or disables reception of ETHERNET_RX_ACCEPT_* broadcast frames
+*/
+void ethernet_rx_accept(uint8_t accept,uint8_t enable)
+{
+	uint8_t accepted = enable ? (ethernet_rx_accepted | accept) : (ethernet_rx_accepted & ~accept);
+
+	if(accepted != ethernet_rx_accepted)
+	{
+		ethernet_rx_accepted = accepted;
+		ethernet_rx_filter_update();
+	}
+}
+
+/**
+* Starts receiving frames sent to the multicast address, an address
+* joined n times has to be left n times
+* @returns 0 if there are already ETHERNET_MULTICAST_MAX addresses
+*/
+uint8_t ethernet_multicast_join(const ethernet_address * addr)
+{
+	if(ethernet_multicast_count >= ETHERNET_MULTICAST_MAX)
+	{
+		return 0;
+	}
+	memcpy(&ethernet_multicast[ethernet_multicast_count++],addr,sizeof(ethernet_address));
+	ethernet_rx_filter_update();
+	return 1;
+}
+
+void ethernet_multicast_leave(const ethernet_address * addr)
+{
+	uint8_t i;
+
+	for(i = 0 ; i < ethernet_multicast_count ; i++)
+	{
+		if(!memcmp(&ethernet_multicast[i],addr,sizeof(ethernet_address)))
+		{
+			memmove(&ethernet_multicast[i],&ethernet_multicast[i+1],(--ethernet_multicast_count - i) * sizeof(ethernet_address));
+			ethernet_rx_filter_update();
+			return;
+		}
+	}
+}
+#endif
+
 uint8_t ethernet_handle_packet()
 {
+	/* the previous frame has been kept by an upper layer, receive into
+	 another buffer, the frame waits in the controller if there is none */
+	if(!ethernet_rx_pbuf || ethernet_rx_pbuf->ref > 1)
+	{
+		struct pbuf * p = pbuf_alloc();
+		
+		if(!p)
+		{
+			return 0;
+		}
+		pbuf_free(ethernet_rx_pbuf);
+		ethernet_rx_pbuf = p;
+		ethernet_rx_buffer = p->data;
+	}
 	/* receive packet */
-	uint16_t packet_size = hal_receive_packet(ethernet_rx_buffer,sizeof(ethernet_rx_buffer));
+#if ETHERNET_RX_HEADER_FIRST
+	uint16_t packet_size = hal_rx_begin();
+	
+	if(packet_size < 1)
+	{
+		return 0;
+ 	}
+	if(packet_size > PBUF_SIZE)
+	{
+		packet_size = PBUF_SIZE;
+	}
+	ethernet_rx_length = packet_size;
+	ethernet_rx_fetched = 0;
+	ethernet_rx_pbuf->len = packet_size;
+	/* upper layers fetch the rest if they need it */
+	ethernet_rx_fetch(ethernet_rx_buffer,ETHERNET_RX_HEADER_SIZE);
+#else
+	uint16_t packet_size = hal_receive_packet(ethernet_rx_buffer,PBUF_SIZE);
 	 
 	if(packet_size < 1)
 	{
 		return 0;
  	}
+	ethernet_rx_length = packet_size;
+	ethernet_rx_fetched = packet_size;
+	ethernet_rx_pbuf->len = packet_size;
+#endif
 	/* get ethernet header */
 	struct ethernet_header * header = (struct ethernet_header*)ethernet_rx_buffer;
 	
@@ -91,26 +250,146 @@ uint8_t ethernet_handle_packet()
 	{
 		case HTON16(ETHERNET_TYPE_IP):
 			ret = ip_handle_packet((struct ip_header*)data,packet_size,(const ethernet_address*)&header->src);
+			ethernet_stats.rx_packets++;
 			break;
 		case HTON16(ETHERNET_TYPE_ARP):
 			ret = arp_handle_packet((struct arp_header*)data,packet_size);
+			ethernet_stats.rx_packets++;
 			break;
 		default:
-			return 0;
+			ret = 0;
+			break;
 	}
-	ethernet_stats.rx_packets++;
+#if ETHERNET_RX_HEADER_FIRST
+	hal_rx_end();
+#endif
+	return ret;
+}
 
+/**
+* Makes sure that len bytes of the received frame starting at data (a
+* pointer into ethernet_rx_buffer) are in the receive buffer
+* @returns 0 if the frame is shorter
+*/
+uint8_t ethernet_rx_fetch(const void * data,uint16_t len)
+{
+	uint16_t end = ethernet_rx_offset(data) + len;
+	uint8_t ret = 1;
+	
+	if(end > ethernet_rx_length)
+	{
+		end = ethernet_rx_length;
+		ret = 0;
+	}
+#if ETHERNET_RX_HEADER_FIRST
+	if(end > ethernet_rx_fetched)
+	{
+		hal_rx_read(ethernet_rx_fetched,&ethernet_rx_buffer[ethernet_rx_fetched],end - ethernet_rx_fetched);
+		ethernet_rx_fetched = end;
+	}
+#endif
 	return ret;
 }
 
-uint8_t ethernet_send_packet(ethernet_address * dst,uint16_t type,uint16_t len)
+/**
+* Checks if len bytes of the received frame starting at data are
+* already in the receive buffer
+*/
+uint8_t ethernet_rx_is_fetched(const void * data,uint16_t len)
 {
-	if(len > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET)
+	return ethernet_rx_offset(data) + len <= ethernet_rx_fetched;
+}
+
+/**
+* Fetches the whole received frame and takes a reference to its buffer,
+* the frame stays valid after it has been handled and the next one is
+* received into another buffer. The reference is dropped with
+* pbuf_free().
+* @returns 0 if the frame is incomplete
+*/
+struct pbuf * ethernet_rx_keep(void)
+{
+	/* frames set with ethernet_rx_set_frame() are not in a packet buffer */
+	if(ethernet_rx_buffer != ethernet_rx_pbuf->data)
+	{
+		return 0;
+	}
+	if(!ethernet_rx_fetch(ethernet_rx_buffer,ethernet_rx_length))
 	{
 		return 0;
 	}
+	return pbuf_ref(ethernet_rx_pbuf);
+}
 
-	struct ethernet_header * header = (struct ethernet_header*)ethernet_tx_buffer;
+/**
+* Copies len bytes at offset of the received frame to data, straight
+* from the controller if they have not been fetched
+*/
+void ethernet_rx_read(uint16_t offset,uint8_t * data,uint16_t len)
+{
+#if ETHERNET_RX_HEADER_FIRST
+	if(offset + len > ethernet_rx_fetched)
+	{
+		hal_rx_read(offset,data,len);
+		return;
+	}
+#endif
+	memcpy(data,&ethernet_rx_buffer[offset],len);
+}
+
+/**
+* Makes frame of len bytes, which is complete in memory, the received
+* frame read by upper layers. Frame 0 makes the receive buffer current
+* again, the frame received into it is not valid anymore.
+*/
+void ethernet_rx_set_frame(uint8_t * frame,uint16_t len)
+{
+	if(frame)
+	{
+		ethernet_rx_buffer = frame;
+		ethernet_rx_length = len;
+		ethernet_rx_fetched = len;
+	}
+	else
+	{
+		ethernet_rx_buffer = ethernet_rx_pbuf->data;
+		ethernet_rx_length = 0;
+		ethernet_rx_fetched = 0;
+	}
+}
+
+/**
+* Adds len bytes of the received frame starting at data to the
+* checksum. Bytes which have not been fetched are summed by the
+* controller.
+*/
+uint16_t ethernet_rx_checksum(uint16_t checksum,const void * data,uint16_t len)
+{
+#if ETHERNET_RX_HEADER_FIRST
+	if(!ethernet_rx_is_fetched(data,len))
+	{
+		uint16_t temp = hal_rx_checksum(ethernet_rx_offset(data),len);
+		
+		checksum += temp;
+		if(checksum < temp)
+			++checksum;
+		return checksum;
+	}
+#endif
+	return net_get_checksum(checksum,(const uint8_t*)data,len,NET_CHECKSUM_NO_SKIP);
+}
+
+uint8_t ethernet_send_packet(ethernet_address * dst,uint16_t type,uint16_t len)
+{
+	return ethernet_send_packet_csum(dst,type,len,0,0);
+}
+
+/**
+* Fills ethernet header of the frame
+*/
+static void ethernet_set_header(uint8_t * frame,ethernet_address * dst,uint16_t type)
+{
+	struct ethernet_header * header = (struct ethernet_header*)frame;
 	
 	if(dst == ETHERNET_ADDR_BROADCAST)
 	{
@@ -124,6 +403,257 @@ uint8_t ethernet_send_packet(ethernet_address * dst,uint16_t type,uint16_t len)
 	memcpy(&header->src,&ethernet_mac,sizeof(ethernet_address));
 	header->type = hton16(type);
 	ethernet_stats.tx_packets++;
+}
+
+/**
+* Completes the checksum of the payload tail from csum_start on in
+* software, the field at csum_start+csum_offset holds the initial sum
+*/
+static void ethernet_tx_checksum(uint8_t * frame,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint8_t * data = &frame[NET_HEADER_SIZE_ETHERNET + csum_start];
+	uint16_t checksum = MAKEUINT16(data[csum_offset],data[csum_offset+1]);
+	
+	checksum = ~net_get_checksum(checksum,data,len - csum_start,csum_offset);
+	data[csum_offset] = checksum >> 8;
+	data[csum_offset+1] = checksum & 0xff;
+}
+
+/**
+* Sends the frame, see ethernet_send_packet_csum()
+*/
+static uint8_t ethernet_send_frame(uint8_t * frame,ethernet_address * dst,uint16_t type,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	if(len > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET)
+	{
+		return 0;
+	}
+
+	ethernet_set_header(frame,dst,type);
+	
+	if(csum_offset)
+	{
+#if HAL_CHECKSUM_OFFLOAD
+		return hal_send_packet_csum(frame,(len + NET_HEADER_SIZE_ETHERNET),
+			(csum_start + NET_HEADER_SIZE_ETHERNET),csum_offset);
+#else
+		ethernet_tx_checksum(frame,len,csum_start,csum_offset);
+#endif
+	}
+	return hal_send_packet(frame,(len + NET_HEADER_SIZE_ETHERNET));
+}
+
+/**
+* Sends packet whose payload carries an Internet checksum of its tail
+* from csum_start on. The checksum field at csum_start+csum_offset holds
+* the initial (pseudo header) sum and is completed by the controller if
+* it can do so, otherwise here. csum_offset 0 means no checksum.
+*/
+uint8_t ethernet_send_packet_csum(ethernet_address * dst,uint16_t type,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	return ethernet_send_frame(ethernet_tx_buffer,dst,type,len,csum_start,csum_offset);
+}
+
+#if HAL_TX_GATHER
+/**
+* Describes the frame as the headers in the transmit buffer followed by
+* the spans
+*/
+static void ethernet_tx_spans(struct hal_span * frame,uint16_t len,const struct net_span * spans,uint8_t count)
+{
+	frame->data = ethernet_tx_buffer;
+	frame->len = len + NET_HEADER_SIZE_ETHERNET;
+	frame->pgm = 0;
+	while(count--)
+	{
+		frame++;
+		frame->data = spans->data;
+		frame->len = spans->len;
+		frame->pgm = spans->pgm;
+		spans++;
+	}
+}
+#endif
+
+/**
+* Copies the spans behind len bytes of payload in the transmit buffer
+*/
+static void ethernet_tx_copy(uint16_t len,const struct net_span * spans,uint8_t count)
+{
+	uint8_t * data = &ethernet_tx_buffer[NET_HEADER_SIZE_ETHERNET + len];
+	
+	for( ; count ; count--,spans++)
+	{
+		if(spans->pgm)
+		{
+			memcpy_P(data,(const prog_uint8_t*)spans->data,spans->len);
+		}
+		else
+		{
+			memcpy(data,spans->data,spans->len);
+		}
+		data += spans->len;
+	}
+}
+
+/**
+* Sends packet of len bytes in the transmit buffer followed by count
+* spans like ethernet_send_packet_csum(). If the controller gathers
+* frames the spans are written to it straight from their memory,
+* otherwise they are copied behind the headers.
+*/
+uint8_t ethernet_send_gather(ethernet_address * dst,uint16_t type,uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint16_t total = len + net_span_len(spans,count);
+	
+	if(count > ETHERNET_TX_SPANS || total > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET)
+	{
+		return 0;
+	}
+#if HAL_TX_GATHER
+	struct hal_span frame[1 + ETHERNET_TX_SPANS];
+	
+	ethernet_set_header(ethernet_tx_buffer,dst,type);
+	ethernet_tx_spans(frame,len,spans,count);
+	return hal_send_gather(frame,1 + count,(csum_start + NET_HEADER_SIZE_ETHERNET),csum_offset);
+#else
+	ethernet_tx_copy(len,spans,count);
+	return ethernet_send_frame(ethernet_tx_buffer,dst,type,total,csum_start,csum_offset);
+#endif
+}
+
+/**
+* Takes the packet of len bytes in the transmit buffer followed by count
+* spans out of it to be sent later with ethernet_send_pbuf(), a new
+* buffer becomes the transmit buffer. The spans are copied and the
+* checksum (see ethernet_send_packet_csum()) is completed now since the
+* frame is sent as it is.
+* @returns Buffer holding the frame or 0 if no buffer is free
+*/
+struct pbuf * ethernet_tx_keep(uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint16_t total = len + net_span_len(spans,count);
+	struct pbuf * kept = ethernet_tx_pbuf;
+	struct pbuf * p;
+	
+	if(total > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET || !(p = pbuf_alloc()))
+	{
+		return 0;
+	}
+	ethernet_tx_copy(len,spans,count);
+	if(csum_offset)
+	{
+		ethernet_tx_checksum(ethernet_tx_buffer,total,csum_start,csum_offset);
+	}
+	kept->len = total + NET_HEADER_SIZE_ETHERNET;
+	ethernet_tx_pbuf = p;
+	ethernet_tx_buffer = p->data;
+	return kept;
+}
+
+/**
+* Sends the received frame, whose first head bytes of payload have been
+* rewritten in the receive buffer, back to its source as a packet of len
+* bytes. The rest of the payload is copied inside the controller if it
+* can do so, otherwise the frame is fetched and sent from the receive
+* buffer.
+*/
+uint8_t ethernet_send_rx(uint16_t len,uint16_t head)
+{
+	struct ethernet_header * header = (struct ethernet_header*)ethernet_rx_buffer;
+	
+	if(len > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET || !ethernet_rx_is_fetched(header,NET_HEADER_SIZE_ETHERNET + head))
+	{
+		return 0;
+	}
+	ethernet_set_header(ethernet_rx_buffer,&header->src,ntoh16(header->type));
+#if HAL_TX_RX
+	if(!ethernet_rx_is_fetched(header,NET_HEADER_SIZE_ETHERNET + len))
+	{
+		struct hal_span frame = {ethernet_rx_buffer,NET_HEADER_SIZE_ETHERNET + head,0};
+		
+		return hal_send_rx(&frame,1,NET_HEADER_SIZE_ETHERNET + head,len - head);
+	}
+#endif
+	if(!ethernet_rx_fetch(header,NET_HEADER_SIZE_ETHERNET + len))
+	{
+		return 0;
+	}
+	return hal_send_packet(ethernet_rx_buffer,NET_HEADER_SIZE_ETHERNET + len);
+}
+
+/**
+* Sends packet whose payload has been built at pbuf_payload(p) of a
+* buffer other than the transmit buffer, for frames sent while the
+* transmit buffer holds another one. The reference to p is dropped.
+*/
+uint8_t ethernet_send_pbuf(struct pbuf * p,ethernet_address * dst,uint16_t type,uint16_t len)
+{
+	uint8_t ret = ethernet_send_frame(p->data,dst,type,len,0,0);
 	
-	return hal_send_packet(ethernet_tx_buffer,(len + NET_HEADER_SIZE_ETHERNET));			
+	pbuf_free(p);
+	return ret;
+}
+
+#if HAL_RTX
+/**
+* Sends packet like ethernet_send_packet_csum() and keeps it in the
+* controller, it can be sent again with ethernet_rtx_resend() until it is
+* released with ethernet_rtx_free()
+* @returns Frame handle or -1 if the controller can not keep the frame
+*/
+int8_t ethernet_send_packet_rtx(ethernet_address * dst,uint16_t type,uint16_t len,uint16_t csum_start,uint16_t csum_offset)
+{
+	if(len > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET)
+	{
+		return -1;
+	}
+
+	ethernet_set_header(ethernet_tx_buffer,dst,type);
+	
+	return hal_rtx_send(ethernet_tx_buffer,(len + NET_HEADER_SIZE_ETHERNET),
+		(csum_start + NET_HEADER_SIZE_ETHERNET),csum_offset);
+}
+
+/**
+* Sends packet made of spans like ethernet_send_gather() and keeps it in
+* the controller like ethernet_send_packet_rtx()
+*/
+int8_t ethernet_send_gather_rtx(ethernet_address * dst,uint16_t type,uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset)
+{
+	uint16_t total = len + net_span_len(spans,count);
+	
+	if(count > ETHERNET_TX_SPANS || total > ETHERNET_MAX_PACKET_SIZE -NET_HEADER_SIZE_ETHERNET)
+	{
+		return -1;
+	}
+	struct hal_span frame[1 + ETHERNET_TX_SPANS];
+	
+	ethernet_set_header(ethernet_tx_buffer,dst,type);
+	ethernet_tx_spans(frame,len,spans,count);
+	return hal_rtx_send_gather(frame,1 + count,(csum_start + NET_HEADER_SIZE_ETHERNET),csum_offset);
+}
+
+/**
+* Overwrites len bytes at offset of the payload of the kept frame and
+* sends it again
+*/
+uint8_t ethernet_rtx_resend(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len)
+{
+	ethernet_stats.tx_packets++;
+	return hal_rtx_resend(frame,offset + NET_HEADER_SIZE_ETHERNET,data,len);
+}
+
+/**
+* Reads len bytes at offset of the payload of the kept frame
+*/
+void ethernet_rtx_read(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len)
+{
+	hal_rtx_read(frame,offset + NET_HEADER_SIZE_ETHERNET,data,len);
+}
+
+void ethernet_rtx_free(int8_t frame)
+{
+	hal_rtx_free(frame);
 }
+#endif //HAL_RTX
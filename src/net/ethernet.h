@@ -13,13 +13,16 @@
 #include <avr/pgmspace.h>
 #include "ethernet_config.h"
 #include "net.h"
+#include "hal.h"
+#include "pbuf.h"
 
 #define ETHERNET_TYPE_IP	0x0800
 #define ETHERNET_TYPE_ARP	0x0806
 
 #define ETHERNET_ADDR_BROADCAST	0
 
-extern uint8_t ethernet_tx_buffer[];
+extern uint8_t * ethernet_tx_buffer;
+extern uint8_t * ethernet_rx_buffer;
 
 struct ethernet_stats
 {
@@ -37,6 +40,46 @@ const struct ethernet_stats * ethernet_get_stats(void);
 
 uint8_t ethernet_handle_packet(void);
 uint8_t ethernet_send_packet(ethernet_address * dst,uint16_t type,uint16_t len);
+uint8_t ethernet_send_packet_csum(ethernet_address * dst,uint16_t type,uint16_t len,uint16_t csum_start,uint16_t csum_offset);
+uint8_t ethernet_send_gather(ethernet_address * dst,uint16_t type,uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset);
+struct pbuf * ethernet_tx_keep(uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset);
+uint8_t ethernet_send_pbuf(struct pbuf * p,ethernet_address * dst,uint16_t type,uint16_t len);
+#if HAL_RTX
+int8_t ethernet_send_packet_rtx(ethernet_address * dst,uint16_t type,uint16_t len,uint16_t csum_start,uint16_t csum_offset);
+int8_t ethernet_send_gather_rtx(ethernet_address * dst,uint16_t type,uint16_t len,const struct net_span * spans,uint8_t count,uint16_t csum_start,uint16_t csum_offset);
+uint8_t ethernet_rtx_resend(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len);
+void ethernet_rtx_read(int8_t frame,uint16_t offset,uint8_t * data,uint16_t len);
+void ethernet_rtx_free(int8_t frame);
+#endif
+
+/* broadcast frames ethernet_rx_accept() lets through besides ARP
+ requests for our address */
+#define ETHERNET_RX_ACCEPT_DHCP		0x01
+#define ETHERNET_RX_ACCEPT_BROADCAST	0x02
+
+#if HAL_RX_FILTER
+void ethernet_rx_filter_update(void);
+void ethernet_rx_accept(uint8_t accept,uint8_t enable);
+uint8_t ethernet_multicast_join(const ethernet_address * addr);
+void ethernet_multicast_leave(const ethernet_address * addr);
+#else
+/* the controller receives every frame */
+#define ethernet_rx_filter_update()
+#define ethernet_rx_accept(accept,enable)
+#define ethernet_multicast_join(addr)	1
+#define ethernet_multicast_leave(addr)
+#endif
+
+uint8_t ethernet_rx_fetch(const void * data,uint16_t len);
+uint8_t ethernet_rx_is_fetched(const void * data,uint16_t len);
+struct pbuf * ethernet_rx_keep(void);
+void ethernet_rx_read(uint16_t offset,uint8_t * data,uint16_t len);
+void ethernet_rx_set_frame(uint8_t * frame,uint16_t len);
+uint16_t ethernet_rx_checksum(uint16_t checksum,const void * data,uint16_t len);
+uint8_t ethernet_send_rx(uint16_t len,uint16_t head);
+
+/* offset of a pointer into the received frame */
+#define ethernet_rx_offset(data)	((uint16_t)((const uint8_t*)(data) - ethernet_rx_buffer))
 
 #define ethernet_get_buffer()	(&ethernet_tx_buffer[NET_HEADER_SIZE_ETHERNET])
 #define ethernet_get_broadcast()
@@ -9,4 +9,23 @@
 #ifndef _ETHERNET_CONFIG_H
 #define _ETHERNET_CONFIG_H
 
+/* read the headers of a received frame first and fetch the rest from
+ the controller only if the frame is delivered (payloads may even be
+ streamed straight to their destination), dropped frames cost just the
+ header transfer */
+#define ETHERNET_RX_HEADER_FIRST	1
+
+/* number of bytes read with the headers: Ethernet, IP and TCP header
+ without options */
+#define ETHERNET_RX_HEADER_SIZE		(NET_HEADER_SIZE_ETHERNET + NET_HEADER_SIZE_IP + NET_HEADER_SIZE_TCP)
+
+/* number of multicast addresses the hardware receive filter lets
+ through, 0 disables multicast reception on controllers with filters */
+#define ETHERNET_MULTICAST_MAX		4
+
+/* maximum number of spans following the headers of a frame sent with
+ ethernet_send_gather(), a fifo span wrapping around the end of its
+ buffer takes two */
+#define ETHERNET_TX_SPANS		2
+
 #endif //_ETHERNET_CONFIG_H
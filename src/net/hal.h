@@ -9,17 +9,98 @@
 #ifndef _HAL_H
 #define _HAL_H
 
+#if HAL_HOST && !HAL_HOST_ENC28J60
+
+#include "../host/hal_host.h"
+
+#define hal_init(mac)	hal_host_init((mac))
+
+#define hal_send_packet(buff,len) hal_host_send_packet((buff),(len))
+
+#define hal_receive_packet(buff,max_len) hal_host_receive_packet((buff),(max_len))
+
+#define hal_rx_begin()	hal_host_rx_begin()
+
+#define hal_rx_read(offset,buff,len) hal_host_rx_read((offset),(buff),(len))
+
+#define hal_rx_checksum(offset,len) hal_host_rx_checksum((offset),(len))
+
+#define hal_rx_end()	hal_host_rx_end()
+/* frames are sent synchronously */
+#define hal_tx_service()
+#define hal_tx_pending()	0
+/* frames can not be kept for retransmission */
+#define HAL_RTX	0
+/* every frame is received */
+#define HAL_RX_FILTER	0
+
+/* checksums are never computed by the host backend */
+#define HAL_CHECKSUM_OFFLOAD	0
+/* frames are sent from one buffer */
+#define HAL_TX_GATHER	0
+/* received frames are sent back from the receive buffer */
+#define HAL_TX_RX	0
+
+#else
+
+/* ENC28J60 driver backend, on the host (HAL_HOST_ENC28J60) the driver
+ runs on top of the register model of the controller */
 #include "../dev/enc28j60.h"
 
 #define hal_init(mac)	enc28j60_init((mac))
 
 #define hal_send_packet(buff,len) enc28j60_send_packet((buff),(len))
 
+#define hal_send_packet_csum(buff,len,csum_start,csum_offset) enc28j60_send_packet_csum((buff),(len),(csum_start),(csum_offset))
+
 #define hal_receive_packet(buff,max_len) enc28j60_receive_packet((buff),(max_len))
 
-#define hal_link_up()	
+#define hal_rx_begin()	enc28j60_rx_begin()
 
+#define hal_rx_read(offset,buff,len) enc28j60_rx_read((offset),(buff),(len))
 
-#endif //_HAL_H
+/* the DMA result is complemented, return the plain sum like net_get_checksum() */
+#define hal_rx_checksum(offset,len) ((uint16_t)~enc28j60_rx_checksum((offset),(len)))
+
+#define hal_rx_end()	enc28j60_rx_end()
+/* sends the next frame queued in the controller's transmit ring */
+#define hal_tx_service()	enc28j60_tx_service()
+#define hal_tx_pending()	enc28j60_tx_pending()
+/* frames kept in the controller for retransmission */
+#define hal_rtx_send(buff,len,csum_start,csum_offset) enc28j60_rtx_send((buff),(len),(csum_start),(csum_offset))
+#define hal_rtx_resend(frame,offset,data,len) enc28j60_rtx_resend((frame),(offset),(data),(len))
+#define hal_rtx_read(frame,offset,data,len) enc28j60_rtx_read((frame),(offset),(data),(len))
+#define hal_rtx_free(frame)	enc28j60_rtx_free((frame))
+#define HAL_RTX	(ENC28J60_RTX_SIZE > 0)
+/* receive filters of the controller, a frame is received if it passes
+ any of the enabled filters */
+#define hal_rx_filter(filters)	enc28j60_rx_filter((filters))
+#define hal_rx_pattern(offset,mask,data,len) enc28j60_rx_pattern((offset),(mask),(data),(len))
+#define hal_rx_hash_clear()	enc28j60_rx_hash_clear()
+#define hal_rx_hash_add(mac)	enc28j60_rx_hash_add((mac))
+#define HAL_RX_FILTER_UNICAST	ERXFCON_UCEN
+#define HAL_RX_FILTER_BROADCAST	ERXFCON_BCEN
+#define HAL_RX_FILTER_MULTICAST	ERXFCON_MCEN
+#define HAL_RX_FILTER_PATTERN	ERXFCON_PMEN
+#define HAL_RX_FILTER_HASH	ERXFCON_HTEN
+#define HAL_RX_FILTER	1
 
+/* the controller's DMA computes checksums of transmitted frames */
+#define HAL_CHECKSUM_OFFLOAD	1
+/* frames, kept ones too, are streamed into the controller from a list
+ of spans, their checksums are computed by the DMA */
+#define hal_span	enc28j60_span
+#define hal_send_gather(spans,count,csum_start,csum_offset) enc28j60_send_gather((spans),(count),(csum_start),(csum_offset))
+#define hal_rtx_send_gather(spans,count,csum_start,csum_offset) enc28j60_rtx_send_gather((spans),(count),(csum_start),(csum_offset))
+#define HAL_TX_GATHER	1
+/* a frame is sent with the tail of the received one, which the DMA
+ copies inside the controller */
+#define hal_send_rx(spans,count,offset,len) enc28j60_send_rx((spans),(count),(offset),(len))
+#define HAL_TX_RX	1
 
+#endif //HAL_HOST
+
+#define hal_link_up()	
+
+
+#endif //_HAL_H
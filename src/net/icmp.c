@@ -14,10 +14,12 @@
 #include "../debug.h"
 
 #include <string.h>
+#include <avr/pgmspace.h>
 
 #include "net.h"
 #include "ethernet.h"
 #include "ip.h"
+#include "../sys/timer.h"
 
 #define ICMP_TYPE_ECHO_REPLY			0x00
 #define ICMP_TYPE_ECHO_REQUEST			0x08
@@ -30,23 +32,94 @@ struct	icmp_header
 	uint16_t checksum;
 };
 
-uint8_t icmp_send_echo_reply(const ip_address * ip_addr,const struct icmp_header * icmp,uint16_t packet_len);
+/* rest of the echo request and reply header */
+struct icmp_echo
+{
+	uint16_t id;
+	uint16_t seq;
+};
+
+/* echo request sent with icmp_ping() */
+struct icmp_ping
+{
+	uint8_t used;
+	uint16_t seq;
+	ip_address ip;
+	/* timer_now() when the request has been sent */
+	uint32_t sent;
+	icmp_ping_callback_t callback;
+};
+
+static struct icmp_ping icmp_ping_pending[ICMP_PING_PENDING];
+static struct icmp_ping_stats icmp_ping_stats;
+static struct ip_route icmp_ping_route;
+static uint16_t icmp_ping_seq;
+/* the timer runs only while requests wait for replies */
+static timer_t icmp_ping_timer;
+static uint8_t icmp_ping_timer_running;
+
+#define FOREACH_ICMP_PING(ping) for(ping = &icmp_ping_pending[0] ; ping < &icmp_ping_pending[ICMP_PING_PENDING] ; ping++)
+
+uint8_t icmp_send_echo_reply(struct icmp_header * icmp,uint16_t packet_len);
+static void icmp_ping_reply(const ip_address * ip_addr,struct icmp_header * icmp,uint16_t packet_len);
+static void icmp_ping_tick(timer_t timer,void * arg);
+
+uint8_t icmp_init(void)
+{
+	memset(icmp_ping_pending,0,sizeof(icmp_ping_pending));
+	memset(&icmp_ping_stats,0,sizeof(icmp_ping_stats));
+	ip_route_init(&icmp_ping_route);
+	icmp_ping_timer = timer_alloc(icmp_ping_tick);
+	if(icmp_ping_timer < 0)
+	{
+		return 0;
+	}
+	/* it is set when the first request is sent */
+	icmp_ping_timer_running = 0;
+	
+	return 1;
+}
+
+const struct icmp_ping_stats * icmp_ping_get_stats(void)
+{
+	return (const struct icmp_ping_stats*)&icmp_ping_stats;
+}
+
+void icmp_print_stat(FILE * fh)
+{
+	fprintf_P(fh,PSTR("Ping   : "));
+	fprintf(fh,"%lu sent, %lu received, %lu lost",
+		(unsigned long)icmp_ping_stats.sent,
+		(unsigned long)icmp_ping_stats.received,
+		(unsigned long)icmp_ping_stats.lost);
+	if(icmp_ping_stats.received)
+	{
+		fprintf(fh,", rtt min/avg/max %lu/%lu/%lu ms",
+			(unsigned long)icmp_ping_stats.rtt_min,
+			(unsigned long)(icmp_ping_stats.rtt_sum / icmp_ping_stats.received),
+			(unsigned long)icmp_ping_stats.rtt_max);
+	}
+	fprintf_P(fh,PSTR("\n"));
+}
 
 
-uint8_t icmp_handle_packet(const ip_address * ip_addr,const struct icmp_header * icmp,uint16_t packet_len)
+uint8_t icmp_handle_packet(const ip_address * ip_addr,struct icmp_header * icmp,uint16_t packet_len)
 {
 	if(packet_len < sizeof(struct icmp_header))
 		return 0;
+	if(!ethernet_rx_fetch(icmp,sizeof(struct icmp_header)))
+		return 0;
 	
-	/* check checksum */
-	if(hton16(icmp->checksum) != ~net_get_checksum(0,(uint8_t*)icmp,packet_len,2))
+	/* check checksum, the data is summed where it is */
+	if(ethernet_rx_checksum(0,icmp,packet_len) != 0xffff)
 		return 0;
 		/* parse icmp packet */
 	switch(icmp->type)
 	{
 		case ICMP_TYPE_ECHO_REQUEST:
-			return icmp_send_echo_reply(ip_addr,icmp,packet_len);
+			return icmp_send_echo_reply(icmp,packet_len);
 		case ICMP_TYPE_ECHO_REPLY:
+			icmp_ping_reply(ip_addr,icmp,packet_len);
 			break;
 		case ICMP_TYPE_DESTINATION_UNREACHABLE:
 			break;
@@ -54,21 +127,215 @@ uint8_t icmp_handle_packet(const ip_address * ip_addr,const struct icmp_header *
 	return 0;
 }
 
-uint8_t icmp_send_echo_reply(const ip_address * ip_addr,const struct icmp_header * icmp,uint16_t packet_len)
+/**
+ * Turns the request into the reply in the receive buffer, the data is
+ * sent back as it has been received
+ */
+uint8_t icmp_send_echo_reply(struct icmp_header * icmp,uint16_t packet_len)
 {
-	struct icmp_header * icmp_reply = (struct icmp_header*)ip_get_buffer();
-	
-	memcpy(icmp_reply,icmp,packet_len);
-	
 	/* set type */
-	icmp_reply->type = ICMP_TYPE_ECHO_REPLY;
+	icmp->type = ICMP_TYPE_ECHO_REPLY;
 	
-	/* compute checksum */
-	icmp_reply->checksum = hton16(~net_get_checksum(0,(const uint8_t*)icmp_reply,packet_len,2));
+	/* only type has changed so update checksum instead of computing it again */
+	icmp->checksum = hton16(net_checksum_adjust(ntoh16(icmp->checksum),
+		MAKEUINT16((uint16_t)ICMP_TYPE_ECHO_REQUEST,icmp->code),
+		MAKEUINT16((uint16_t)ICMP_TYPE_ECHO_REPLY,icmp->code)));
 	
 	/* send ip packet */
-	return ip_send_packet(ip_addr,IP_PROTOCOL_ICMP,packet_len);
-			
+	return ip_send_reply(sizeof(struct icmp_header),packet_len);
+}
+
+/**
+ * Tells ip_addr that the received packet could not be delivered. The
+ * caller checks with ip_error_allowed() that it may be told so.
+ */
+uint8_t icmp_send_unreachable(const ip_address * ip_addr,uint8_t code)
+{
+	struct icmp_header * icmp = (struct icmp_header*)ip_get_buffer();
+	uint8_t * data = (uint8_t*)(icmp + 1);
+	uint16_t length;
+	
+	icmp->type = ICMP_TYPE_DESTINATION_UNREACHABLE;
+	icmp->code = code;
+	icmp->checksum = 0;
+	/* unused */
+	memset(data,0,4);
+	length = sizeof(struct icmp_header) + 4 + ip_quote_packet(data + 4);
+	icmp->checksum = hton16(~net_get_checksum(0,(const uint8_t*)icmp,length,2));
+	
+	return ip_send_packet(ip_addr,0,IP_PROTOCOL_ICMP,length);
+}
+
+/**
+ * Sends echo request with size bytes of data to ip, callback is called
+ * with its sequence number when the reply comes or when it is lost
+ * @returns 0 if too many requests wait for replies or the request can
+ * not be sent
+ */
+uint8_t icmp_ping(const ip_address * ip,uint16_t size,icmp_ping_callback_t callback)
+{
+	struct icmp_header * icmp = (struct icmp_header*)ip_get_buffer();
+	struct icmp_echo * echo = (struct icmp_echo*)(icmp + 1);
+	uint8_t * data = (uint8_t*)(echo + 1);
+	uint16_t length = sizeof(struct icmp_header) + sizeof(struct icmp_echo) + size;
+	struct icmp_ping * ping;
+	uint16_t i;
+	
+	if(length > ip_get_buffer_size())
+	{
+		return 0;
+	}
+	FOREACH_ICMP_PING(ping)
+	{
+		if(!ping->used)
+		{
+			break;
+		}
+	}
+	if(ping == &icmp_ping_pending[ICMP_PING_PENDING])
+	{
+		return 0;
+	}
+	icmp->type = ICMP_TYPE_ECHO_REQUEST;
+	icmp->code = 0;
+	icmp->checksum = 0;
+	echo->id = HTON16(ICMP_PING_ID);
+	echo->seq = hton16(++icmp_ping_seq);
+	for(i = 0 ; i < size ; i++)
+	{
+		data[i] = i;
+	}
+	ping->sent = timer_now();
+#if NET_CHECKSUM_OFFLOAD
+	if(size >= NET_CHECKSUM_OFFLOAD_MIN)
+	{
+		/* there is no pseudo header, the controller sums the message */
+		if(!ip_send_packet_csum(ip,&icmp_ping_route,IP_PROTOCOL_ICMP,length,2))
+		{
+			return 0;
+		}
+	}
+	else
+#endif
+	{
+		icmp->checksum = hton16(~net_get_checksum(0,(const uint8_t*)icmp,length,2));
+		if(!ip_send_packet(ip,&icmp_ping_route,IP_PROTOCOL_ICMP,length))
+		{
+			return 0;
+		}
+	}
+	ping->used = 1;
+	ping->seq = icmp_ping_seq;
+	memcpy(&ping->ip,ip,sizeof(ip_address));
+	ping->callback = callback;
+	icmp_ping_stats.sent++;
+	if(!icmp_ping_timer_running)
+	{
+		icmp_ping_timer_running = timer_set(icmp_ping_timer,ICMP_PING_TIMEOUT_MS,TIMER_MODE_ONE_SHOT);
+	}
+	return 1;
+}
+
+/**
+ * Reports the result of the request whose entry has been freed
+ */
+static void icmp_ping_done(const struct icmp_ping * ping,int32_t rtt)
+{
+	icmp_ping_callback_t callback = ping->callback;
+	uint16_t seq = ping->seq;
+	ip_address ip;
+	
+	if(callback)
+	{
+		memcpy(&ip,&ping->ip,sizeof(ip_address));
+		callback((const ip_address*)&ip,seq,rtt);
+	}
+}
+
+/**
+ * Matches the echo reply with the request waiting for it
+ */
+static void icmp_ping_reply(const ip_address * ip_addr,struct icmp_header * icmp,uint16_t packet_len)
+{
+	struct icmp_echo * echo = (struct icmp_echo*)(icmp + 1);
+	struct icmp_ping * ping;
+	uint32_t rtt;
+	
+	if(packet_len < sizeof(struct icmp_header) + sizeof(struct icmp_echo) ||
+		!ethernet_rx_fetch(echo,sizeof(struct icmp_echo)) ||
+		echo->id != HTON16(ICMP_PING_ID))
+	{
+		return;
+	}
+	FOREACH_ICMP_PING(ping)
+	{
+		if(ping->used && ping->seq == ntoh16(echo->seq) &&
+			!memcmp(&ping->ip,ip_addr,sizeof(ip_address)))
+		{
+			break;
+		}
+	}
+	if(ping == &icmp_ping_pending[ICMP_PING_PENDING])
+	{
+		return;
+	}
+	rtt = timer_now() - ping->sent;
+	ping->used = 0;
+	if(!icmp_ping_stats.received || rtt < icmp_ping_stats.rtt_min)
+	{
+		icmp_ping_stats.rtt_min = rtt;
+	}
+	if(rtt > icmp_ping_stats.rtt_max)
+	{
+		icmp_ping_stats.rtt_max = rtt;
+	}
+	icmp_ping_stats.rtt_sum += rtt;
+	icmp_ping_stats.received++;
+	/* the callback may send the next request into the freed entry */
+	icmp_ping_done(ping,(int32_t)rtt);
+}
+
+/**
+ * Counts requests which have not been answered in time as lost
+ */
+static void icmp_ping_tick(timer_t timer,void * arg)
+{
+	struct icmp_ping * ping;
+	uint32_t now = timer_now();
+	int32_t next = ICMP_PING_TIMEOUT_MS;
+	int32_t left;
+	
+	if(timer != icmp_ping_timer)
+	{
+		return;
+	}
+	icmp_ping_timer_running = 0;
+	FOREACH_ICMP_PING(ping)
+	{
+		if(!ping->used)
+		{
+			continue;
+		}
+		left = ICMP_PING_TIMEOUT_MS - (int32_t)(now - ping->sent);
+		if(left <= 0)
+		{
+			ping->used = 0;
+			icmp_ping_stats.lost++;
+			icmp_ping_done(ping,-1);
+		}
+		else
+		{
+			if(left < next)
+			{
+				next = left;
+			}
+			icmp_ping_timer_running = 1;
+		}
+	}
+	if(icmp_ping_timer_running)
+	{
+		timer_set(icmp_ping_timer,next,TIMER_MODE_ONE_SHOT);
+	}
 }
 
 #endif //NET_ICMP
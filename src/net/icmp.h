@@ -9,15 +9,42 @@
 #ifndef _ICMP_H
 #define _ICMP_H
 
-#include "net_config.h"
+#include "icmp_config.h"
 
 #include "ip.h"
 
 #include <stdint.h>
+#include <stdio.h>
 
 struct icmp_header;
 
-uint8_t icmp_handle_packet(const ip_address * ip_addr,const struct icmp_header * icmp,uint16_t packet_len);
+/* codes of destination unreachable messages */
+#define ICMP_CODE_PROTOCOL_UNREACHABLE	0x02
+#define ICMP_CODE_PORT_UNREACHABLE	0x03
+
+/**
+ * Called when the reply to echo request seq sent to ip comes, rtt is the
+ * round trip time in ms, or when it is lost, rtt is -1 then
+ */
+typedef void (*icmp_ping_callback_t)(const ip_address * ip,uint16_t seq,int32_t rtt);
+
+struct icmp_ping_stats
+{
+	uint32_t sent;
+	uint32_t received;
+	uint32_t lost;
+	/* round trip times of received replies in ms */
+	uint32_t rtt_min;
+	uint32_t rtt_max;
+	uint32_t rtt_sum;
+};
+
+uint8_t icmp_init(void);
+uint8_t icmp_handle_packet(const ip_address * ip_addr,struct icmp_header * icmp,uint16_t packet_len);
+uint8_t icmp_send_unreachable(const ip_address * ip_addr,uint8_t code);
+uint8_t icmp_ping(const ip_address * ip,uint16_t size,icmp_ping_callback_t callback);
+const struct icmp_ping_stats * icmp_ping_get_stats(void);
+void icmp_print_stat(FILE * fh);
 
 
 #endif //_ICMP_H
\ No newline at end of file
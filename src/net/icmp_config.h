@@ -11,4 +11,12 @@
 
 #include "net_config.h"
 
+/* echo requests sent with icmp_ping() which wait for replies at the
+ same time */
+#define ICMP_PING_PENDING	4
+/* a request not answered within this time is counted as lost */
+#define ICMP_PING_TIMEOUT_MS	2000
+/* identifier of the echo requests sent with icmp_ping() */
+#define ICMP_PING_ID		0x6176
+
 #endif //_ICMP_CONFIG_H
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include "icmp.h"
 #include "udp.h"
 #include "tcp.h"
+#include "../sys/timer.h"
 
 #include "../debug.h"
 
@@ -141,6 +142,54 @@ static ip_address ip_gateway = NET_IP_GATEWAY;
  */
 static ip_address ip_broadcast;
 
+/**
+ * Routes filled in another generation are not valid
+ */
+static uint16_t ip_route_generation = 1;
+
+/**
+ * Identification of the last packet sent
+ */
+static uint16_t ip_id;
+
+/**
+ * Tokens of error replies left, they are earned every
+ * NET_IP_ERROR_INTERVAL_MS since ip_error_time
+ */
+static uint8_t ip_error_tokens;
+static uint32_t ip_error_time;
+
+#if NET_IP_MULTICAST_GROUPS
+/**
+ * Joined multicast groups, 0.0.0.0 marks a free entry
+ */
+static ip_address ip_multicast[NET_IP_MULTICAST_GROUPS];
+#endif
+
+#if NET_IP_REASS_DATAGRAMS
+/**
+ * Datagram being reassembled from fragments
+ */
+struct ip_reass
+{
+	uint8_t used;
+	/* timer_now() at which the received fragments are dropped */
+	uint32_t expires;
+	/* payload length, 0 until the last fragment is received */
+	uint16_t length;
+	/* number of 8 byte blocks of payload received, map has a bit for each */
+	uint16_t blocks;
+	uint8_t map[(NET_IP_REASS_SIZE + 63) / 64];
+	/* room for Ethernet header, header of the first fragment received and payload */
+	uint8_t frame[NET_HEADER_SIZE_ETHERNET + NET_HEADER_SIZE_IP + NET_IP_REASS_SIZE];
+};
+
+static struct ip_reass ip_reass[NET_IP_REASS_DATAGRAMS]; // EXMEM
+
+#define FOREACH_IP_REASS(reass) for(reass = &ip_reass[0] ; reass < &ip_reass[NET_IP_REASS_DATAGRAMS] ; reass++)
+#define ip_reass_header(reass) ((struct ip_header*)&(reass)->frame[NET_HEADER_SIZE_ETHERNET])
+#endif
+
 /*		A.B.C.D = 3*4 + 3 dots +	: + port number + NULL*/
 static char ip_addr_char[3*sizeof(ip_address) + 3 + 1 + 5 + 1];
 
@@ -167,6 +216,10 @@ const ip_address * ip_get_gateway(void)		{return (const ip_address*)&ip_gateway;
  *
  */
 static void ip_set_broadcast(void);
+static void ip_deliver(struct ip_header * header,uint8_t header_length,uint16_t packet_length);
+#if NET_IP_REASS_DATAGRAMS
+static uint8_t ip_reassemble(const struct ip_header * header,uint8_t header_length,uint16_t packet_length);
+#endif
 
 /**
  *
@@ -206,8 +259,11 @@ uint8_t ip_is_broadcast(const ip_address * ip)
  */
 void ip_init(const ip_address * addr,const ip_address * netmask,const ip_address * gateway)
 {
+	uint8_t changed = 0;
+	
 	if(addr)
 	{
+		changed = memcmp(&ip_addr,addr,sizeof(ip_address)) != 0;
 		memcpy(&ip_addr,addr,sizeof(ip_address));
 	}
 	if(netmask)
@@ -220,21 +276,142 @@ void ip_init(const ip_address * addr,const ip_address * netmask,const ip_address
 	}
 	
 	ip_set_broadcast();
+	/* next hops may change */
+	ip_route_flush();
+	ip_error_tokens = NET_IP_ERROR_BURST;
+	ip_error_time = timer_now();
+	/* ARP requests are filtered by the target address */
+	ethernet_rx_filter_update();
+	/* peers which knew another host at the address update their tables */
+	if(changed && *((uint32_t*)&ip_addr) != 0)
+	{
+		arp_announce();
+	}
+}
+
+#if NET_IP_MULTICAST_GROUPS
+/**
+ * Returns the entry of the multicast group or 0
+ */
+static ip_address * ip_multicast_find(const ip_address * group)
+{
+	uint8_t i;
+	
+	for(i = 0 ; i < NET_IP_MULTICAST_GROUPS ; i++)
+	{
+		if(!memcmp(&ip_multicast[i],group,sizeof(ip_address)))
+		{
+			return &ip_multicast[i];
+		}
+	}
+	return 0;
 }
 
+/**
+ * Maps the multicast group to its Ethernet address 01:00:5e + lower 23 bits
+ */
+static void ip_multicast_mac(const ip_address * group,ethernet_address * mac)
+{
+	(*mac)[0] = 0x01;
+	(*mac)[1] = 0x00;
+	(*mac)[2] = 0x5e;
+	(*mac)[3] = (*group)[1] & 0x7f;
+	(*mac)[4] = (*group)[2];
+	(*mac)[5] = (*group)[3];
+}
 
 /**
- *
+ * Starts receiving datagrams sent to the multicast group (224.0.0.0/4),
+ * no IGMP reports are sent
+ * @return 1 on success
  */
-uint8_t ip_send_packet(const ip_address * ip_dst,uint8_t protocol,uint16_t length)
+uint8_t ip_multicast_join(const ip_address * group)
 {
+	const ip_address any = {0,0,0,0};
 	ethernet_address mac;
+	ip_address * entry;
 	
+	if(((*group)[0] & 0xf0) != 0xe0 || ip_multicast_find(group))
+	{
+		return 0;
+	}
+	entry = ip_multicast_find(&any);
+	ip_multicast_mac(group,&mac);
+	if(!entry || !ethernet_multicast_join((const ethernet_address*)&mac))
+	{
+		return 0;
+	}
+	memcpy(entry,group,sizeof(ip_address));
+	return 1;
+}
+
+void ip_multicast_leave(const ip_address * group)
+{
+	ethernet_address mac;
+	ip_address * entry = ip_multicast_find(group);
+	
+	if(!entry || !(*group)[0])
+	{
+		return;
+	}
+	memset(entry,0,sizeof(ip_address));
+	ip_multicast_mac(group,&mac);
+	ethernet_multicast_leave((const ethernet_address*)&mac);
+}
+#endif
+
+
+void ip_route_flush(void)
+{
+	if(!++ip_route_generation)
+	{
+		ip_route_generation = 1;
+	}
+}
+
+/**
+ *
+ */
+uint8_t ip_send_packet(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length)
+{
+	return ip_send_packet_csum(ip_dst,route,protocol,length,0);
+}
+
+/**
+ * Fills ip header of the packet in the transmit buffer and gets mac
+ * address of the next hop, returns 0 if it is not known yet. The address
+ * is requested then and next_hop is set to the address being resolved.
+ * The header and the address are copied from the route while it is valid
+ * for ip_dst, otherwise the route is filled again.
+ */
+static uint8_t ip_set_header(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,ethernet_address * mac,const ip_address ** next_hop)
+{
+	struct ip_header * ip = (struct ip_header*)ethernet_get_buffer();
+	uint16_t total_len = (uint16_t)sizeof(struct ip_header) + length;
+	uint16_t checksum;
+	uint32_t until;
+	
+	*next_hop = 0;
+	if(route && route->generation == ip_route_generation &&
+		(int32_t)(timer_now() - route->until) < 0 &&
+		((struct ip_header*)route->header)->protocol == protocol &&
+		!memcmp(&((struct ip_header*)route->header)->dst,ip_dst,sizeof(ip_address)))
+	{
+		memcpy(mac,&route->mac,sizeof(ethernet_address));
+		memcpy(ip,route->header,sizeof(struct ip_header));
+		ip->length = hton16(total_len);
+		ip->id = hton16(++ip_id);
+		checksum = net_checksum_adjust(route->checksum,0,total_len);
+		ip->checksum = hton16(net_checksum_adjust(checksum,0,ip_id));
+		return 1;
+	}
 	/* chech if ip dst address is broadcast */
 	if(ip_is_broadcast(ip_dst))
 	{
 		/* if so then get ip bradcast addr and set mac broadcast*/
-		memset(&mac,0xff,sizeof(ethernet_address));
+		memset(mac,0xff,sizeof(ethernet_address));
+		/* it is cheap to send to, there is no route */
+		route = 0;
 	}
 	else
 	{
@@ -252,17 +429,17 @@ uint8_t ip_send_packet(const ip_address * ip_dst,uint8_t protocol,uint16_t lengt
 			arp_target=(const ip_address*)&ip_gateway;
 		}
 
-		if(!arp_get_mac(arp_target,&mac))
+		if(!arp_get_mac(arp_target,mac,&until))
 		{
 			/* if there is no mac in arp table
 			 the request for this mac is send
-			 but we can't send this packet at this time
-			 so we return 0 which means that packet was not send
+			 but we can't send this packet at this time,
+			 it may wait for the reply with ip_hold()
 			*/
-			return 0;
+			*next_hop = arp_target;
+			route = 0;
 		}
 	}
-	struct ip_header * ip = (struct ip_header*)ethernet_get_buffer();
 	
 	/* clear ip header */
 	memset(ip,0,sizeof(struct ip_header));
@@ -273,10 +450,6 @@ uint8_t ip_send_packet(const ip_address * ip_dst,uint8_t protocol,uint16_t lengt
 	/* set header length */
 	ip->vihl.header_length |= (sizeof(struct ip_header) / 4) & 0xf;
 	
-	/* set ip packet length */
-	uint16_t total_len = (uint16_t)sizeof(struct ip_header) + length;
-	ip->length = hton16(total_len);
-	
 	/* set time to live */
 	ip->ttl = 64;
 	
@@ -289,14 +462,290 @@ uint8_t ip_send_packet(const ip_address * ip_dst,uint8_t protocol,uint16_t lengt
 	/* set dst addr */
 	memcpy(&ip->dst,ip_dst,sizeof(ip_address));
 	
-	/* compute checksum */
-	ip->checksum = hton16(~net_get_checksum(0,(const uint8_t*)ip,sizeof(struct ip_header),10));
+	/* compute checksum of the header without length and id */
+	checksum = ~net_get_checksum(0,(const uint8_t*)ip,sizeof(struct ip_header),10);
+	
+	if(route)
+	{
+		route->generation = ip_route_generation;
+		route->until = until;
+		route->checksum = checksum;
+		memcpy(&route->mac,mac,sizeof(ethernet_address));
+		memcpy(route->header,ip,sizeof(struct ip_header));
+	}
+	
+	/* set ip packet length and id */
+	ip->length = hton16(total_len);
+	ip->id = hton16(++ip_id);
+	checksum = net_checksum_adjust(checksum,0,total_len);
+	ip->checksum = hton16(net_checksum_adjust(checksum,0,ip_id));
+	
+	return *next_hop == 0;
+}
+
+/**
+ * Takes the packet out of the transmit buffer to be sent when the mac
+ * address of next_hop is resolved
+ * @returns 0 if the packet can not wait
+ */
+static uint8_t ip_hold(const ip_address * next_hop,uint16_t length,const struct net_span * spans,uint8_t count,uint16_t csum_offset)
+{
+	struct pbuf * p;
+	
+	if(!next_hop)
+	{
+		return 0;
+	}
+	p = ethernet_tx_keep((uint16_t)sizeof(struct ip_header) + length,spans,count,sizeof(struct ip_header),csum_offset);
+	if(!p)
+	{
+		return 0;
+	}
+	p->next = 0;
+	return arp_hold(next_hop,p);
+}
+
+uint8_t ip_send_packet_csum(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,uint16_t csum_offset)
+{
+	ethernet_address mac;
+	const ip_address * next_hop;
+	
+	if(!ip_set_header(ip_dst,route,protocol,length,&mac,&next_hop))
+	{
+		return ip_hold(next_hop,length,0,0,csum_offset);
+	}
 	
 	/* send packet */
-	return ethernet_send_packet(&mac,ETHERNET_TYPE_IP,total_len);
+	return ethernet_send_packet_csum(&mac,ETHERNET_TYPE_IP,(uint16_t)sizeof(struct ip_header) + length,sizeof(struct ip_header),csum_offset);
+}
+
+uint8_t ip_send_gather(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count,uint16_t csum_offset)
+{
+	ethernet_address mac;
+	const ip_address * next_hop;
+	
+	if(!ip_set_header(ip_dst,route,protocol,length + net_span_len(spans,count),&mac,&next_hop))
+	{
+		return ip_hold(next_hop,length,spans,count,csum_offset);
+	}
+	return ethernet_send_gather(&mac,ETHERNET_TYPE_IP,(uint16_t)sizeof(struct ip_header) + length,spans,count,sizeof(struct ip_header),csum_offset);
+}
+
+/**
+ * Sends the packet in fragments which fit into the transmit buffer if it
+ * is too large, see ip.h
+ */
+uint8_t ip_send_fragments(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count)
+{
+	struct ip_header * ip = (struct ip_header*)ethernet_get_buffer();
+	struct net_span slice[ETHERNET_TX_SPANS];
+	ethernet_address mac;
+	const ip_address * next_hop;
+	/* fragments kept while the mac address is resolved */
+	struct pbuf * held = 0;
+	struct pbuf * last = 0;
+	struct pbuf * p;
+	uint32_t total = (uint32_t)length + net_span_len(spans,count);
+	/* all fragments but the last carry multiple of 8 bytes */
+	uint16_t fragment = ip_get_buffer_size() & ~7;
+	uint32_t offset = 0;
+	uint16_t fragment_len = fragment;
+	uint16_t flags = 0;
+	uint16_t checksum;
+	uint16_t in_buffer;
+	uint8_t slices;
+	
+	if(total <= ip_get_buffer_size())
+	{
+		return ip_send_gather(ip_dst,route,protocol,length,spans,count,0);
+	}
+	if(total > 0xffff - sizeof(struct ip_header) || length > fragment)
+	{
+		return 0;
+	}
+	/* if the mac address is not known the fragments are kept in buffers
+	 of their own and wait for it together */
+	ip_set_header(ip_dst,route,protocol,fragment,&mac,&next_hop);
+	checksum = ntoh16(ip->checksum);
+	for(; offset < total ; offset += fragment)
+	{
+		/* fragments share the header, only length and flags change */
+		if(offset + fragment < total)
+		{
+			flags = (IP_FLAGS_MORE_FRAGMENTS << 13) | (offset / 8);
+		}
+		else
+		{
+			flags = offset / 8;
+			fragment_len = total - offset;
+			checksum = net_checksum_adjust(checksum,ntoh16(ip->length),sizeof(struct ip_header) + fragment_len);
+			ip->length = hton16(sizeof(struct ip_header) + fragment_len);
+		}
+		checksum = net_checksum_adjust(checksum,ntoh16(ip->ffo.flags),flags);
+		ip->ffo.flags = hton16(flags);
+		ip->checksum = hton16(checksum);
+		/* header of the upper layer in the transmit buffer goes with the first fragment */
+		in_buffer = offset ? 0 : length;
+		slices = net_span_slice(spans,count,offset ? offset - length : 0,fragment_len - in_buffer,slice,ETHERNET_TX_SPANS);
+		if(!slices)
+		{
+			break;
+		}
+		if(!next_hop)
+		{
+			if(!ethernet_send_gather(&mac,ETHERNET_TYPE_IP,sizeof(struct ip_header) + in_buffer,slice,slices,0,0))
+			{
+				return 0;
+			}
+			continue;
+		}
+		if(!(p = ethernet_tx_keep(sizeof(struct ip_header) + in_buffer,slice,slices,0,0)))
+		{
+			break;
+		}
+		p->next = 0;
+		if(last)
+		{
+			last->next = p;
+		}
+		else
+		{
+			held = p;
+		}
+		last = p;
+		/* the next fragment is built in the new transmit buffer */
+		memcpy(ethernet_get_buffer(),pbuf_payload(p),sizeof(struct ip_header));
+		ip = (struct ip_header*)ethernet_get_buffer();
+	}
+	if(!next_hop)
+	{
+		return offset >= total;
+	}
+	if(offset < total)
+	{
+		/* not all fragments could be kept, the datagram is dropped */
+		while(held)
+		{
+			p = held->next;
+			pbuf_free(held);
+			held = p;
+		}
+		return 0;
+	}
+	return arp_hold(next_hop,held);
+}
+
+#if HAL_RTX
+/**
+ * Sends packet like ip_send_packet_csum() and keeps it in the network
+ * controller for retransmission
+ * @returns Frame handle or -1 if the packet was not sent
+ */
+int8_t ip_send_packet_rtx(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,uint16_t csum_offset)
+{
+	ethernet_address mac;
+	const ip_address * next_hop;
+	
+	/* kept frames can not wait for the mac address */
+	if(!ip_set_header(ip_dst,route,protocol,length,&mac,&next_hop))
+	{
+		return -1;
+	}
+	return ethernet_send_packet_rtx(&mac,ETHERNET_TYPE_IP,(uint16_t)sizeof(struct ip_header) + length,sizeof(struct ip_header),csum_offset);
+}
+
+int8_t ip_send_gather_rtx(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count,uint16_t csum_offset)
+{
+	ethernet_address mac;
+	const ip_address * next_hop;
+	
+	if(!ip_set_header(ip_dst,route,protocol,length + net_span_len(spans,count),&mac,&next_hop))
+	{
+		return -1;
+	}
+	return ethernet_send_gather_rtx(&mac,ETHERNET_TYPE_IP,(uint16_t)sizeof(struct ip_header) + length,spans,count,sizeof(struct ip_header),csum_offset);
 }
+#endif
+
 
 
+/**
+ * Sends the received packet back to its source, see ip.h
+ */
+uint8_t ip_send_reply(uint16_t head,uint16_t length)
+{
+	struct ip_header * ip = (struct ip_header*)&ethernet_rx_buffer[NET_HEADER_SIZE_ETHERNET];
+	uint8_t header_length = (ip->vihl.header_length & IP_VIHL_HL_MASK)*4;
+	
+	/* the source becomes the destination, the packet may have been
+	 sent to a broadcast or multicast address */
+	memcpy(&ip->dst,&ip->src,sizeof(ip_address));
+	memcpy(&ip->src,ip_get_addr(),sizeof(ip_address));
+	ip->ttl = 64;
+	ip->id = hton16(++ip_id);
+	ip->ffo.flags = 0;
+	ip->length = hton16(header_length + length);
+	/* the header is in memory, compute its checksum again */
+	ip->checksum = hton16(~net_get_checksum(0,(const uint8_t*)ip,header_length,10));
+	
+	return ethernet_send_rx(header_length + length,header_length + head);
+}
+
+/**
+ * Checks if an error may be sent about the received packet and takes a
+ * token for it, see ip.h
+ */
+uint8_t ip_error_allowed(void)
+{
+	const struct ip_header * ip = (const struct ip_header*)&ethernet_rx_buffer[NET_HEADER_SIZE_ETHERNET];
+	uint32_t now = timer_now();
+	uint32_t earned;
+	
+	/* nobody is told about packets to broadcast or multicast addresses,
+	 a source which is not a host or about fragments but the first one */
+	if(memcmp(&ip->dst,ip_get_addr(),sizeof(ip_address)) ||
+		ip_is_broadcast((const ip_address*)&ip->src) ||
+		(ip->src[0] & 0xf0) == 0xe0 ||
+		(ntoh16(ip->ffo.flags) & 0x1fff))
+	{
+		return 0;
+	}
+	earned = (now - ip_error_time) / NET_IP_ERROR_INTERVAL_MS;
+	if(earned >= NET_IP_ERROR_BURST - ip_error_tokens)
+	{
+		ip_error_tokens = NET_IP_ERROR_BURST;
+		ip_error_time = now;
+	}
+	else
+	{
+		ip_error_tokens += earned;
+		ip_error_time += earned * NET_IP_ERROR_INTERVAL_MS;
+	}
+	if(!ip_error_tokens)
+	{
+		return 0;
+	}
+	ip_error_tokens--;
+	return 1;
+}
+
+/**
+ * Copies the header and the first 8 bytes of payload of the received
+ * packet to data, see ip.h
+ */
+uint16_t ip_quote_packet(uint8_t * data)
+{
+	const struct ip_header * ip = (const struct ip_header*)&ethernet_rx_buffer[NET_HEADER_SIZE_ETHERNET];
+	uint16_t length = (ip->vihl.header_length & IP_VIHL_HL_MASK)*4 + 8;
+	
+	if(length > ntoh16(ip->length))
+	{
+		length = ntoh16(ip->length);
+	}
+	ethernet_rx_read(NET_HEADER_SIZE_ETHERNET,data,length);
+	return length;
+}
+
 /**
  *
  */
@@ -316,43 +765,72 @@ uint8_t ip_handle_packet(struct ip_header * header, uint16_t packet_len,const et
 	/* get header length */
 	uint8_t header_length = (header->vihl.header_length & IP_VIHL_HL_MASK)*4;
 	
+	/* options are not part of the headers read first */
+	if(!ethernet_rx_fetch(header,header_length))
+	{
+		return 0;
+	}
+	
 	/* get packet length */
 	uint16_t packet_length = ntoh16(header->length);
 	
 	/* check packet length */
-	if(packet_length > packet_len)
+	if(packet_length > packet_len || packet_length < header_length)
 	{		
 		return 0;
 	}
 
-	/* do not support fragmentation */
-	if(ntoh16(header->ffo.flags) & (IP_FLAGS_MORE_FRAGMENTS << 13) || ntoh16(header->ffo.fragment_offset) & 0x1fff)
-	{
-		return 0;
-	}
-
 	/* check destination ip address */
 	if(memcmp(&header->dst,ip_get_addr(),sizeof(ip_address)))
 	{
 		/* check if this is broadcast packet */
-		if(	header->dst[0] != 0xff ||
+		if(	(header->dst[0] != 0xff ||
 			header->dst[1] != 0xff ||
 			header->dst[2] != 0xff ||
 			header->dst[3] != 0xff)
+#if NET_IP_MULTICAST_GROUPS
+			/* or a datagram to a joined group */
+			&& ((header->dst[0] & 0xf0) != 0xe0 || !ip_multicast_find((const ip_address*)&header->dst))
+#endif
+			)
 		{
 			return 0;
 		}
 	}
 
 	/* check checksum */
-	if(ntoh16(header->checksum) != (~net_get_checksum(0,(const uint8_t*)header,header_length,10)))
+	if(ntoh16(header->checksum) != (uint16_t)(~net_get_checksum(0,(const uint8_t*)header,header_length,10)))
 	{
 		return 0;
 	}
 
-	/* add to arp table if ip does not exist */
-	arp_table_insert((const ip_address*)&header->src,mac);
+	/* add to arp table if ip does not exist, hosts behind the gateway
+	 are not, they would push on-link peers out of the table */
+	if(ip_in_subnet((const ip_address*)&header->src))
+	{
+		arp_table_insert((const ip_address*)&header->src,mac);
+	}
+	
+	/* fragments wait for the rest of their datagram */
+	if(ntoh16(header->ffo.flags) & ((IP_FLAGS_MORE_FRAGMENTS << 13) | 0x1fff))
+	{
+#if NET_IP_REASS_DATAGRAMS
+		return ip_reassemble(header,header_length,packet_length);
+#else
+		return 0;
+#endif
+	}
+	
+	ip_deliver(header,header_length,packet_length);
 	
+	return 0;
+}
+
+/**
+ * Passes payload of the packet to the upper layer
+ */
+static void ip_deliver(struct ip_header * header,uint8_t header_length,uint16_t packet_length)
+{
 	/* redirect packet to the proper upper layer */
 	switch(header->protocol)
 	{
@@ -360,7 +838,7 @@ uint8_t ip_handle_packet(struct ip_header * header, uint16_t packet_len,const et
 		case IP_PROTOCOL_ICMP:
 			icmp_handle_packet(
 				(const ip_address*)&header->src,
-				(const struct icmp_header*)((const uint8_t*)header + header_length),
+				(struct icmp_header*)((uint8_t*)header + header_length),
 				packet_length-header_length);
 			break;
 // #endif //NET_ICMP
@@ -379,11 +857,118 @@ uint8_t ip_handle_packet(struct ip_header * header, uint16_t packet_len,const et
 				packet_length-header_length);
 			break;
 		default:
+#if NET_ICMP
+			/* the sender is told there is nobody for the protocol */
+			if(ip_error_allowed())
+			{
+				icmp_send_unreachable((const ip_address*)&header->src,ICMP_CODE_PROTOCOL_UNREACHABLE);
+			}
+#endif
 			break;
 	}
+}
 
-	return 0;
+#if NET_IP_REASS_DATAGRAMS
+/**
+ * Returns the datagram the fragment belongs to. Datagrams whose fragments
+ * have timed out are dropped, a new one replaces the oldest if there is
+ * no free entry.
+ */
+static struct ip_reass * ip_reass_get(const struct ip_header * header)
+{
+	struct ip_reass * reass;
+	struct ip_reass * entry = 0;
+	uint32_t now = timer_now();
+	
+	FOREACH_IP_REASS(reass)
+	{
+		if(reass->used && (int32_t)(now - reass->expires) >= 0)
+		{
+			reass->used = 0;
+		}
+		if(!reass->used)
+		{
+			if(!entry || entry->used)
+			{
+				entry = reass;
+			}
+			continue;
+		}
+		if(ip_reass_header(reass)->id == header->id &&
+			ip_reass_header(reass)->protocol == header->protocol &&
+			!memcmp(&ip_reass_header(reass)->src,&header->src,sizeof(ip_address)))
+		{
+			return reass;
+		}
+		if(!entry || (entry->used && (int32_t)(reass->expires - entry->expires) < 0))
+		{
+			entry = reass;
+		}
+	}
+	entry->used = 1;
+	entry->expires = now + NET_IP_REASS_TIMEOUT_MS;
+	entry->length = 0;
+	entry->blocks = 0;
+	memset(entry->map,0,sizeof(entry->map));
+	/* options are not kept, the link header is for replies */
+	memcpy(entry->frame,ethernet_rx_buffer,NET_HEADER_SIZE_ETHERNET);
+	memcpy(ip_reass_header(entry),header,sizeof(struct ip_header));
+	ip_reass_header(entry)->vihl.version = (IP_V4 << 4) | (sizeof(struct ip_header) / 4);
+	
+	return entry;
+}
+
+/**
+ * Copies the fragment to its datagram, the datagram is passed to the
+ * upper layer when all its blocks are received
+ */
+static uint8_t ip_reassemble(const struct ip_header * header,uint8_t header_length,uint16_t packet_length)
+{
+	struct ip_reass * reass;
+	uint16_t flags = ntoh16(header->ffo.flags);
+	uint16_t offset = (flags & 0x1fff) * 8;
+	uint16_t length = packet_length - header_length;
+	uint16_t end;
+	uint16_t block;
+	
+	/* the fragment must fit into the buffer, offset + length could wrap,
+	 fragments but the last one carry whole blocks */
+	if(!length || offset >= NET_IP_REASS_SIZE || length > NET_IP_REASS_SIZE - offset ||
+		((flags & (IP_FLAGS_MORE_FRAGMENTS << 13)) && (length & 7)))
+	{
+		return 0;
+	}
+	end = offset + length;
+	reass = ip_reass_get(header);
+	if(!(flags & (IP_FLAGS_MORE_FRAGMENTS << 13)))
+	{
+		reass->length = end;
+	}
+	ethernet_rx_read(ethernet_rx_offset(header) + header_length,&reass->frame[NET_HEADER_SIZE_ETHERNET + sizeof(struct ip_header) + offset],length);
+	for(block = offset / 8 ; block < (end + 7) / 8 ; block++)
+	{
+		if(!(reass->map[block / 8] & (1 << (block & 7))))
+		{
+			reass->map[block / 8] |= 1 << (block & 7);
+			reass->blocks++;
+		}
+	}
+	if(!reass->length || reass->blocks != (reass->length + 7) / 8)
+	{
+		return 1;
+	}
+	/* the datagram is read by upper layers like a received frame */
+	reass->used = 0;
+	length = sizeof(struct ip_header) + reass->length;
+	ip_reass_header(reass)->length = hton16(length);
+	ip_reass_header(reass)->ffo.flags = 0;
+	ethernet_rx_set_frame(reass->frame,NET_HEADER_SIZE_ETHERNET + length);
+	ip_deliver(ip_reass_header(reass),sizeof(struct ip_header),length);
+	ethernet_rx_set_frame(0,0);
+	
+	return 1;
 }
+#endif
 
 /**
  *
@@ -21,6 +21,27 @@
 
 typedef uint8_t ip_address[4];
 
+/**
+ * Destination of a connection, the mac address of its next hop and the
+ * IP header filled for it. Packets sent with the route copy the header
+ * and update its length and checksum.
+ */
+struct ip_route
+{
+	/* ip_route_flush() generation the route was filled in, 0 if it is not */
+	uint16_t generation;
+	/* timer_now() after which the next hop is looked up again */
+	uint32_t until;
+	ethernet_address mac;
+	/* header checksum of the packet with zero length */
+	uint16_t checksum;
+	uint8_t header[NET_HEADER_SIZE_IP];
+};
+
+/**
+ * Marks route as not filled
+ */
+#define ip_route_init(route) ((route)->generation = 0)
 
 /**
  *
@@ -35,6 +56,21 @@ struct ip_header;
  */
 void ip_init(const ip_address * addr,const ip_address * netmask,const ip_address * gateway);
 
+#if NET_IP_MULTICAST_GROUPS
+/**
+ * Joins the multicast group
+ * @param [in] group Multicast address
+ * @return 1 on success, 0 if the group is not multicast, already joined or there is no free entry
+ */
+uint8_t ip_multicast_join(const ip_address * group);
+
+/**
+ * Leaves the multicast group
+ * @param [in] group Multicast address
+ */
+void ip_multicast_leave(const ip_address * group);
+#endif
+
 /**
  */
 const ip_address * ip_get_addr(void);
@@ -65,9 +101,74 @@ const char * ip_addr_str(const ip_address * addr);
 const char * ip_addr_port_str(const ip_address * addr,uint16_t portno);
 
 /**
- *
+ * Makes all routes to be filled again, called when an address which
+ * they were filled with changes
+ */
+void ip_route_flush(void);
+
+/**
+ * Sends packet in the transmit buffer. Route of the connection, if it
+ * is not 0, keeps the header and the next hop for the next packets.
+ */
+uint8_t ip_send_packet(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length);
+
+/**
+ * Sends packet whose checksum at csum_offset of the payload holds the
+ * pseudo header sum and is to be completed over the whole payload
+ */
+uint8_t ip_send_packet_csum(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,uint16_t csum_offset);
+
+/**
+ * Sends packet like ip_send_packet_csum() whose payload is length bytes
+ * in the transmit buffer followed by count spans
+ */
+uint8_t ip_send_gather(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count,uint16_t csum_offset);
+
+/**
+ * Sends packet whose payload is length bytes in the transmit buffer
+ * followed by count spans and whose checksum is complete. If it does
+ * not fit into one packet it is sent in fragments. While the mac address
+ * of the next hop is resolved the fragments wait in packet buffers, the
+ * datagram is dropped if there are not enough of them (see ARP_QUEUE_LEN).
+ */
+uint8_t ip_send_fragments(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count);
+
+/**
+ * Sends the received packet back to its source. Its header is rewritten
+ * in the receive buffer, the upper layer has rewritten the first head
+ * bytes of its payload of length bytes, the rest is sent as received
+ * without passing through the transmit buffer.
+ */
+uint8_t ip_send_reply(uint16_t head,uint16_t length);
+
+/**
+ * Checks if an error reply (TCP reset, ICMP error) may be sent about the
+ * received packet. It may not if the packet has not been sent to our
+ * address by a host or if it is not the first fragment. Replies share a
+ * token bucket, a token is taken if it may.
+ */
+uint8_t ip_error_allowed(void);
+
+/**
+ * Copies the header and the first 8 bytes of payload of the received
+ * packet, which ICMP error messages carry, to data
+ * @returns Number of bytes copied
+ */
+uint16_t ip_quote_packet(uint8_t * data);
+
+#if HAL_RTX
+/**
+ * Sends packet like ip_send_packet_csum() and keeps it in the network
+ * controller, returns handle of the kept frame or -1
+ */
+int8_t ip_send_packet_rtx(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,uint16_t csum_offset);
+
+/**
+ * Sends packet made of spans like ip_send_gather() and keeps it in the
+ * network controller like ip_send_packet_rtx()
  */
-uint8_t ip_send_packet(const ip_address * ip_dst,uint8_t protocol,uint16_t length);
+int8_t ip_send_gather_rtx(const ip_address * ip_dst,struct ip_route * route,uint8_t protocol,uint16_t length,const struct net_span * spans,uint8_t count,uint16_t csum_offset);
+#endif
 
 /**
  *
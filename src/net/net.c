@@ -8,6 +8,9 @@
 
 #include "net.h"
 
+#include <string.h>
+#include <avr/pgmspace.h>
+
 //
 #include "../debug.h"
 
@@ -21,10 +24,300 @@ uint32_t hton32(uint32_t h)
 	return HTON32(h);
 }
 
-#define NET_ROLAND_CHECKSUM		1
+#if NET_CHECKSUM_ASM && defined(__AVR__)
+/**
+ * Adds 16-bit big endian words to the checksum. The carry flag is kept
+ * alive across the whole loop (dec and brne do not touch it), so the carry
+ * out of the high byte is added to the low byte of the next word and the
+ * end-around carry is folded in only once at the end. The main loop
+ * sums 8 bytes per iteration (27 cycles).
+ */
+static uint16_t net_checksum_words(uint16_t checksum,const uint8_t * data,uint8_t blocks,uint8_t words)
+{
+	uint8_t tmp;
+	__asm__ __volatile__(
+		"	clc				\n"
+		"	cpse	%[blocks],__zero_reg__	\n"
+		"	rjmp	1f			\n"
+		"	rjmp	2f			\n"
+		"1:	ld	%[tmp],%a[data]+	\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	dec	%[blocks]		\n"
+		"	brne	1b			\n"
+		"2:	cpse	%[words],__zero_reg__	\n"
+		"	rjmp	3f			\n"
+		"	rjmp	4f			\n"
+		"3:	ld	%[tmp],%a[data]+	\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[data]+	\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	dec	%[words]		\n"
+		"	brne	3b			\n"
+		"4:	adc	%B[sum],__zero_reg__	\n"
+		"	adc	%A[sum],__zero_reg__	\n"
+		"	adc	%B[sum],__zero_reg__	\n"
+		: [sum] "+r" (checksum),
+		  [data] "+e" (data),
+		  [blocks] "+r" (blocks),
+		  [words] "+r" (words),
+		  [tmp] "=&r" (tmp)
+		:
+		: "memory"
+	);
+	return checksum;
+}
+
+static uint16_t net_checksum_add(uint16_t checksum,const uint8_t * data,uint16_t len)
+{
+	/* at most 255 blocks of 8 bytes per call */
+	for(;len >= 0xff << 3; data += 0xff << 3, len -= 0xff << 3)
+	{
+		checksum = net_checksum_words(checksum,data,0xff,0);
+	}
+	checksum = net_checksum_words(checksum,data,len >> 3,(len & 0x7) >> 1);
+	/* last byte is padded with zero */
+	if(len & 1)
+	{
+		uint16_t temp = ((uint16_t)data[len - 1]) << 8;
+		checksum += temp;
+		if(checksum < temp)
+			++checksum;
+	}
+	return checksum;
+}
+/**
+ * The same as net_checksum_words() but data is also copied to dst
+ * (43 cycles per 8 bytes)
+ */
+static uint16_t net_copy_checksum_words(uint16_t checksum,uint8_t * dst,const uint8_t * src,uint8_t blocks,uint8_t words)
+{
+	uint8_t tmp;
+	__asm__ __volatile__(
+		"	clc				\n"
+		"	cpse	%[blocks],__zero_reg__	\n"
+		"	rjmp	1f			\n"
+		"	rjmp	2f			\n"
+		"1:	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	dec	%[blocks]		\n"
+		"	brne	1b			\n"
+		"2:	cpse	%[words],__zero_reg__	\n"
+		"	rjmp	3f			\n"
+		"	rjmp	4f			\n"
+		"3:	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%B[sum],%[tmp]		\n"
+		"	ld	%[tmp],%a[src]+		\n"
+		"	st	%a[dst]+,%[tmp]		\n"
+		"	adc	%A[sum],%[tmp]		\n"
+		"	dec	%[words]		\n"
+		"	brne	3b			\n"
+		"4:	adc	%B[sum],__zero_reg__	\n"
+		"	adc	%A[sum],__zero_reg__	\n"
+		"	adc	%B[sum],__zero_reg__	\n"
+		: [sum] "+r" (checksum),
+		  [dst] "+e" (dst),
+		  [src] "+e" (src),
+		  [blocks] "+r" (blocks),
+		  [words] "+r" (words),
+		  [tmp] "=&r" (tmp)
+		:
+		: "memory"
+	);
+	return checksum;
+}
+
+/**
+ * Copies data and computes ones' complement sum of copied bytes
+ * continuing from checksum, so each byte is loaded only once
+ */
+uint16_t net_copy_checksum(uint8_t * dst,const uint8_t * src,uint16_t len,uint16_t checksum)
+{
+	/* at most 255 blocks of 8 bytes per call */
+	for(;len >= 0xff << 3; dst += 0xff << 3, src += 0xff << 3, len -= 0xff << 3)
+	{
+		checksum = net_copy_checksum_words(checksum,dst,src,0xff,0);
+	}
+	checksum = net_copy_checksum_words(checksum,dst,src,len >> 3,(len & 0x7) >> 1);
+	/* last byte is padded with zero */
+	if(len & 1)
+	{
+		uint16_t temp = ((uint16_t)(dst[len - 1] = src[len - 1])) << 8;
+		checksum += temp;
+		if(checksum < temp)
+			++checksum;
+	}
+	return checksum;
+}
+#else
+/**
+ * Portable version - words are summed into 32-bit accumulator, 8 bytes
+ * per iteration, and carries are folded once at the end
+ */
+static uint16_t net_checksum_add(uint16_t checksum,const uint8_t * data,uint16_t len)
+{
+	uint32_t sum = checksum;
+	
+	for(;len >= 8; data += 8, len -= 8)
+	{
+		sum += MAKEUINT16((uint16_t)data[0],data[1]);
+		sum += MAKEUINT16((uint16_t)data[2],data[3]);
+		sum += MAKEUINT16((uint16_t)data[4],data[5]);
+		sum += MAKEUINT16((uint16_t)data[6],data[7]);
+	}
+	for(;len > 1; data += 2, len -= 2)
+	{
+		sum += MAKEUINT16((uint16_t)data[0],data[1]);
+	}
+	/* last byte is padded with zero */
+	if(len)
+	{
+		sum += ((uint16_t)data[0]) << 8;
+	}
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (uint16_t)sum;
+}
+/**
+ * Copies data and computes ones' complement sum of copied bytes
+ * continuing from checksum. Portable version uses memcpy() which on
+ * targets with data cache is faster than copying in the summing loop.
+ */
+uint16_t net_copy_checksum(uint8_t * dst,const uint8_t * src,uint16_t len,uint16_t checksum)
+{
+	uint32_t sum = checksum;
+	
+	memcpy(dst,src,len);
+	for(;len >= 8; src += 8, len -= 8)
+	{
+		sum += MAKEUINT16((uint16_t)src[0],src[1]);
+		sum += MAKEUINT16((uint16_t)src[2],src[3]);
+		sum += MAKEUINT16((uint16_t)src[4],src[5]);
+		sum += MAKEUINT16((uint16_t)src[6],src[7]);
+	}
+	for(;len > 1; src += 2, len -= 2)
+	{
+		sum += MAKEUINT16((uint16_t)src[0],src[1]);
+	}
+	/* last byte is padded with zero */
+	if(len)
+	{
+		sum += ((uint16_t)src[0]) << 8;
+	}
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (uint16_t)sum;
+}
+#endif //NET_CHECKSUM_ASM
+
+/**
+ * Computes ones' complement sum of the data. The 16-bit word at offset
+ * skip (checksum field within the data) is not summed, skip must be even.
+ * Pass skip >= len to sum all data.
+ */
 uint16_t net_get_checksum(uint16_t checksum,const uint8_t * data,uint16_t len,uint8_t skip)
 {
-#if NET_ROLAND_CHECKSUM
+	if((uint16_t)skip + 2 <= len && !(skip & 1))
+	{
+		checksum = net_checksum_add(checksum,data,skip);
+		data += skip + 2;
+		len -= skip + 2;
+	}
+	return net_checksum_add(checksum,data,len);
+}
+
+/**
+ * Updates checksum field value when 16-bit word covered by the checksum
+ * changes from old_val to new_val (RFC 1624, eqn. 3):
+ * HC' = ~(~HC + ~m + m')
+ */
+uint16_t net_checksum_adjust(uint16_t checksum,uint16_t old_val,uint16_t new_val)
+{
+	uint16_t sum = ~checksum;
+	
+	old_val = ~old_val;
+	sum += old_val;
+	if(sum < old_val)
+		++sum;
+	sum += new_val;
+	if(sum < new_val)
+		++sum;
+	return ~sum;
+}
+
+/**
+ * Updates checksum field value when 32-bit word covered by the checksum
+ * changes (e.g. sequence or acknowledgment number)
+ */
+uint16_t net_checksum_adjust32(uint16_t checksum,uint32_t old_val,uint32_t new_val)
+{
+	checksum = net_checksum_adjust(checksum,(uint16_t)(old_val >> 16),(uint16_t)(new_val >> 16));
+	return net_checksum_adjust(checksum,(uint16_t)old_val,(uint16_t)new_val);
+}
+
+/**
+ * Updates checksum field value when data covered by the checksum is
+ * rewritten (e.g. addresses). Data must start at even offset from the
+ * beginning of checksummed data and len must be even.
+ */
+uint16_t net_checksum_adjust_data(uint16_t checksum,const uint8_t * old_data,const uint8_t * new_data,uint8_t len)
+{
+	for(;len > 1; len -= 2, old_data += 2, new_data += 2)
+	{
+		checksum = net_checksum_adjust(checksum,
+			MAKEUINT16((uint16_t)old_data[0],old_data[1]),
+			MAKEUINT16((uint16_t)new_data[0],new_data[1]));
+	}
+	return checksum;
+}
+
+#if NET_CHECKSUM_REFERENCE
+/**
+ * Previous byte by byte implementation kept as a reference for
+ * testing and benchmarking net_get_checksum()
+ */
+uint16_t net_get_checksum_reference(uint16_t checksum,const uint8_t * data,uint16_t len,uint8_t skip)
+{
 	if(len < 1)
 		return checksum;
 	
@@ -52,26 +345,96 @@ uint16_t net_get_checksum(uint16_t checksum,const uint8_t * data,uint16_t len,ui
 			++checksum;	
 	}
 	return checksum;
-#else
-	if(len < 1)
-		return checksum;
-	const uint8_t * data_skip = &data[skip];
-	uint16_t temp;
-	uint32_t sum=0;
-	while(len > 1)
+}
+#endif //NET_CHECKSUM_REFERENCE
+
+/**
+* Returns total length of the spans
+*/
+uint16_t net_span_len(const struct net_span * spans,uint8_t count)
+{
+	uint16_t len = 0;
+	
+	while(count--)
 	{
-		if(data != data_skip)
+		len += (spans++)->len;
+	}
+	return len;
+}
+
+/**
+* Stores spans of len bytes at offset of the data of the spans in slice
+* @returns number of spans in slice or 0 if more than max are needed
+*/
+uint8_t net_span_slice(const struct net_span * spans,uint8_t count,uint16_t offset,uint16_t len,struct net_span * slice,uint8_t max)
+{
+	uint8_t n = 0;
+	
+	for(; count && len ; count--, spans++)
+	{
+		if(offset >= spans->len)
+		{
+			offset -= spans->len;
+			continue;
+		}
+		if(n == max)
 		{
-			temp = MAKEUINT16((*data),*(data+1));
-			sum += temp;
+			return 0;
 		}
-		data+=2;
-		len -= 2;
+		slice[n].data = spans->data + offset;
+		slice[n].len = spans->len - offset;
+		slice[n].pgm = spans->pgm;
+		if(slice[n].len > len)
+		{
+			slice[n].len = len;
+		}
+		len -= slice[n].len;
+		offset = 0;
+		n++;
 	}
-	if(len > 0)
-		sum += (*data);
-	while((temp = (sum>>16)))
-		sum = (sum & 0xffff) + temp;
-	return (uint16_t)sum;
-#endif
+	return n;
+}
+
+/**
+* Adds data of the spans, which follow each other in the packet, to the
+* checksum. Sum of a span starting at odd offset is swapped.
+*/
+uint16_t net_span_checksum(uint16_t checksum,const struct net_span * spans,uint8_t count)
+{
+	uint8_t odd = 0;
+	uint16_t sum;
+	uint16_t val;
+	uint16_t i;
+	
+	for(; count ; count--, spans++)
+	{
+		if(spans->pgm)
+		{
+			sum = 0;
+			for(i = 0 ; i < spans->len ; i++)
+			{
+				val = pgm_read_byte(spans->data + i);
+				if(!(i & 1))
+				{
+					val <<= 8;
+				}
+				sum += val;
+				if(sum < val)
+					++sum;
+			}
+		}
+		else
+		{
+			sum = net_get_checksum(0,spans->data,spans->len,NET_CHECKSUM_NO_SKIP);
+		}
+		if(odd)
+		{
+			sum = (sum << 8) | (sum >> 8);
+		}
+		checksum += sum;
+		if(checksum < sum)
+			++checksum;
+		odd ^= spans->len & 1;
+	}
+	return checksum;
 }
@@ -11,20 +11,30 @@
 
 #include <stdint.h>
 
+#include "net_config.h"
+
 #define NET_HEADER_SIZE_ETHERNET	14
 #define NET_HEADER_SIZE_IP		20
 #define NET_HEADER_SIZE_UDP		8
 #define NET_HEADER_SIZE_TCP		20
 #define ETHERNET_MAX_PACKET_SIZE	1500
 
-#if BIG_ENDIAN
+#ifndef NET_BIG_ENDIAN
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define NET_BIG_ENDIAN	1
+#else
+#define NET_BIG_ENDIAN	0
+#endif
+#endif
+
+#if NET_BIG_ENDIAN
 #define HTON16(val) (val)
 #define HTON32(val) (val)
 #else
-#define HTON16(val) 	(						\
+#define HTON16(val) 	((uint16_t)(					\
 			(((uint16_t) (val)) << 8) | 			\
 			(((uint16_t) (val)) >> 8)	 		\
-			)
+			))
 #define HTON32(val) 	(						\
 			((((uint32_t) (val)) & 0x000000ff) << 24) |	\
 			((((uint32_t) (val)) & 0x0000ff00) <<	8) | 	\
@@ -45,7 +55,32 @@ uint32_t 	hton32(uint32_t h);
 #define ntoh32(n)	hton32((n))
 
 #define MAKEUINT16(x,y) 	(((x)<<8)|(y)) 
+/* skip value of net_get_checksum() which never excludes a word */
+#define NET_CHECKSUM_NO_SKIP	1
 uint16_t net_get_checksum(uint16_t checksum,const uint8_t * data,uint16_t len,uint8_t skip);
+uint16_t net_copy_checksum(uint8_t * dst,const uint8_t * src,uint16_t len,uint16_t checksum);
+uint16_t net_checksum_adjust(uint16_t checksum,uint16_t old_val,uint16_t new_val);
+uint16_t net_checksum_adjust32(uint16_t checksum,uint32_t old_val,uint32_t new_val);
+uint16_t net_checksum_adjust_data(uint16_t checksum,const uint8_t * old_data,const uint8_t * new_data,uint8_t len);
+
+/**
+* Payload piece of a transmitted packet which is not in the transmit
+* buffer, e.g. data in a fifo or in program memory
+*/
+struct net_span
+{
+	const uint8_t * data;
+	uint16_t len;
+	/* data is stored in program memory */
+	uint8_t pgm;
+};
+
+uint16_t net_span_len(const struct net_span * spans,uint8_t count);
+uint8_t net_span_slice(const struct net_span * spans,uint8_t count,uint16_t offset,uint16_t len,struct net_span * slice,uint8_t max);
+uint16_t net_span_checksum(uint16_t checksum,const struct net_span * spans,uint8_t count);
+#if NET_CHECKSUM_REFERENCE
+uint16_t net_get_checksum_reference(uint16_t checksum,const uint8_t * data,uint16_t len,uint8_t skip);
+#endif
 
 
 #endif //_NET_H
@@ -13,6 +13,40 @@
 #define NET_UDP		1
 #define NET_TCP		1
 
+/* use hand-written assembly checksum loop on AVR */
+#define NET_CHECKSUM_ASM	1
+
+/* build previous checksum implementation for comparison */
+#ifndef NET_CHECKSUM_REFERENCE
+#define NET_CHECKSUM_REFERENCE	0
+#endif
+
+/* let the network controller compute TCP/UDP checksums of outgoing
+ segments carrying at least NET_CHECKSUM_OFFLOAD_MIN data bytes; below
+ that the DMA setup costs more SPI traffic than the AVR spends summing */
+#ifndef NET_CHECKSUM_OFFLOAD
+#define NET_CHECKSUM_OFFLOAD	1
+#endif
+#define NET_CHECKSUM_OFFLOAD_MIN	256
+
+/* number of IP multicast groups which can be joined */
+#define NET_IP_MULTICAST_GROUPS	2
+
+/* datagrams reassembled from fragments at the same time, 0 drops
+ fragments; each takes a buffer of NET_IP_REASS_SIZE bytes in EXMEM */
+#define NET_IP_REASS_DATAGRAMS	1
+/* largest reassembled datagram without the IP header, room for a syslog
+ message of 2048 bytes or a TFTP block of up to 4 KB with its headers */
+#define NET_IP_REASS_SIZE	4128
+/* time the fragments of a datagram wait for the rest */
+#define NET_IP_REASS_TIMEOUT_MS	10000
+
+/* error replies (TCP resets, ICMP errors) are limited by a token bucket
+ of NET_IP_ERROR_BURST tokens, one token is earned every
+ NET_IP_ERROR_INTERVAL_MS */
+#define NET_IP_ERROR_BURST	8
+#define NET_IP_ERROR_INTERVAL_MS	10
+
 #define NET_IP_ADDRESS	{192,168,1,7}
 #define NET_IP_NETMASK	{255,255,255,0}
 #define NET_IP_GATEWAY	{192,168,1,1}
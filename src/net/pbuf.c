@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "pbuf.h"
+#include "../arch/exmem.h"
+
+#include <string.h>
+
+static struct pbuf pbufs[PBUF_COUNT]; // EXMEM
+static struct pbuf_stats pbuf_stats;
+
+#define FOREACH_PBUF(p) for(p = &pbufs[0] ; p < &pbufs[PBUF_COUNT]; p++)
+
+void pbuf_init(void)
+{
+	struct pbuf * p;
+
+	FOREACH_PBUF(p)
+	{
+		p->ref = 0;
+	}
+	memset(&pbuf_stats,0,sizeof(pbuf_stats));
+}
+
+/**
+* Takes a buffer from the pool, it holds one reference
+* @returns 0 if all buffers are in use
+*/
+struct pbuf * pbuf_alloc(void)
+{
+	struct pbuf * p;
+
+	FOREACH_PBUF(p)
+	{
+		if(!p->ref)
+		{
+			p->ref = 1;
+			p->next = 0;
+			p->len = 0;
+			if(++pbuf_stats.used > pbuf_stats.used_max)
+			{
+				pbuf_stats.used_max = pbuf_stats.used;
+			}
+			return p;
+		}
+	}
+	pbuf_stats.alloc_failures++;
+	return 0;
+}
+
+/**
+* Takes another reference to the buffer
+*/
+struct pbuf * pbuf_ref(struct pbuf * p)
+{
+	p->ref++;
+	return p;
+}
+
+/**
+* Drops a reference to the buffer, the last one returns it to the pool
+*/
+void pbuf_free(struct pbuf * p)
+{
+	if(!p || !p->ref)
+	{
+		return;
+	}
+	if(!--p->ref)
+	{
+		pbuf_stats.used--;
+	}
+}
+
+const struct pbuf_stats * pbuf_get_stats(void)
+{
+	return (const struct pbuf_stats*)&pbuf_stats;
+}
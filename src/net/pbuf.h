@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _PBUF_H
+#define _PBUF_H
+
+#include <stdint.h>
+#include "net.h"
+#include "pbuf_config.h"
+
+/**
+* Packet buffer holding a whole Ethernet frame. A buffer is allocated
+* with one reference, every holder which keeps it takes another one with
+* pbuf_ref() and drops it with pbuf_free(), the buffer returns to the
+* pool with the last reference.
+*/
+struct pbuf
+{
+	/* next buffer of a queue, free for the holder's use */
+	struct pbuf * next;
+	/* length of the frame */
+	uint16_t len;
+	uint8_t ref;
+	uint8_t data[PBUF_SIZE];
+};
+
+struct pbuf_stats
+{
+	/* buffers in use and the highest number in use at once */
+	uint8_t used;
+	uint8_t used_max;
+	/* allocations which failed because the pool was empty */
+	uint16_t alloc_failures;
+};
+
+void pbuf_init(void);
+struct pbuf * pbuf_alloc(void);
+struct pbuf * pbuf_ref(struct pbuf * p);
+void pbuf_free(struct pbuf * p);
+const struct pbuf_stats * pbuf_get_stats(void);
+
+/* payload of the frame in the buffer, behind the Ethernet header */
+#define pbuf_payload(p)		(&(p)->data[NET_HEADER_SIZE_ETHERNET])
+
+#endif //_PBUF_H
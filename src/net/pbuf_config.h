@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2026 by agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _PBUF_CONFIG_H
+#define _PBUF_CONFIG_H
+
+/* number of packet buffers, the Ethernet layer holds one for the
+ received and one for the transmitted frame, the rest are for frames
+ which are built besides them or kept for later */
+#define PBUF_COUNT		4
+
+/* size of a packet buffer, a whole Ethernet frame */
+#define PBUF_SIZE		(ETHERNET_MAX_PACKET_SIZE + NET_HEADER_SIZE_ETHERNET)
+
+#endif //_PBUF_CONFIG_H
@@ -17,9 +17,14 @@
 #include "../debug.h"
 
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <avr/pgmspace.h>
 
+/* unacknowledged data is kept in tx fifo unless the network controller
+keeps sent segments */
+#define TCP_TX_FIFO	(!TCP_RTX_CONTROLLER || !HAL_RTX)
+
 /* TCP Flags:
 * URG:	Urgent Pointer field significant
 * ACK:	Acknowledgment field significant
@@ -192,6 +197,24 @@ static const char * tcp_state_chars[] = {
 */
 
 
+#if !TCP_TX_FIFO
+/* Segment sent but not acknowledged yet, the frame is kept in the
+network controller */
+struct tcp_segment
+{
+	uint32_t seq;
+	uint16_t length;
+	int8_t frame;
+};
+
+/* acknowledgment number, data offset, flags and window may change when
+a kept segment is sent again, the checksum which follows them is adjusted
+and they are rewritten together */
+#define TCP_RTX_FIELDS_OFFSET	(NET_HEADER_SIZE_IP + offsetof(struct tcp_header,ack))
+#define TCP_RTX_FIELDS_LEN	(offsetof(struct tcp_header,checksum) - offsetof(struct tcp_header,ack))
+#define TCP_RTX_REWRITE_LEN	(offsetof(struct tcp_header,urgent) - offsetof(struct tcp_header,ack))
+#endif
+
 /* Transmission Control Block */
 struct tcp_tcb
 {
@@ -200,6 +223,8 @@ struct tcp_tcb
 	uint16_t port_local;
 	uint16_t port_remote;
 	ip_address ip_remote;
+	/* next hop and IP header of the segments */
+	struct ip_route route;
 	uint32_t ack;
 	uint32_t seq;
 	uint16_t seq_next;
@@ -208,9 +233,31 @@ struct tcp_tcb
 	timer_t timer;
 	int8_t rtx;
 	struct fifo * fifo_rx;
+#if TCP_TX_FIFO
 	struct fifo * fifo_tx;
+	/* last segment sent from the beginning of tx fifo, its checksum
+	is updated instead of computed again on retransmission */
+	uint32_t rtx_seq;
+	uint32_t rtx_ack;
+	uint16_t rtx_length;
+	uint16_t rtx_window;
+	uint16_t rtx_checksum;
+	uint8_t rtx_flags;
+#else
+	/* sent segments in sequence order */
+	struct tcp_segment segments[TCP_RTX_SEGMENTS];
+	uint8_t segments_count;
+#endif
 };
 
+#if TCP_TX_FIFO
+/* data written and not acknowledged yet */
+#define tcp_tx_length(tcb)	fifo_length((tcb)->fifo_tx)
+#else
+/* everything written has been sent */
+#define tcp_tx_length(tcb)	((tcb)->seq_next)
+#endif
+
 static struct tcp_tcb tcp_tcbs[TCP_MAX_SOCKETS]; // EXMEM
 
 #define FOREACH_TCB(tcb) for(tcb = &tcp_tcbs[0] ; tcb < &tcp_tcbs[TCP_MAX_SOCKETS] ; tcb++)
@@ -220,6 +267,9 @@ static uint8_t 	tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_rem
 static uint8_t 	tcp_send_rst(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length);
 static uint8_t 	tcp_get_options(struct tcp_tcb * tcb,const struct tcp_header * tcp,uint16_t length);
 static uint16_t tcp_get_checksum(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length);
+static uint16_t tcp_get_checksum_data(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t header_length,uint16_t length,uint16_t checksum);
+static uint8_t 	tcp_rx_checksum_valid(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length);
+static uint8_t 	tcp_receive_fast(struct tcp_tcb * tcb,const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length);
 static tcp_socket_t tcp_get_socket_num(struct tcp_tcb * tcb);
 static uint8_t tcp_socket_valid(tcp_socket_t socket);
 static uint8_t tcp_tcb_valid(struct tcp_tcb * tcb);
@@ -232,6 +282,14 @@ static uint16_t tcp_port_find_unused(void);
 static uint8_t tcp_tcb_alloc_fifo(struct tcp_tcb * tcb);
 static void tcp_tcb_free_fifo(struct tcp_tcb * tcb);
 static void tcp_tcb_close(struct tcp_tcb * tcb,tcp_socket_t socket,enum tcp_event event);
+static void tcp_set_header(struct tcp_tcb * tcb,struct tcp_header * tcp,uint8_t flags);
+static uint8_t tcp_tx_rewind(struct tcp_tcb * tcb);
+#if !TCP_TX_FIFO
+static int16_t tcp_send_data(struct tcp_tcb * tcb,const uint8_t * data,uint16_t len,uint8_t pgm);
+static uint8_t tcp_rtx_resend(struct tcp_tcb * tcb);
+static void tcp_rtx_ack(struct tcp_tcb * tcb,uint32_t ack);
+#endif
+static void tcp_rtx_free(struct tcp_tcb * tcb);
 
 void tcp_print_stat(FILE * fh)
 {
@@ -276,8 +334,7 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 				return tcp_send_rst(ip_remote,tcp,length);
 			/* get TCB for new connection */
 			struct tcp_tcb * new_tcb = tcp_tcb_alloc();
-			tcp_tcb_alloc_fifo(new_tcb);
-			if(!new_tcb || !new_tcb->fifo_rx || !new_tcb->fifo_tx)
+			if(!new_tcb || !tcp_tcb_alloc_fifo(new_tcb))
 			{
 				/* if there is no free tcb then maybe remote host will send 
 				 another SYN and then we will have any free slot, so we do not send RST*/
@@ -469,8 +526,13 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 				DBG_INFO("ack in window\n");
 				/* get number of acked bytes */
 				uint16_t acked_bytes = (uint16_t)(rcv_ack - tcb->seq);
+#if TCP_TX_FIFO
 				/* remove acked bytes form tx fifo */
 				fifo_skip(tcb->fifo_tx,acked_bytes);
+#else
+				/* release acked segments kept in the controller */
+				tcp_rtx_ack(tcb,rcv_ack);
+#endif
 	
 				/* update sequence number */
 				tcb->seq += acked_bytes;
@@ -487,9 +549,9 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 				/* send information to user that some data was acknowledged */
 				tcb->callback(socket,tcp_event_data_acked);
 				/* if there is data in tx buffer send it to keep data flowing */
-				DBG_INFO("fifo len %d seq_next %d\n",fifo_length(tcb->fifo_tx),tcb->seq_next);
-				if((fifo_length(tcb->fifo_tx) - tcb->seq_next > 0) 
-				|| (tcb->state == tcp_state_start_close && fifo_length(tcb->fifo_tx)))
+				DBG_INFO("fifo len %d seq_next %d\n",tcp_tx_length(tcb),tcb->seq_next);
+				if((tcp_tx_length(tcb) - tcb->seq_next > 0) 
+				|| (tcb->state == tcp_state_start_close && tcp_tx_length(tcb)))
 				{
 					DBG_INFO("HERE\n");
 					if(!tcp_send_packet(tcb,TCP_FLAG_ACK,1))
@@ -505,6 +567,14 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 					set timer to 1 and continue processing in this state in tcp_timeout*/
 					timer_set(tcb->timer,1, TIMER_MODE_ONE_SHOT);
 				}
+#if !TCP_TX_FIFO
+				else if(tcp_tx_length(tcb))
+				{
+					/* data written in the callback or still not acked 
+					is sent again on timeout */
+					timer_set(tcb->timer,TCP_TIMEOUT_GENERIC, TIMER_MODE_ONE_SHOT);
+				}
+#endif
 				else
 				{
 					/* if there is nothing to send and we are not in start close state 
@@ -555,7 +625,7 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 		}
 		case tcp_state_last_ack:
 		{
-			if(fifo_length(tcb->fifo_tx) == 0 && rcv_ack == tcb->seq + 1)
+			if(tcp_tx_length(tcb) == 0 && rcv_ack == tcb->seq + 1)
 			{
 				tcp_tcb_close(tcb,socket,tcp_event_connection_closed);
 				return 1;
@@ -612,7 +682,7 @@ uint8_t tcp_state_machine(struct tcp_tcb * tcb,const ip_address * ip_remote,cons
 					}
 					DBG_INFO("sending ack = %lx, f=%x\n",tcb->ack,tcp->flags);
 					/* start idle timeout */
-					if(tcb->state == tcp_state_established && fifo_length(tcb->fifo_tx)<1)
+					if(tcb->state == tcp_state_established && tcp_tx_length(tcb)<1)
 						timer_set(tcb->timer,TCP_TIMEOUT_IDLE, TIMER_MODE_ONE_SHOT);
 					/* send information to user that some data have been received */
 					tcb->callback(socket,tcp_event_data_received);
@@ -740,19 +810,23 @@ void tcp_timeout(timer_t timer,void * arg)
 			break;
 		case tcp_state_start_close:
 		case tcp_state_established:
-			if(fifo_length(tcb->fifo_tx) > 0)
+			if(tcp_tx_length(tcb) > 0)
 			{
 				/* send buffered data again*/
-				tcb->seq_next = 0;
 		// 		DBG_INFO("timeout established/start close send\n");
+#if TCP_TX_FIFO
+				tcb->seq_next = 0;
 				if(!tcp_send_packet(tcb,TCP_FLAG_ACK,1))
+#else
+				if(!tcp_rtx_resend(tcb))
+#endif
 				{
 					/* close connection and send error event to user only
 					if there is some error in sending packet but not coused by
 					lack of mac addr in arp table. If there is no remote host of
 					specified ip address there number of retransmissions will be decreased
 					to zero and then the error event will be sent ot user*/
-					if(arp_get_mac((const ip_address*)tcb->ip_remote,NULL))
+					if(arp_get_mac((const ip_address*)tcb->ip_remote,NULL,NULL))
 						tcp_tcb_close(tcb,socket,tcp_event_error);
 					return;
 				}
@@ -775,7 +849,7 @@ void tcp_timeout(timer_t timer,void * arg)
 			}
 			break;
 		case tcp_state_close_wait:
-			tcb->seq_next = 0;
+			tcp_tx_rewind(tcb);
 			if(!tcp_send_packet(tcb,TCP_FLAG_ACK|TCP_FLAG_FIN,1))
 			{
 				tcp_tcb_close(tcb,socket,tcp_event_error);
@@ -804,7 +878,7 @@ void tcp_timeout(timer_t timer,void * arg)
 					break;
 			}
 			/* send FIN again */
-			tcb->seq_next = 0;
+			tcp_tx_rewind(tcb);
 			if(!tcp_send_packet(tcb,TCP_FLAG_FIN|TCP_FLAG_ACK,1))
 			{
 				tcp_tcb_close(tcb,socket,tcp_event_error);
@@ -832,19 +906,7 @@ uint8_t tcp_send_packet(struct tcp_tcb * tcb,uint8_t flags,uint8_t send_data)
 		return 0;
 	struct tcp_header * tcp = (struct tcp_header*)ip_get_buffer();
  
-	memset(tcp,0,sizeof(struct tcp_header));
-	/* set destination port */
-	tcp->port_destination = hton16(tcb->port_remote);
-	/* set source port */
-	tcp->port_source = hton16(tcb->port_local);
-	/* not using urgent */
-	tcp->urgent = HTON16(0x0000);
-	/* set acknowledgment number */
-	tcp->ack = hton32(tcb->ack);
-	/* set flags */
-	tcp->flags = flags;
-	/* set window to buffer free space length */
-	tcp->window = /*hton16(6);*/hton16(fifo_space(tcb->fifo_rx));
+	tcp_set_header(tcb,tcp,flags);
 	uint16_t packet_header_len = sizeof(struct tcp_header);
 	uint16_t max_packet_size = tcp_get_buffer_size();
 	uint8_t * data_ptr = (uint8_t*)tcp + sizeof(struct tcp_header);
@@ -859,6 +921,7 @@ uint8_t tcp_send_packet(struct tcp_tcb * tcb,uint8_t flags,uint8_t send_data)
 	
 	tcp->offset = (packet_header_len>>2)<<4;
 	
+#if TCP_TX_FIFO
 	int16_t tx_data_size = fifo_length(tcb->fifo_tx);
 //	 DBG_INFO("tx=%d\n",tx_data_size);
 //	 tcb->mss = 4;
@@ -884,12 +947,29 @@ uint8_t tcp_send_packet(struct tcp_tcb * tcb,uint8_t flags,uint8_t send_data)
 	uint8_t packet_sent = 1;	
 	uint16_t packet_total_len;
 	uint16_t data_length = 0;
+	uint16_t data_checksum;
 	uint16_t counter = 0;
+	uint8_t offload = 0;
+	struct net_span spans[2];
+	uint8_t span_count = 0;
 	do
 	{
+		data_checksum = 0;
+#if NET_CHECKSUM_OFFLOAD
+		/* let the controller sum large segments after they are written to it */
+		offload = send_data && tx_data_size >= NET_CHECKSUM_OFFLOAD_MIN && max_packet_size >= NET_CHECKSUM_OFFLOAD_MIN;
+		if(offload)
+		{
+			/* the data goes to the controller straight from the fifo */
+			span_count = fifo_peek_spans(tcb->fifo_tx,spans,max_packet_size,tx_data_offset);
+			data_length = net_span_len(spans,span_count);
+		}
+		else
+#endif
 		if(send_data)
 		{
-			 data_length = fifo_peek(tcb->fifo_tx,data_ptr,max_packet_size,tx_data_offset);
+			/* copy data and compute its checksum at once */
+			 data_length = fifo_peek_csum(tcb->fifo_tx,data_ptr,max_packet_size,tx_data_offset,&data_checksum);
 			 //				DBG_INFO("data length = %d\n",data_length);
 		}
 		packet_total_len = data_length + packet_header_len;
@@ -900,8 +980,39 @@ uint8_t tcp_send_packet(struct tcp_tcb * tcb,uint8_t flags,uint8_t send_data)
 			tcp->flags = flags;
 		
 		tcp->seq = hton32(packet_seq);
-		tcp->checksum = hton16(tcp_get_checksum((const ip_address*)&tcb->ip_remote,tcp,packet_total_len));
-		packet_sent = ip_send_packet((const ip_address*)&tcb->ip_remote,IP_PROTOCOL_TCP,packet_total_len);
+		if(offload)
+		{
+			/* pseudo header only, the final checksum is never known here */
+			tcp->checksum = hton16(~tcp_get_checksum_data((const ip_address*)&tcb->ip_remote,tcp,0,packet_total_len,0));
+			tcb->rtx_length = 0;
+		}
+		else if(tx_data_offset == 0 && data_length > 0 && data_length == tcb->rtx_length && packet_seq == tcb->rtx_seq)
+		{
+			/* the same data sent again, only ack, window and flags could change */
+			uint16_t checksum = net_checksum_adjust32(tcb->rtx_checksum,tcb->rtx_ack,tcb->ack);
+			checksum = net_checksum_adjust(checksum,tcb->rtx_window,ntoh16(tcp->window));
+			checksum = net_checksum_adjust(checksum,
+				MAKEUINT16((uint16_t)tcp->offset,tcb->rtx_flags),
+				MAKEUINT16((uint16_t)tcp->offset,tcp->flags));
+			tcp->checksum = hton16(checksum);
+		}
+		else
+		{
+			tcp->checksum = hton16(tcp_get_checksum_data((const ip_address*)&tcb->ip_remote,tcp,packet_header_len,packet_total_len,data_checksum));
+		}
+		if(!offload && tx_data_offset == 0 && data_length > 0)
+		{
+			tcb->rtx_seq = packet_seq;
+			tcb->rtx_ack = tcb->ack;
+			tcb->rtx_length = data_length;
+			tcb->rtx_window = ntoh16(tcp->window);
+			tcb->rtx_flags = tcp->flags;
+			tcb->rtx_checksum = ntoh16(tcp->checksum);
+		}
+		if(offload)
+			packet_sent = ip_send_gather((const ip_address*)&tcb->ip_remote,&tcb->route,IP_PROTOCOL_TCP,packet_header_len,spans,span_count,16);
+		else
+			packet_sent = ip_send_packet_csum((const ip_address*)&tcb->ip_remote,&tcb->route,IP_PROTOCOL_TCP,packet_total_len,0);
 		
 		if(packet_sent)
 		{
@@ -917,9 +1028,192 @@ uint8_t tcp_send_packet(struct tcp_tcb * tcb,uint8_t flags,uint8_t send_data)
 		
 	}while(packet_sent && send_data && tx_data_size > 0);
 	tcb->seq_next = tx_data_offset;
+#else
+	/* data is sent by tcp_write(), only the header follows it */
+	tcp->seq = hton32(tcb->seq + (uint32_t)tcb->seq_next);
+	tcp->checksum = hton16(tcp_get_checksum((const ip_address*)&tcb->ip_remote,tcp,packet_header_len));
+	uint8_t packet_sent = ip_send_packet((const ip_address*)&tcb->ip_remote,&tcb->route,IP_PROTOCOL_TCP,packet_header_len);
+#endif
 	DBG_INFO("send ret\n");
 	return packet_sent;
 }
+
+/**
+ * Fills header of a segment without options in the transmit buffer
+ */
+void tcp_set_header(struct tcp_tcb * tcb,struct tcp_header * tcp,uint8_t flags)
+{
+	memset(tcp,0,sizeof(struct tcp_header));
+	/* set destination port */
+	tcp->port_destination = hton16(tcb->port_remote);
+	/* set source port */
+	tcp->port_source = hton16(tcb->port_local);
+	/* not using urgent */
+	tcp->urgent = HTON16(0x0000);
+	/* set acknowledgment number */
+	tcp->ack = hton32(tcb->ack);
+	/* set flags */
+	tcp->flags = flags;
+	/* set window to buffer free space length */
+	tcp->window = /*hton16(6);*/hton16(fifo_space(tcb->fifo_rx));
+	tcp->offset = (sizeof(struct tcp_header)>>2)<<4;
+}
+
+/**
+ * Makes the next transmission start at the first unacknowledged byte,
+ * segments kept in the controller are sent again at once
+ */
+uint8_t tcp_tx_rewind(struct tcp_tcb * tcb)
+{
+#if TCP_TX_FIFO
+	tcb->seq_next = 0;
+	return 1;
+#else
+	return tcp_rtx_resend(tcb);
+#endif
+}
+
+#if !TCP_TX_FIFO
+/**
+ * Sends data at once in segments which the network controller keeps
+ * until they are acknowledged. Sending stops when the window of the
+ * remote host is full or no more segments can be kept.
+ * @returns Number of bytes sent
+ */
+int16_t tcp_send_data(struct tcp_tcb * tcb,const uint8_t * data,uint16_t len,uint8_t pgm)
+{
+	struct tcp_header * tcp = (struct tcp_header*)ip_get_buffer();
+	uint8_t * data_ptr = (uint8_t*)tcp + sizeof(struct tcp_header);
+	uint16_t max_packet_size = tcp_get_buffer_size();
+	struct tcp_segment * segment;
+	struct net_span span;
+	uint16_t packet_total_len;
+	uint16_t size;
+	int16_t sent = 0;
+	uint8_t offload;
+	int8_t frame;
+	
+	if(max_packet_size > tcb->mss)
+		max_packet_size = tcb->mss;
+	while(len > 0 && tcb->segments_count < TCP_RTX_SEGMENTS)
+	{
+		size = len > max_packet_size ? max_packet_size : len;
+		if(tcb->window > 0)
+		{
+			if(tcb->seq_next >= tcb->window)
+				break;
+			if(size > tcb->window - tcb->seq_next)
+				size = tcb->window - tcb->seq_next;
+		}
+		else if(tcb->seq_next > 0)
+		{
+			/* if window is zero we just send one segment, when it is
+			acked we will update information about window size */
+			break;
+		}
+		tcp_set_header(tcb,tcp,TCP_FLAG_ACK);
+		tcp->seq = hton32(tcb->seq + (uint32_t)tcb->seq_next);
+		packet_total_len = sizeof(struct tcp_header) + size;
+#if NET_CHECKSUM_OFFLOAD
+		offload = size >= NET_CHECKSUM_OFFLOAD_MIN;
+#else
+		offload = 0;
+#endif
+		if(offload)
+		{
+			/* pseudo header only, the controller sums the segment
+			 whose data is written to it straight from the caller */
+			tcp->checksum = hton16(~tcp_get_checksum_data((const ip_address*)&tcb->ip_remote,tcp,0,packet_total_len,0));
+			span.data = data;
+			span.len = size;
+			span.pgm = pgm;
+			frame = ip_send_gather_rtx((const ip_address*)&tcb->ip_remote,&tcb->route,IP_PROTOCOL_TCP,sizeof(struct tcp_header),&span,1,16);
+		}
+		else
+		{
+			if(pgm)
+				memcpy_P(data_ptr,data,size);
+			else
+				memcpy(data_ptr,data,size);
+			tcp->checksum = hton16(tcp_get_checksum((const ip_address*)&tcb->ip_remote,tcp,packet_total_len));
+			frame = ip_send_packet_rtx((const ip_address*)&tcb->ip_remote,&tcb->route,IP_PROTOCOL_TCP,packet_total_len,0);
+		}
+		if(frame < 0)
+			break;
+		segment = &tcb->segments[tcb->segments_count++];
+		segment->seq = tcb->seq + (uint32_t)tcb->seq_next;
+		segment->length = size;
+		segment->frame = frame;
+		tcb->seq_next += size;
+		data += size;
+		len -= size;
+		sent += size;
+	}
+	return sent;
+}
+
+/**
+ * Sends all kept segments again. Only the acknowledgment number and the
+ * window could have changed since they were sent, so just these fields
+ * are rewritten in the controller and the checksum is updated for them.
+ */
+uint8_t tcp_rtx_resend(struct tcp_tcb * tcb)
+{
+	struct tcp_header header;
+	struct tcp_segment * segment;
+	uint8_t fields[TCP_RTX_FIELDS_LEN];
+	uint8_t * new_fields = (uint8_t*)&header.ack;
+	
+	for(segment = &tcb->segments[0] ; segment < &tcb->segments[tcb->segments_count] ; segment++)
+	{
+		ethernet_rtx_read(segment->frame,TCP_RTX_FIELDS_OFFSET,new_fields,TCP_RTX_REWRITE_LEN);
+		memcpy(fields,new_fields,TCP_RTX_FIELDS_LEN);
+		header.ack = hton32(tcb->ack);
+		header.window = hton16(fifo_space(tcb->fifo_rx));
+		header.checksum = hton16(net_checksum_adjust_data(ntoh16(header.checksum),fields,new_fields,TCP_RTX_FIELDS_LEN));
+		if(!ethernet_rtx_resend(segment->frame,TCP_RTX_FIELDS_OFFSET,new_fields,TCP_RTX_REWRITE_LEN))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Releases kept segments which are acknowledged by ack
+ */
+void tcp_rtx_ack(struct tcp_tcb * tcb,uint32_t ack)
+{
+	uint8_t acked = 0;
+	struct tcp_segment * segment = &tcb->segments[0];
+	
+	while(acked < tcb->segments_count && (int32_t)(ack - (segment->seq + segment->length)) >= 0)
+	{
+		ethernet_rtx_free(segment->frame);
+		segment++;
+		acked++;
+	}
+	if(acked)
+	{
+		tcb->segments_count -= acked;
+		memmove(&tcb->segments[0],segment,tcb->segments_count * sizeof(struct tcp_segment));
+	}
+}
+#endif //!TCP_TX_FIFO
+
+/**
+ * Releases all unacknowledged data
+ */
+void tcp_rtx_free(struct tcp_tcb * tcb)
+{
+#if !TCP_TX_FIFO
+	struct tcp_segment * segment;
+	
+	for(segment = &tcb->segments[0] ; segment < &tcb->segments[tcb->segments_count] ; segment++)
+	{
+		ethernet_rtx_free(segment->frame);
+	}
+	tcb->segments_count = 0;
+#endif
+}
 uint8_t tcp_close(tcp_socket_t socket)
 {
 		if(!tcp_socket_valid(socket))
@@ -970,15 +1264,20 @@ void tcp_tcb_reset(struct tcp_tcb * tcb)
 	/* save local port */
 	uint16_t port = tcb->port_local;
 	/* save rx and tx fifo */
+#if TCP_TX_FIFO
 	struct fifo * fifo_tx = tcb->fifo_tx;
+#endif
 	struct fifo * fifo_rx = tcb->fifo_rx;
+	tcp_rtx_free(tcb);
 	memset(tcb,0,sizeof(struct tcp_tcb));
 	tcb->callback = callback;
 	tcb->timer = timer;
 	tcb->state = tcp_state_closed;
 	tcb->port_local = port;
 	tcb->fifo_rx = fifo_rx;
+#if TCP_TX_FIFO
 	tcb->fifo_tx = fifo_tx;
+#endif
 }
 
 
@@ -1069,7 +1368,7 @@ tcp_socket_t tcp_socket_alloc(tcp_socket_callback callback)
 
 tcp_socket_t tcp_get_socket_num(struct tcp_tcb * tcb)
 {
-		tcp_socket_t socket_num = (tcp_socket_t)(((uint16_t)tcb - (uint16_t)tcp_tcbs)/sizeof(struct tcp_tcb));
+		tcp_socket_t socket_num = (tcp_socket_t)(tcb - tcp_tcbs);
 		if(tcp_socket_valid(socket_num))
 			return socket_num;
 		return -1;
@@ -1133,12 +1432,68 @@ uint8_t tcp_connect(tcp_socket_t socket,ip_address * ip,uint16_t port)
 	return 1;
 }
 
+/**
+ * Header prediction: in-order data segment on established connection
+ * which does not acknowledge anything new is put into rx fifo while its
+ * checksum is verified. The segment is the newest one from the remote
+ * host, so the window it advertises is taken too. Returns 0 if segment has to be processed by
+ * tcp_state_machine (also if checksum is invalid).
+ */
+uint8_t tcp_receive_fast(struct tcp_tcb * tcb,const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length)
+{
+	uint8_t data_offset = (tcp->offset>>4)<<2;
+	if(tcb->state != tcp_state_established)
+		return 0;
+	if((tcp->flags & ~TCP_FLAG_PSH) != TCP_FLAG_ACK)
+		return 0;
+	if(data_offset < sizeof(struct tcp_header) || data_offset >= length)
+		return 0;
+	if(ntoh32(tcp->seq) != tcb->ack || ntoh32(tcp->ack) != tcb->seq)
+		return 0;
+	uint16_t data_length = length - data_offset;
+	if(data_length > fifo_space(tcb->fifo_rx))
+		return 0;
+	tcp_socket_t socket = tcp_get_socket_num(tcb);
+	if(socket < 0)
+		return 0;
+	const uint8_t * data = (const uint8_t*)tcp + data_offset;
+	if(ethernet_rx_is_fetched(data,data_length))
+	{
+		/* sum of pseudo header and tcp header including checksum field */
+		uint16_t checksum = ~tcp_get_checksum_data(ip_remote,tcp,data_offset,length,0);
+		checksum = net_get_checksum(checksum,(const uint8_t*)&tcp->checksum,sizeof(tcp->checksum),sizeof(tcp->checksum));
+		/* data is enqueued only if checksum is valid */
+		if(!fifo_enqueue_csum(tcb->fifo_rx,data,data_length,checksum))
+			return 0;
+	}
+	else
+	{
+		/* data is still in the controller, verify it there and 
+		stream it straight into the fifo */
+		if(!tcp_rx_checksum_valid(ip_remote,tcp,length))
+			return 0;
+		if(!fifo_enqueue_stream(tcb->fifo_rx,ethernet_rx_read,ethernet_rx_offset(data),data_length))
+			return 0;
+	}
+	tcb->ack += data_length;
+	/* update remote host window size */
+	tcb->window = ntoh16(tcp->window);
+	if(!tcp_send_packet(tcb,TCP_FLAG_ACK,1))
+	{
+		tcp_tcb_close(tcb,socket,tcp_event_error);
+		return 1;
+	}
+	/* start idle timeout */
+	if(tcp_tx_length(tcb) < 1)
+		timer_set(tcb->timer,TCP_TIMEOUT_IDLE, TIMER_MODE_ONE_SHOT);
+	tcb->callback(socket,tcp_event_data_received);
+	return 1;
+}
+
 uint8_t tcp_handle_packet(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length)
 {
 		if(length < sizeof(struct tcp_header))
 			return 0;
-		if(ntoh16(tcp->checksum) != tcp_get_checksum(ip_remote,tcp,length))
-			return 0;
 		struct tcp_tcb * tcb;
 		struct tcp_tcb * tcb_selected = 0;
 		FOREACH_TCB(tcb)
@@ -1159,8 +1514,18 @@ uint8_t tcp_handle_packet(const ip_address * ip_remote,const struct tcp_header *
 			tcb_selected = tcb;
 			break;
 		}
+		/* options are not part of the headers read first */
+		if(!ethernet_rx_fetch(tcp,(tcp->offset>>4)<<2))
+			return 0;
+		if(tcb_selected != 0 && tcp_receive_fast(tcb_selected,ip_remote,tcp,length))
+			return 1;
+		if(!tcp_rx_checksum_valid(ip_remote,tcp,length))
+			return 0;
 		if(tcb_selected != 0)
+		{
+			ethernet_rx_fetch(tcp,length);
 			return tcp_state_machine(tcb_selected,ip_remote,tcp,length); 
+		}
 		tcp_send_rst(ip_remote,tcp,length);
 		return 0;
 }
@@ -1174,6 +1539,9 @@ uint8_t tcp_send_rst(const ip_address * ip_remote,const struct tcp_header * tcp_
 		return 0;
 	if(tcp_rcv->flags & TCP_FLAG_RST)
 		return 0;
+	/* resets share the rate limit of error replies */
+	if(!ip_error_allowed())
+		return 0;
 	struct tcp_header * tcp_rst = (struct tcp_header*)ip_get_buffer();
 	memset(tcp_rst,0,sizeof(struct tcp_header));
 	tcp_rst->port_destination = tcp_rcv->port_source;
@@ -1201,9 +1569,30 @@ uint8_t tcp_send_rst(const ip_address * ip_remote,const struct tcp_header * tcp_
 		tcp_rst->ack = hton32(ack);
 	}
 	tcp_rst->checksum = hton16(tcp_get_checksum(ip_remote,tcp_rst,sizeof(struct tcp_header)));
-	return ip_send_packet(ip_remote,IP_PROTOCOL_TCP,sizeof(struct tcp_header));
+	return ip_send_packet(ip_remote,0,IP_PROTOCOL_TCP,sizeof(struct tcp_header));
 }
 uint16_t tcp_get_checksum(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length)
+{
+	return tcp_get_checksum_data(ip_remote,tcp,length,length,0);
+}
+
+/**
+ * Verifies checksum of received segment, the part of the segment which
+ * has not been fetched from the controller is summed there
+ */
+uint8_t tcp_rx_checksum_valid(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t length)
+{
+	/* pseudo header only */
+	uint16_t checksum = ~tcp_get_checksum_data(ip_remote,tcp,0,length,0);
+	
+	return ethernet_rx_checksum(checksum,tcp,length) == 0xffff;
+}
+
+/**
+ * Computes checksum of the segment of which only first header_length
+ * bytes are summed here, the sum of the rest of data is passed in checksum
+ */
+uint16_t tcp_get_checksum_data(const ip_address * ip_remote,const struct tcp_header * tcp,uint16_t header_length,uint16_t length,uint16_t checksum)
 {
     /* tcp pseudo header :
              +--------+--------+--------+--------+
@@ -1215,14 +1604,17 @@ uint16_t tcp_get_checksum(const ip_address * ip_remote,const struct tcp_header *
              +--------+--------+--------+--------+
     */
     /* PTCL + TCP length */
-	uint16_t checksum = IP_PROTOCOL_TCP + length;
+	uint16_t temp = IP_PROTOCOL_TCP + length;
+	checksum += temp;
+	if(checksum < temp)
+		++checksum;
 	/* source/destination ip address */
 	checksum = net_get_checksum(checksum,(const uint8_t*)ip_remote,sizeof(ip_address),4);
 	/* our ip address */
 	checksum = net_get_checksum(checksum,(const uint8_t*)ip_get_addr(),sizeof(ip_address),4);
 	
-	/* TCP header + data */
-	return ~net_get_checksum(checksum,(const uint8_t*)tcp,length,16);
+	/* TCP header (+ data) */
+	return ~net_get_checksum(checksum,(const uint8_t*)tcp,header_length,16);
 }
 
 uint16_t tcp_get_remote_port(tcp_socket_t socket)
@@ -1252,6 +1644,7 @@ uint8_t tcp_tcb_alloc_fifo(struct tcp_tcb * tcb)
 		if(!tcp_tcb_valid(tcb))
 			return 0;
 		tcb->fifo_rx = fifo_alloc();
+#if TCP_TX_FIFO
 		tcb->fifo_tx = fifo_alloc();
 		if(tcb->fifo_rx == 0 || tcb->fifo_tx == 0)
 		{
@@ -1259,6 +1652,10 @@ uint8_t tcp_tcb_alloc_fifo(struct tcp_tcb * tcb)
 			fifo_free(tcb->fifo_tx);
 			return 0;
 		}
+#else
+		if(tcb->fifo_rx == 0)
+			return 0;
+#endif
 		return 1;
 }
 uint8_t tcp_tcb_valid(struct tcp_tcb * tcb)
@@ -1269,9 +1666,11 @@ uint8_t tcp_tcb_valid(struct tcp_tcb * tcb)
 void tcp_tcb_free_fifo(struct tcp_tcb * tcb)
 {
 		fifo_free(tcb->fifo_rx);
-		fifo_free(tcb->fifo_tx);
 		tcb->fifo_rx = 0;
+#if TCP_TX_FIFO
+		fifo_free(tcb->fifo_tx);
 		tcb->fifo_tx = 0;
+#endif
 }
 int16_t tcp_read(tcp_socket_t socket,uint8_t * data,uint16_t maxlen)
 {
@@ -1282,6 +1681,20 @@ int16_t tcp_read(tcp_socket_t socket,uint8_t * data,uint16_t maxlen)
 		return fifo_dequeue(tcb->fifo_rx,data,maxlen);
 }
 
+#if !TCP_TX_FIFO
+/**
+ * Starts retransmission timer when sent data is the first in flight
+ */
+static void tcp_write_sent(struct tcp_tcb * tcb,int16_t sent)
+{
+	if(sent > 0 && tcb->seq_next == (uint16_t)sent)
+	{
+		tcb->rtx = TCP_RTX_DATA;
+		timer_set(tcb->timer,TCP_TIMEOUT_GENERIC, TIMER_MODE_ONE_SHOT);
+	}
+}
+#endif
+
 int16_t tcp_write(tcp_socket_t socket,const uint8_t * data,uint16_t len)
 {
 	if(!tcp_socket_valid(socket))
@@ -1291,6 +1704,7 @@ int16_t tcp_write(tcp_socket_t socket,const uint8_t * data,uint16_t len)
 		return -1;	
 	if(len > INT16_MAX)
 		len = INT16_MAX;
+#if TCP_TX_FIFO
 	int16_t ret = fifo_enqueue(tcb->fifo_tx,data,len);
 	if(fifo_length(tcb->fifo_tx) > 0)
 	{
@@ -1298,6 +1712,10 @@ int16_t tcp_write(tcp_socket_t socket,const uint8_t * data,uint16_t len)
 		timer_set(tcb->timer,1, TIMER_MODE_ONE_SHOT);
 //		 tcp_timeout(tcb->timer,(void*)tcb);
 	}
+#else
+	int16_t ret = tcp_send_data(tcb,data,len,0);
+	tcp_write_sent(tcb,ret);
+#endif
 	return ret;
 }
 
@@ -1310,12 +1728,17 @@ int16_t tcp_write_P(tcp_socket_t socket,const prog_uint8_t * data,uint16_t len)
 		return -1;
 	if(len > INT16_MAX)
 		len = INT16_MAX;
+#if TCP_TX_FIFO
 	int16_t ret = fifo_enqueue_P(tcb->fifo_tx,data,len);
 	if(fifo_length(tcb->fifo_tx) > 0)
 	{
 		tcb->rtx = TCP_RTX_DATA;
 		timer_set(tcb->timer,1, TIMER_MODE_ONE_SHOT);
 	}
+#else
+	int16_t ret = tcp_send_data(tcb,(const uint8_t*)data,len,1);
+	tcp_write_sent(tcb,ret);
+#endif
 	return ret;
 }
 int16_t tcp_write_string_P(tcp_socket_t socket,const prog_char * string)
@@ -1325,6 +1748,7 @@ int16_t tcp_write_string_P(tcp_socket_t socket,const prog_char * string)
 
 void tcp_tcb_close(struct tcp_tcb * tcb,tcp_socket_t socket,enum tcp_event event)
 {
+	tcp_rtx_free(tcb);
 	tcb->state = tcp_state_closed;
 	timer_stop(tcb->timer);
 	tcb->callback(socket,event);
@@ -1336,6 +1760,7 @@ void tcp_tcb_free(struct tcp_tcb * tcb)
 		return;
 	timer_free(tcb->timer);
 	tcp_tcb_free_fifo(tcb);
+	tcp_rtx_free(tcb);
 	tcb->state = tcp_state_unused;
-	memset(tcb,0,0x1f);
+	memset(tcb,0,sizeof(struct tcp_tcb));
 }
@@ -28,5 +28,11 @@
 #define TCP_RTX_DATA		10
 #define TCP_RTX_FIN		5
 
+/* keep sent but unacknowledged data in the network controller if it can
+do so, tcp_write() then sends data at once and connections need no tx fifo */
+#define TCP_RTX_CONTROLLER	1
+/* unacknowledged segments per connection kept in the controller */
+#define TCP_RTX_SEGMENTS	4
+
 
 #endif //_TCP_CONFIG_H
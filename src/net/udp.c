@@ -7,6 +7,7 @@
  */
 
 #include "udp.h"
+#include "icmp.h"
 
 #if NET_UDP
 
@@ -38,21 +39,43 @@ struct udp_header
 
 struct udp_socket
 {
-	udp_socket_callback callback;
+	/* set for allocated sockets */
+	union
+	{
+		udp_socket_callback callback;
+		udp_socket_callback_from callback_from;
+	};
+	/* the socket is not bound to the source of received datagrams, its
+	 callback is callback_from */
+	uint8_t connectionless;
 	uint16_t port_local;
 	uint16_t port_remote;
 	ip_address ip_remote;
+	/* next hop and IP header of the datagrams */
+	struct ip_route route;
+	/* next socket whose local port is in the same bucket, -1 ends the chain */
+	udp_socket_t next;
 };
 
 static struct udp_socket udp_sockets[UDP_SOCKET_MAX]; // EXMEM
+/* first socket of each bucket of local ports, -1 if there is none */
+static udp_socket_t udp_hash[UDP_HASH_SIZE]; // EXMEM
+/* next candidate for an ephemeral local port */
+static uint16_t udp_port_next;
 
 #define FOREACH_UDP_SOCKET(socket) for((socket) = &udp_sockets[0] ; (socket) < &udp_sockets[UDP_SOCKET_MAX] ; (socket)++)
+#define UDP_HASH(port)	(((port) ^ ((port) >> 8)) & (UDP_HASH_SIZE - 1))
 
 uint16_t 	udp_get_checksum(const ip_address * ip_addr,const struct udp_header * udp,uint16_t packet_len);
+uint16_t 	udp_get_checksum_data(const ip_address * ip_addr,const struct udp_header * udp,uint16_t data_len,uint16_t packet_len);
 uint8_t 	udp_is_free_port(uint16_t port);
 udp_socket_t 	udp_socket_num(struct udp_socket * socket);
 uint8_t 	udp_socket_is_valid(udp_socket_t socket);
 uint16_t 	udp_get_free_local_port(void);
+static struct udp_socket * udp_socket_lookup(uint16_t port);
+static void	udp_hash_add(udp_socket_t socket_num);
+static void	udp_hash_remove(udp_socket_t socket_num);
+static uint8_t	udp_rx_checksum_valid(const ip_address * ip_remote,const struct udp_header * udp,uint16_t packet_len);
 
 void udp_print_stat(FILE * fh)
 {
@@ -76,9 +99,59 @@ void udp_print_stat(FILE * fh)
 uint8_t udp_init(void)
 {
 	memset(udp_sockets,0,sizeof(udp_sockets));
+	memset(udp_hash,-1,sizeof(udp_hash));
+	udp_port_next = UDP_PORT_EPHEMERAL_FIRST;
 
 	return 1;
 }
+
+/**
+* Returns the socket bound to the local port or 0
+*/
+static struct udp_socket * udp_socket_lookup(uint16_t port)
+{
+	udp_socket_t socket_num = udp_hash[UDP_HASH(port)];
+	
+	while(socket_num >= 0)
+	{
+		if(udp_sockets[socket_num].port_local == port)
+		{
+			return &udp_sockets[socket_num];
+		}
+		socket_num = udp_sockets[socket_num].next;
+	}
+	return 0;
+}
+
+/**
+* Puts the socket into the bucket of its local port
+*/
+static void udp_hash_add(udp_socket_t socket_num)
+{
+	struct udp_socket * socket = &udp_sockets[socket_num];
+	uint8_t bucket = UDP_HASH(socket->port_local);
+	
+	socket->next = udp_hash[bucket];
+	udp_hash[bucket] = socket_num;
+}
+
+/**
+* Takes the socket out of the bucket of its local port
+*/
+static void udp_hash_remove(udp_socket_t socket_num)
+{
+	udp_socket_t * link = &udp_hash[UDP_HASH(udp_sockets[socket_num].port_local)];
+	
+	while(*link >= 0)
+	{
+		if(*link == socket_num)
+		{
+			*link = udp_sockets[socket_num].next;
+			return;
+		}
+		link = &udp_sockets[*link].next;
+	}
+}
 uint8_t udp_socket_is_valid(udp_socket_t socket)
 {
 	return (socket >= 0 && socket < UDP_SOCKET_MAX);
@@ -90,7 +163,7 @@ udp_socket_t udp_socket_num(struct udp_socket * socket)
 		return -1;
 	}
 
-	udp_socket_t socket_num = (udp_socket_t)(((uint16_t)socket - (uint16_t)udp_sockets)/sizeof(struct udp_socket));
+	udp_socket_t socket_num = (udp_socket_t)(socket - udp_sockets);
 	
 	if(udp_socket_is_valid(socket_num))
 	{
@@ -140,6 +213,7 @@ udp_socket_t udp_socket_alloc(uint16_t local_port,udp_socket_callback callback)
 		memset(socket,0,sizeof(struct udp_socket));
 		socket->callback = callback;
 		socket->port_local = local_port;
+		udp_hash_add(socket_num);
 		
 		return socket_num;
 	}
@@ -147,30 +221,45 @@ udp_socket_t udp_socket_alloc(uint16_t local_port,udp_socket_callback callback)
 	return socket_num;
 }
 
-void udp_socket_free(udp_socket_t socket_num)
+/**
+* Allocates connectionless socket. Datagrams from any source are passed
+* to the callback with their source address, the socket is not bound to
+* it. Replies are sent with udp_sendto().
+*/
+udp_socket_t udp_socket_alloc_from(uint16_t local_port,udp_socket_callback_from callback)
 {
-	if(udp_socket_is_valid(socket_num))
+	udp_socket_t socket_num = udp_socket_alloc(local_port,(udp_socket_callback)callback);
+	
+	if(socket_num >= 0)
 	{
-		memset(&udp_sockets[socket_num],0,sizeof(struct udp_socket));
+		udp_sockets[socket_num].connectionless = 1;
 	}
+	return socket_num;
 }
 
-uint8_t udp_is_free_port(uint16_t port)
+void udp_socket_free(udp_socket_t socket_num)
 {
-	struct udp_socket * socket;
-	
-	FOREACH_UDP_SOCKET(socket)
+	if(udp_socket_is_valid(socket_num) && udp_sockets[socket_num].callback)
 	{
-		if(socket->callback != 0 && socket->port_local == port)
-		{
-			return 0;
-		}
+		udp_hash_remove(socket_num);
+		memset(&udp_sockets[socket_num],0,sizeof(struct udp_socket));
 	}
+}
 
-	return 1;
+uint8_t udp_is_free_port(uint16_t port)
+{
+	return udp_socket_lookup(port) == 0;
 }
 
 uint16_t udp_get_checksum(const ip_address * ip_addr,const struct udp_header * udp,uint16_t packet_len)
+{
+	return udp_get_checksum_data(ip_addr,udp,packet_len,packet_len);
+}
+
+/**
+* Computes checksum over pseudo header and data_len bytes of the packet
+*/
+uint16_t udp_get_checksum_data(const ip_address * ip_addr,const struct udp_header * udp,uint16_t data_len,uint16_t packet_len)
 {
 	/* UDP pseudo header = ip protocol + total udp packet length (header+data) + dst ip + src ip
 	*	0      7 8     15 16    23 24    31 
@@ -187,7 +276,7 @@ uint16_t udp_get_checksum(const ip_address * ip_addr,const struct udp_header * u
 	checksum = net_get_checksum(checksum,(const uint8_t*)ip_get_addr(),sizeof(ip_address),4);
 	checksum = net_get_checksum(checksum,(const uint8_t*)ip_addr,sizeof(ip_address),4);
 	/* udp header + data */
-	checksum = net_get_checksum(checksum,(const uint8_t*)udp,packet_len,6);
+	checksum = net_get_checksum(checksum,(const uint8_t*)udp,data_len,6);
 	
 	return ~checksum;
 }
@@ -198,11 +287,6 @@ uint8_t udp_handle_packet(const ip_address * ip_remote,const struct udp_header *
 	{
 		return 0;
 	}
-	/*check checksum */
-	if(udp_get_checksum(ip_remote,udp,packet_len) != ntoh16(udp->checksum))
-	{
-		return 0;
-	}
 	/* get local port number */
 	uint16_t port_local = ntoh16(udp->port_destination);
 	/* get remote port number */
@@ -213,21 +297,21 @@ uint8_t udp_handle_packet(const ip_address * ip_remote,const struct udp_header *
 		return 0;
 	}
 
-	struct udp_socket * socket;
+	/* only one socket is bound to a local port */
+	struct udp_socket * socket = udp_socket_lookup(port_local);
 	
-	udp_socket_t socket_num = -1;
+	udp_socket_t socket_num = udp_socket_num(socket);
 	
-	FOREACH_UDP_SOCKET(socket)
+	do
 	{
-		/* check if socket is used and if whether packet is directed to this one*/
-		if(socket->callback == 0 || socket->port_local != port_local)
+		if(socket_num < 0)
 		{
-			continue;
+			break;
 		}
 		/* if socket has remote port binded check if is equal to src port*/
 		if(socket->port_remote != 0 && socket->port_remote != port_remote)
 		{
-			continue;
+			break;
 		}
 		/* if socket has remote ip binded check if is equal to src ip*/
 		if((socket->ip_remote[0] | 
@@ -235,14 +319,23 @@ uint8_t udp_handle_packet(const ip_address * ip_remote,const struct udp_header *
 			socket->ip_remote[2] |
 			socket->ip_remote[3]) != 0x00 && memcmp(&socket->ip_remote,ip_remote,sizeof(ip_address)) != 0)
 		{
-			continue;
+			break;
 		}
-		/* get socket_number */
-		socket_num = udp_socket_num(socket);
-		
-		if(socket_num < 0)
+		/* data is fetched and checked only if there is a socket for it */
+		if(!ethernet_rx_fetch(udp,packet_len))
 		{
-			continue;
+			return 0;
+		}
+		/*check checksum */
+		if(udp_get_checksum(ip_remote,udp,packet_len) != ntoh16(udp->checksum))
+		{
+			return 0;
+		}
+		if(socket->connectionless)
+		{
+			socket->callback_from(socket_num,ip_remote,port_remote,(uint8_t*)udp + sizeof(struct udp_header),packet_len-sizeof(struct udp_header));
+			
+			return 1;
 		}
 		/* bind remote port and ip to socket so it can get this values later if needed */
 		memcpy(&socket->ip_remote,ip_remote,sizeof(ip_address));
@@ -251,10 +344,34 @@ uint8_t udp_handle_packet(const ip_address * ip_remote,const struct udp_header *
 		socket->callback(socket_num,(uint8_t*)udp + sizeof(struct udp_header),packet_len-sizeof(struct udp_header));
 
 		return 1;
+	}while(0);
+#if NET_ICMP
+	/* nobody listens on the port, the sender of a valid datagram is told
+	 so instead of waiting for a reply */
+	if(udp_rx_checksum_valid(ip_remote,udp,packet_len) && ip_error_allowed())
+	{
+		icmp_send_unreachable(ip_remote,ICMP_CODE_PORT_UNREACHABLE);
 	}
-
+#endif
 	return 0;
 }
+
+/**
+ * Verifies checksum of received datagram without fetching it, the
+ * controller sums the part which has not been fetched
+ */
+static uint8_t udp_rx_checksum_valid(const ip_address * ip_remote,const struct udp_header * udp,uint16_t packet_len)
+{
+	/* the sender has not computed it */
+	if(!udp->checksum)
+	{
+		return 1;
+	}
+	/* pseudo header only */
+	uint16_t checksum = ~udp_get_checksum_data(ip_remote,udp,0,packet_len);
+	
+	return ethernet_rx_checksum(checksum,udp,packet_len) == 0xffff;
+}
 uint8_t udp_bind_remote(udp_socket_t socket,uint16_t remote_port,const ip_address * remote_ip)
 {
 	if(!udp_socket_is_valid(socket))
@@ -301,40 +418,70 @@ uint8_t udp_bind_local(udp_socket_t socket,uint16_t local_port)
 		return 1;
 	}
 
-	if(!udp_is_free_port(local_port))
+	if(!s->callback || !udp_is_free_port(local_port))
 	{
 		return 0;
 	}
 
+	udp_hash_remove(socket);
 	s->port_local = local_port;
+	udp_hash_add(socket);
 	
 	return 1;
 }
 
+/**
+* Returns the local port of the socket, 0 if the socket is not valid
+*/
+uint16_t udp_get_local_port(udp_socket_t socket)
+{
+	if(!udp_socket_is_valid(socket))
+	{
+		return 0;
+	}
+	return udp_sockets[socket].port_local;
+}
+
+/**
+* Returns the next free ephemeral port. The ports are given out in turn
+* so that a port is not reused right after it has been freed.
+*/
 uint16_t udp_get_free_local_port(void)
 {
-	uint16_t port = 1024;
+	uint16_t port;
 	
 	do
 	{
-		port++;
-	}while(!udp_is_free_port(port) && port !=0); 
+		port = udp_port_next;
+		udp_port_next = (port == UDP_PORT_EPHEMERAL_LAST) ? UDP_PORT_EPHEMERAL_FIRST : port + 1;
+	}while(!udp_is_free_port(port));
 	
 	return port;
 }
 uint8_t udp_send(udp_socket_t socket_num,uint16_t length)
 {
-	if(length < 0 || !udp_socket_is_valid(socket_num))
+	if(!udp_socket_is_valid(socket_num))
 	{
 		return 0;
 	}
 
 	struct udp_socket * socket = &udp_sockets[socket_num];
 
-	if(socket->port_remote < 1)
+	return udp_sendto(socket_num,(const ip_address*)&socket->ip_remote,socket->port_remote,length);
+}
+
+/**
+* Sends datagram of length bytes in the buffer to port_remote at
+* ip_remote, the socket stays bound as it is
+*/
+uint8_t udp_sendto(udp_socket_t socket_num,const ip_address * ip_remote,uint16_t port_remote,uint16_t length)
+{
+	if(!udp_socket_is_valid(socket_num) || port_remote < 1)
 	{
 		return 0;
 	}
+
+	struct udp_socket * socket = &udp_sockets[socket_num];
 	
 	uint16_t packet_max_length = ip_get_buffer_size() - sizeof(struct udp_header);
 	
@@ -347,12 +494,59 @@ uint8_t udp_send(udp_socket_t socket_num,uint16_t length)
 	
 	struct udp_header * udp = (struct udp_header*)ip_get_buffer();
 	
+	udp->length = hton16(length);
+	udp->port_destination = hton16(port_remote);
+	udp->port_source = hton16(socket->port_local);
+#if NET_CHECKSUM_OFFLOAD
+	if(length >= sizeof(struct udp_header) + NET_CHECKSUM_OFFLOAD_MIN)
+	{
+		/* pseudo header only, the controller sums the datagram */
+		udp->checksum = hton16(~udp_get_checksum_data(ip_remote,udp,0,length));
+		return ip_send_packet_csum(ip_remote,&socket->route,IP_PROTOCOL_UDP,length,6);
+	}
+#endif
+	udp->checksum = hton16(udp_get_checksum(ip_remote,udp,length));
+	
+	return ip_send_packet(ip_remote,&socket->route,IP_PROTOCOL_UDP,length);
+}
+
+/**
+* Sends datagram whose data are the spans (e.g. a buffer or pieces of a
+* fifo), it is sent in IP fragments if it does not fit into one packet
+*/
+uint8_t udp_send_gather(udp_socket_t socket_num,const struct net_span * spans,uint8_t count)
+{
+	if(!udp_socket_is_valid(socket_num))
+	{
+		return 0;
+	}
+
+	struct udp_socket * socket = &udp_sockets[socket_num];
+	uint32_t length = sizeof(struct udp_header) + (uint32_t)net_span_len(spans,count);
+	uint16_t checksum;
+
+	if(socket->port_remote < 1 || length > 0xffff)
+	{
+		return 0;
+	}
+	
+	struct udp_header * udp = (struct udp_header*)ip_get_buffer();
+	
 	udp->length = hton16(length);
 	udp->port_destination = hton16(socket->port_remote);
 	udp->port_source = hton16(socket->port_local);
-	udp->checksum = hton16(udp_get_checksum((const ip_address*)&socket->ip_remote,udp,length));
+	/* fragments are not checked by the controller, the checksum is complete */
+	checksum = ~udp_get_checksum_data((const ip_address*)&socket->ip_remote,udp,sizeof(struct udp_header),length);
+	udp->checksum = hton16(~net_span_checksum(checksum,spans,count));
+	
+	return ip_send_fragments((const ip_address*)&socket->ip_remote,&socket->route,IP_PROTOCOL_UDP,sizeof(struct udp_header),spans,count);
+}
+
+uint8_t udp_send_data(udp_socket_t socket,const uint8_t * data,uint16_t length)
+{
+	struct net_span span = {data,length,0};
 	
-	return ip_send_packet((const ip_address*)&socket->ip_remote,IP_PROTOCOL_UDP,length);
+	return udp_send_gather(socket,&span,1);
 }
 
 #endif //NET_UDP
@@ -19,6 +19,10 @@
 typedef int8_t udp_socket_t;
 
 typedef void (*udp_socket_callback)(udp_socket_t socket,uint8_t * data,uint16_t length);
+/**
+ * Callback of connectionless sockets, it gets the source of each datagram
+ */
+typedef void (*udp_socket_callback_from)(udp_socket_t socket,const ip_address * ip_remote,uint16_t port_remote,uint8_t * data,uint16_t length);
 
 struct udp_header;
 
@@ -31,12 +35,17 @@ uint8_t udp_handle_packet(const ip_address * ip_remote,const struct udp_header *
 
 
 udp_socket_t udp_socket_alloc(uint16_t local_port,udp_socket_callback callback);
+udp_socket_t udp_socket_alloc_from(uint16_t local_port,udp_socket_callback_from callback);
 void udp_socket_free(udp_socket_t socket);
 
 uint8_t udp_send(udp_socket_t socket,uint16_t length);
+uint8_t udp_sendto(udp_socket_t socket,const ip_address * ip_remote,uint16_t port_remote,uint16_t length);
+uint8_t udp_send_gather(udp_socket_t socket,const struct net_span * spans,uint8_t count);
+uint8_t udp_send_data(udp_socket_t socket,const uint8_t * data,uint16_t length);
 uint8_t udp_bind_remote(udp_socket_t socket,uint16_t remote_port,const ip_address * remote_ip);
 uint8_t udp_unbind_remote(udp_socket_t socket);
 uint8_t udp_bind_local(udp_socket_t socket,uint16_t local_port);
+uint16_t udp_get_local_port(udp_socket_t socket);
 
 void udp_print_stat(FILE * fh);
 
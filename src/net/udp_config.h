@@ -12,5 +12,10 @@
 #include "net_config.h"
 
 #define UDP_SOCKET_MAX	4
+/* buckets of the local port index, power of 2 */
+#define UDP_HASH_SIZE	8
+/* local ports given to sockets allocated with UDP_PORT_ANY */
+#define UDP_PORT_EPHEMERAL_FIRST	49152
+#define UDP_PORT_EPHEMERAL_LAST		65535
 
 #endif //_UDP_CONFIG_H
\ No newline at end of file
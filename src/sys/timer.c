@@ -7,6 +7,7 @@
  */
 
 #include <string.h>
+#include <util/atomic.h>
 
 #include "timer.h"
 
@@ -30,6 +31,10 @@ struct timer_core
 };
 
 static struct timer_core timer_cores[TIMER_MAX]; // EXMEM
+/* ticks counted by timer_tick() which were not handled by timer_poll() */
+static volatile uint16_t timer_ticks;
+/* milliseconds applied by timer_poll() since timer_init() */
+static uint32_t timer_now_ms;
 static timer_t timer_number(const struct timer_core * timer);
 static uint8_t timer_valid(const timer_t timer);
 
@@ -42,12 +47,51 @@ void timer_init(void)
 	{
 		memset(timer,0,sizeof(*timer));
 	}
+	timer_ticks = 0;
+	timer_now_ms = 0;
 }
 
+/**
+* Returns the time in ms at which the main loop runs, it wraps around
+* after 49 days so times are compared by their signed difference
+*/
+uint32_t timer_now(void)
+{
+	return timer_now_ms;
+}
+
+/**
+* Counts a tick, called from the timer interrupt. The timers are updated
+* and their callbacks run by timer_poll() from the main loop.
+*/
 void timer_tick()
+{
+	timer_ticks++;
+}
+
+/**
+* Applies the ticks counted since the previous call and runs callbacks of
+* expired timers. Ticks counted while the main loop is busy are not lost,
+* a periodic timer keeps its phase and fires once for missed periods.
+*/
+void timer_poll()
 {
 	struct timer_core * timer;
-	DBG_INFO("timer tick\n");
+	uint16_t ticks;
+	int32_t elapsed;
+	
+	/* the caller may run with interrupts disabled, keep them that way */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = timer_ticks;
+		timer_ticks = 0;
+	}
+	if(!ticks)
+	{
+		return;
+	}
+	elapsed = (int32_t)ticks * TIMER_MS_PER_TICK;
+	timer_now_ms += elapsed;
 	FOREACH_TIMER(timer)
 	{
 		/* Skip unused timers (without callback) */
@@ -61,18 +105,23 @@ void timer_tick()
 			continue;
 		}
 
-		timer->ms_left -= TIMER_MS_PER_TICK;
+		timer->ms_left -= elapsed;
 		if(timer->ms_left < 0)
 		{
-			timer->callback(timer_number(timer),timer->arg);
+			/* update state before callback, so the callback can set the timer again */
 			if(TIMER_MODE_PERIODIC == timer->mode)
 			{
-				timer->ms_left = timer->ms_org;
+				timer->ms_left += timer->ms_org + TIMER_MS_PER_TICK;
+				if(timer->ms_left < 0)
+				{
+					timer->ms_left = timer->ms_org;
+				}
 			}
 			else
 			{
 				timer->state = TIMER_STATE_STOPPED;
 			}
+			timer->callback(timer_number(timer),timer->arg);
 		}
 
 	}
@@ -174,7 +223,7 @@ static timer_t timer_number(const struct timer_core * timer)
 	{
 		return -1;
 	}
-	timer_t ret = (timer_t)(((uint16_t)timer - (uint16_t)&timer_cores[0])/sizeof(struct timer_core));
+	timer_t ret = (timer_t)(timer - &timer_cores[0]);
 	if (timer_valid(ret))
 	{
 		return ret;
@@ -24,9 +24,11 @@ typedef void (*timer_callback_t)(timer_t timer,void * arg);
 
 void timer_init(void);
 void timer_tick(void);
+void timer_poll(void);
 uint8_t timer_set(timer_t timer,int32_t ms, timer_mode_t);
 uint8_t timer_stop(timer_t timer);
 int32_t timer_get_time(timer_t timer);
+uint32_t timer_now(void);
 
 timer_t timer_alloc(timer_callback_t callback);
 void timer_free(timer_t);
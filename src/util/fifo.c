@@ -11,6 +11,7 @@
 
 #include "fifo.h"
 #include "../arch/exmem.h"
+#include "../net/net.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -28,9 +29,14 @@ static struct fifo fifos[FIFO_MAX_COUNT]; // EXMEM
 #define FOREACH_FIFO(fifo) for(fifo = &fifos[0] ; fifo < &fifos[FIFO_MAX_COUNT]; fifo++)
 
 #define FIFO_WRITE_FLAG_PGM		0x80
+#define FIFO_WRITE_FLAG_CSUM		0x40
+
+#define FIFO_SWAP16(val)	((uint16_t)(((val) << 8) | ((val) >> 8)))
 
 static uint8_t fifo_valid(struct fifo * fifo);
-static uint16_t fifo_write(struct fifo * fifo,const void * data,uint16_t len,uint8_t mode);
+static uint16_t fifo_write(struct fifo * fifo,const void * data,uint16_t len,uint8_t mode,uint16_t checksum);
+static uint16_t fifo_read(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset,uint16_t * checksum);
+static uint16_t fifo_copy_checksum(uint8_t * dst,const uint8_t * src,uint16_t len,uint16_t checksum,uint16_t done);
 
 void fifo_init()
 {
@@ -91,44 +97,108 @@ uint16_t fifo_space(struct fifo * fifo)
 	return (FIFO_SIZE-fifo->length);
 }
 
-uint16_t fifo_write(struct fifo * fifo,const void * data,uint16_t len,uint8_t mode)
+/**
+ * Copies data and adds it to the checksum. Data is a continuation of
+ * done bytes already summed, if done is odd the first byte is the low
+ * byte of a word. In this case the sum is computed byte swapped.
+ */
+uint16_t fifo_copy_checksum(uint8_t * dst,const uint8_t * src,uint16_t len,uint16_t checksum,uint16_t done)
+{
+	if(done & 1)
+		return FIFO_SWAP16(net_copy_checksum(dst,src,len,FIFO_SWAP16(checksum)));
+	return net_copy_checksum(dst,src,len,checksum);
+}
+
+uint16_t fifo_write(struct fifo * fifo,const void * data,uint16_t len,uint8_t mode,uint16_t checksum)
 {
 	if(!fifo_valid(fifo))
 		return 0;
 	if(fifo->length + len > FIFO_SIZE)
-			len = FIFO_SIZE - fifo->length;
+	{
+		/* data with checksum is enqueued only as a whole */
+		if(mode & FIFO_WRITE_FLAG_CSUM)
+			return 0;
+		len = FIFO_SIZE - fifo->length;
+	}
 	if(!len)
 		return 0;
 	uint16_t ret = len;
-	fifo->length += len;
-	uint16_t bytes_to_bound = (uint16_t)&fifo->buffer[FIFO_SIZE] - (uint16_t)fifo->last;
+	/* fifo is updated after data is copied, so it can be dropped if checksum is invalid */
+	uint8_t * last = fifo->last;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - last);
 	if(len > bytes_to_bound)
 	{
 		if(mode & FIFO_WRITE_FLAG_PGM)
-			memcpy_P(fifo->last,(prog_uint8_t*)data,bytes_to_bound);
+			memcpy_P(last,(prog_uint8_t*)data,bytes_to_bound);
+		else if(mode & FIFO_WRITE_FLAG_CSUM)
+			checksum = fifo_copy_checksum(last,(const uint8_t*)data,bytes_to_bound,checksum,0);
 		else
-			memcpy(fifo->last,(uint8_t*)data,bytes_to_bound);
+			memcpy(last,(uint8_t*)data,bytes_to_bound);
 		len -= bytes_to_bound;
-		fifo->last = fifo->buffer;
+		last = fifo->buffer;
 		data += bytes_to_bound;
 	}
 	if(mode & FIFO_WRITE_FLAG_PGM)
-		memcpy_P(fifo->last,(prog_uint8_t*)data,len);
+		memcpy_P(last,(prog_uint8_t*)data,len);
+	else if(mode & FIFO_WRITE_FLAG_CSUM)
+		checksum = fifo_copy_checksum(last,(const uint8_t*)data,len,checksum,ret - len);
 	else
-		memcpy(fifo->last,(uint8_t*)data,len);
-	fifo->last += len;
-	if(fifo->last >= &fifo->buffer[FIFO_SIZE])
-		fifo->last = fifo->buffer;
+		memcpy(last,(uint8_t*)data,len);
+	if((mode & FIFO_WRITE_FLAG_CSUM) && checksum != 0xffff)
+		return 0;
+	last += len;
+	if(last >= &fifo->buffer[FIFO_SIZE])
+		last = fifo->buffer;
+	fifo->last = last;
+	fifo->length += ret;
 	return ret;		
 }
 uint16_t fifo_enqueue(struct fifo * fifo,const uint8_t * data,uint16_t len)
 {
-	return fifo_write(fifo,(void*)data,len,0);
+	return fifo_write(fifo,(void*)data,len,0,0);
 }
 
 uint16_t fifo_enqueue_P(struct fifo * fifo,const prog_uint8_t * data,uint16_t len)
 {
-	return fifo_write(fifo,(void*)data,len,FIFO_WRITE_FLAG_PGM);
+	return fifo_write(fifo,(void*)data,len,FIFO_WRITE_FLAG_PGM,0);
+}
+
+/**
+ * Enqueues data and verifies checksum in one pass. Checksum is the sum
+ * of all other checksummed data (e.g. pseudo header and header including
+ * checksum field). Data is enqueued only if it fits into the fifo and
+ * the checksum of everything is valid, otherwise 0 is returned.
+ */
+uint16_t fifo_enqueue_csum(struct fifo * fifo,const uint8_t * data,uint16_t len,uint16_t checksum)
+{
+	return fifo_write(fifo,(void*)data,len,FIFO_WRITE_FLAG_CSUM,checksum);
+}
+
+/**
+ * Enqueues len bytes read by reader starting at offset of its source
+ * directly into the fifo buffer. Data is enqueued only as a whole.
+ */
+uint16_t fifo_enqueue_stream(struct fifo * fifo,fifo_reader reader,uint16_t offset,uint16_t len)
+{
+	if(!fifo_valid(fifo))
+		return 0;
+	if(!len || fifo->length + len > FIFO_SIZE)
+		return 0;
+	uint16_t ret = len;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - fifo->last);
+	if(len > bytes_to_bound)
+	{
+		reader(offset,fifo->last,bytes_to_bound);
+		len -= bytes_to_bound;
+		offset += bytes_to_bound;
+		fifo->last = fifo->buffer;
+	}
+	reader(offset,fifo->last,len);
+	fifo->last += len;
+	if(fifo->last >= &fifo->buffer[FIFO_SIZE])
+		fifo->last = fifo->buffer;
+	fifo->length += ret;
+	return ret;
 }
 
 uint16_t fifo_dequeue(struct fifo * fifo,uint8_t * data,uint16_t len)
@@ -141,7 +211,7 @@ uint16_t fifo_dequeue(struct fifo * fifo,uint8_t * data,uint16_t len)
 		return 0;
 	fifo->length -= len;
 	uint16_t ret = len;
-	uint16_t bytes_to_bound = (uint16_t)&fifo->buffer[FIFO_SIZE] - (uint16_t)fifo->first;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - fifo->first);
 	if(len > bytes_to_bound)
 	{
 		memcpy(data,fifo->first,bytes_to_bound);
@@ -155,7 +225,7 @@ uint16_t fifo_dequeue(struct fifo * fifo,uint8_t * data,uint16_t len)
 		fifo->first = fifo->buffer;
 	return ret;
 }
-uint16_t fifo_peek(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset)
+uint16_t fifo_read(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset,uint16_t * checksum)
 {
 	/* check if fifo pointer is valid */
 	if(!fifo_valid(fifo))
@@ -172,7 +242,7 @@ uint16_t fifo_peek(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offse
 	/* we cannot modify any pointer of fifo so we use temp pointer */
 	uint8_t * ptr = fifo->first;
 	/* get number of bytes to boundary of fifo's buffer */
-	uint16_t bytes_to_bound = (uint16_t)&fifo->buffer[FIFO_SIZE] - (uint16_t)ptr;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - ptr);
 	/* if number bytes to skip exceeds number of bytes to boundary 
 		set temp pointer to beggining of the buffer and decrease number of bytes to skip left */
 	if(offset > bytes_to_bound)
@@ -183,20 +253,74 @@ uint16_t fifo_peek(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offse
 	/* update pointer */
 	ptr += offset;
 	/* do the same for number of bytes to peek */
-	bytes_to_bound = (uint16_t)&fifo->buffer[FIFO_SIZE] - (uint16_t)ptr;
+	bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - ptr);
 	if(len > bytes_to_bound)
 	{
 		/* copy part of bytes up to boundary */
-		memcpy(data,ptr,bytes_to_bound);
+		if(checksum)
+			*checksum = fifo_copy_checksum(data,ptr,bytes_to_bound,*checksum,0);
+		else
+			memcpy(data,ptr,bytes_to_bound);
 		/* update length and pointer */
 		len -= bytes_to_bound;
 		ptr = fifo->buffer;
 		data += bytes_to_bound;
 	}
 	/* copy the rest */
-	memcpy(data,ptr,len);
+	if(checksum)
+		*checksum = fifo_copy_checksum(data,ptr,len,*checksum,ret - len);
+	else
+		memcpy(data,ptr,len);
 	return ret;
 }
+uint16_t fifo_peek(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset)
+{
+	return fifo_read(fifo,data,len,offset,0);
+}
+
+/**
+ * Peeks data and adds it to the checksum in one pass
+ */
+uint16_t fifo_peek_csum(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset,uint16_t * checksum)
+{
+	return fifo_read(fifo,data,len,offset,checksum);
+}
+/**
+ * Describes up to len bytes at offset of the fifo without copying them,
+ * the data is split into two spans if it wraps around the end of the
+ * buffer. The spans are valid until the fifo is modified.
+ * @returns Number of spans, 0 if there is no data at offset
+ */
+uint8_t fifo_peek_spans(struct fifo * fifo,struct net_span * spans,uint16_t len,uint16_t offset)
+{
+	if(!fifo_valid(fifo) || offset >= fifo->length)
+		return 0;
+	if(len > fifo->length - offset)
+		len = fifo->length - offset;
+	if(!len)
+		return 0;
+	uint8_t * ptr = fifo->first;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - ptr);
+	if(offset >= bytes_to_bound)
+	{
+		offset -= bytes_to_bound;
+		ptr = fifo->buffer;
+	}
+	ptr += offset;
+	bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - ptr);
+	spans[0].data = ptr;
+	spans[0].pgm = 0;
+	if(len <= bytes_to_bound)
+	{
+		spans[0].len = len;
+		return 1;
+	}
+	spans[0].len = bytes_to_bound;
+	spans[1].data = fifo->buffer;
+	spans[1].len = len - bytes_to_bound;
+	spans[1].pgm = 0;
+	return 2;
+}
 uint16_t fifo_skip(struct fifo * fifo,uint16_t len)
 {
 	/* check if fifo pointer is valid*/
@@ -214,7 +338,7 @@ uint16_t fifo_skip(struct fifo * fifo,uint16_t len)
 	/* update fifo's length */
 	fifo->length -= len;
 	/* get number of bytes to boundary of fifo's buffer */
-	uint16_t bytes_to_bound = (uint16_t)&fifo->buffer[FIFO_SIZE] - (uint16_t)fifo->first;
+	uint16_t bytes_to_bound = (uint16_t)(&fifo->buffer[FIFO_SIZE] - fifo->first);
 	/* if number bytes to skip exceeds number of bytes to boundary 
 	set fifo's first pointer to beggining of the buffer and decrease number of bytes to skip left*/
 	if(len > bytes_to_bound)
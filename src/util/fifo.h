@@ -13,10 +13,16 @@
 
 #include <stdint.h>
 #include <avr/pgmspace.h>
+#include "../net/net.h"
 
 
 struct fifo;
 
+/**
+* Supplies len bytes at offset of the source of fifo_enqueue_stream()
+*/
+typedef void (*fifo_reader)(uint16_t offset,uint8_t * data,uint16_t len);
+
 struct fifo * fifo_alloc(void);
 void fifo_free(struct fifo * fifo);
 void fifo_init(void);
@@ -27,8 +33,12 @@ uint16_t fifo_size(struct fifo * fifo);
 uint16_t fifo_space(struct fifo * fifo);
 uint16_t fifo_enqueue(struct fifo * fifo,const uint8_t * data,uint16_t len);
 uint16_t fifo_enqueue_P(struct fifo * fifo,const prog_uint8_t * data,uint16_t len);
+uint16_t fifo_enqueue_csum(struct fifo * fifo,const uint8_t * data,uint16_t len,uint16_t checksum);
+uint16_t fifo_enqueue_stream(struct fifo * fifo,fifo_reader reader,uint16_t offset,uint16_t len);
 uint16_t fifo_dequeue(struct fifo * fifo,uint8_t * data,uint16_t len); 
 uint16_t fifo_peek(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset);
+uint16_t fifo_peek_csum(struct fifo * fifo,uint8_t * data,uint16_t len,uint16_t offset,uint16_t * checksum);
+uint8_t fifo_peek_spans(struct fifo * fifo,struct net_span * spans,uint16_t len,uint16_t offset);
 uint16_t fifo_skip(struct fifo * fifo,uint16_t len);
 
 // #ifdef DEBUG_MODE